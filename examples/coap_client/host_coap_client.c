@@ -0,0 +1,296 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/random.h>
+#include <arpa/inet.h>
+
+#include "port_common.h"
+
+#include "coapClient.h"
+#include "coapTrace.h"
+
+#include "timer.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Buffer */
+#define ETHERNET_BUF_MAX_SIZE (1024 * 2)
+
+/* Socket */
+#define SOCKET_COAP 0
+
+/* Port */
+#define PORT_COAP 5683
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* COAP */
+static uint8_t g_coap_send_buf[ETHERNET_BUF_MAX_SIZE] = {
+    0,
+};
+static uint8_t g_coap_recv_buf[ETHERNET_BUF_MAX_SIZE] = {
+    0,
+};
+static uint8_t g_coap_req_buf[128] = {
+    0,
+};
+coap_prepared_t tx_req;
+static volatile bool g_observing = false;
+static int g_notifications = 0;
+static volatile bool g_downloading = false;
+static uint32_t g_checksum = 0;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* COAP */
+static void coap_response_callback(int rc, const coap_packet_t *rsp, void *arg);
+static void coap_observe_callback(int rc, const coap_packet_t *rsp, void *arg);
+static int coap_download_sink(size_t offset, const uint8_t *buf, size_t len, void *arg);
+static void coap_download_done(int rc, size_t total, void *arg);
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------------------------------------
+ */
+
+/* Usage : host_coap_client [server ip] [server port] [uri path] [count] [parallel] [cache|observe|download|idle] */
+int main(int argc, char *argv[])
+{
+    uint8_t destip[4] = {127, 0, 0, 1};
+    uint16_t destport = PORT_COAP;
+    const char *uri_path = ".well-known/core";
+    int count = -1;
+    int parallel = 1;
+    bool use_cache = false;
+    bool use_observe = false;
+    bool use_download = false;
+    bool use_idle = false;
+    unsigned int submitted = 0;
+    uint8_t observation;
+    const wizhost_impair_stats_t *tx, *rx;
+    uint64_t start_us;
+    uint32_t seed;
+    int i, ret;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    if (argc > 1 && inet_pton(AF_INET, argv[1], destip) != 1)
+    {
+        printf("Invalid server ip: %s\n", argv[1]);
+        return 1;
+    }
+    if (argc > 2)
+        destport = (uint16_t)atoi(argv[2]);
+    if (argc > 3)
+        uri_path = argv[3];
+    if (argc > 4)
+        count = atoi(argv[4]);
+    if (argc > 5)
+        parallel = atoi(argv[5]);
+    if (argc > 6 && 0 == strcmp(argv[6], "cache"))
+        use_cache = true;
+    if (argc > 6 && 0 == strcmp(argv[6], "observe"))
+        use_observe = true;
+    if (argc > 6 && 0 == strcmp(argv[6], "download"))
+        use_download = true;
+    if (argc > 6 && 0 == strcmp(argv[6], "idle"))
+        use_idle = true;
+
+    start_us = time_us_64();
+
+    /* Time base of the client, no 1 ms timer thread */
+    coapClient_setClock(time_us_64);
+    if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed))
+    {
+        printf("Failed to get a random seed\n");
+        return 1;
+    }
+    if ((ret = coapClient_init(g_coap_send_buf, sizeof(g_coap_send_buf), g_coap_recv_buf, sizeof(g_coap_recv_buf), SOCKET_COAP, seed)) != 0)
+    {
+        printf("Failed to initialize CoAP client, error code: %d\n", ret);
+        return 1;
+    }
+    coap_trace_setClock(time_us_64);
+    coapClient_setDestination(destip, destport);
+    coapClient_setCache(use_cache);
+
+    /* Encoded once, each submit only stamps a message ID and token */
+    if ((ret = coap_prepare_request(&tx_req, g_coap_req_buf, sizeof(g_coap_req_buf), COAP_TYPE_CON, COAP_METHOD_GET, (const uint8_t *)uri_path, strlen(uri_path), NULL, 0, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT)) != 0)
+    {
+        printf("Failed to prepare CoAP request, error code: %d\n", ret);
+        return 1;
+    }
+
+    /* Register once, notifications then arrive without polling, count of them are received */
+    if (use_observe)
+    {
+        if ((ret = coapClient_observe(NULL, 0, &tx_req, coap_observe_callback, NULL, &observation)) != 0)
+        {
+            printf("Failed to observe, error code: %d\n", ret);
+            return 1;
+        }
+        g_observing = true;
+        while (g_observing && (count < 0 || g_notifications < count))
+        {
+            coapClient_run();
+            wizchip_delay_ms(1);
+        }
+        coapClient_cancelObserve(observation);
+        count = 0;
+    }
+
+    /* Fetch the resource in 16 byte blocks, parallel of them at once */
+    if (use_download)
+    {
+        if ((ret = coapClient_download(NULL, 0, &tx_req, 0, (uint8_t)parallel, coap_download_sink, coap_download_done, NULL)) != 0)
+        {
+            printf("Failed to start download, error code: %d\n", ret);
+            return 1;
+        }
+        g_downloading = true;
+        while (g_downloading)
+        {
+            coapClient_run();
+            wizchip_delay_ms(1);
+        }
+        count = 0;
+    }
+
+    /* Submit parallel requests at once, the next round once they all completed */
+    while (count != 0 || coapClient_pending() > 0)
+    {
+        if (count != 0 && coapClient_pending() == 0)
+        {
+            /* Sleep between rounds like the W5x00 example, coapClient_run() is not called meanwhile */
+            if (use_idle && submitted > 0)
+                wizchip_delay_ms(1000);
+            for (i = 0; i < parallel; i++)
+            {
+                if ((ret = coapClient_submitPrepared(NULL, 0, &tx_req, coap_response_callback, NULL)) != 0)
+                    printf("Failed to submit CoAP request, error code: %d\n", ret);
+                else
+                    submitted++;
+            }
+            if (count > 0)
+                count--;
+        }
+
+        coapClient_run();
+        wizchip_delay_ms(1);
+    }
+
+    printf("Estimated RTO of the server: %u ms\n", (unsigned int)coapClient_getRto(destip, destport));
+
+    /* Datagrams against completed requests are the retransmission overhead, e.g. under WIZHOST_IMPAIR */
+    tx = wizhost_impair_stats(WIZHOST_IMPAIR_TX);
+    rx = wizhost_impair_stats(WIZHOST_IMPAIR_RX);
+    printf("Completed in %u ms, %u datagrams sent, %u received\n", (unsigned int)((time_us_64() - start_us) / 1000),
+           (unsigned int)tx->datagrams, (unsigned int)rx->datagrams);
+    if (tx->dropped + tx->duplicated + tx->delayed + rx->dropped + rx->duplicated + rx->delayed != 0)
+        printf("Impaired: tx %u dropped, %u duplicated, %u reordered, %u delayed; rx %u dropped, %u duplicated, %u reordered, %u delayed\n",
+               (unsigned int)tx->dropped, (unsigned int)tx->duplicated, (unsigned int)tx->reordered, (unsigned int)tx->delayed,
+               (unsigned int)rx->dropped, (unsigned int)rx->duplicated, (unsigned int)rx->reordered, (unsigned int)rx->delayed);
+    if (use_cache)
+    {
+        const coap_client_cache_stats_t *stats = coapClient_getCacheStats();
+
+        printf("Cache: %u hits, %u misses, %u stale, %u revalidated\n", (unsigned int)stats->hits, (unsigned int)stats->misses,
+               (unsigned int)stats->stale, (unsigned int)stats->revalidated);
+    }
+#if COAP_TRACE
+    coap_trace_dump();
+#endif
+
+    /* Nothing was lost or late, so each request must have gone out once. A retransmission after the
+     * idle time means its timer counted the sleep, e.g. it was started on a wheel not advanced since. */
+    if (use_idle && tx->dropped + tx->delayed + rx->dropped + rx->delayed == 0 && tx->datagrams != submitted)
+    {
+        printf("Idle check failed: %u datagrams sent for %u requests\n", (unsigned int)tx->datagrams, submitted);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* COAP */
+static void coap_response_callback(int rc, const coap_packet_t *rsp, void *arg)
+{
+    (void)arg;
+
+    if (rc == COAP_ERR_TIMEOUT)
+        printf("Failed to receive response from the server: give up after 4 attempts\n");
+    else if (rc != 0)
+        printf("Request failed, error code: %d\n", rc);
+    else
+        coap_handle_response(rsp);
+}
+
+static void coap_observe_callback(int rc, const coap_packet_t *rsp, void *arg)
+{
+    coap_option_iter_t it;
+
+    (void)arg;
+
+    if (rc != 0 || rsp == NULL || coap_findOptions(rsp, COAP_OPTION_OBSERVE, &it) == 0)
+    {
+        printf("Observation ended, error code: %d\n", rc);
+        g_observing = false;
+        if (rc == 0 && rsp != NULL)
+            coap_handle_response(rsp);
+        return;
+    }
+    g_notifications++;
+    coap_handle_response(rsp);
+}
+
+/* Blocks may come out of order, the checksum does not depend on it */
+static int coap_download_sink(size_t offset, const uint8_t *buf, size_t len, void *arg)
+{
+    size_t i;
+
+    (void)arg;
+
+    for (i = 0; i < len; i++)
+        g_checksum += (uint32_t)buf[i] * (uint32_t)(offset + i + 1);
+    return 0;
+}
+
+static void coap_download_done(int rc, size_t total, void *arg)
+{
+    (void)arg;
+
+    if (rc != 0)
+        printf("Download failed after %u bytes, error code: %d\n", (unsigned int)total, rc);
+    else
+        printf("Downloaded %u bytes, checksum %08x\n", (unsigned int)total, (unsigned int)g_checksum);
+    g_downloading = false;
+}
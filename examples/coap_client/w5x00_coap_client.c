@@ -13,11 +13,13 @@
 #include <string.h>
 
 #include "port_common.h"
+#include "pico/rand.h"
 
 #include "wizchip_conf.h"
 #include "w5x00_spi.h"
 
 #include "coapClient.h"
+#include "coapTrace.h"
 
 #include "timer.h"
 
@@ -63,10 +65,10 @@ static uint8_t g_coap_send_buf[ETHERNET_BUF_MAX_SIZE] = {
 static uint8_t g_coap_recv_buf[ETHERNET_BUF_MAX_SIZE] = {
     0,
 };
-coap_packet_t tx_pkt;
-
-/* Timer  */
-static volatile uint32_t g_msec_cnt = 0;
+static uint8_t g_coap_req_buf[128] = {
+    0,
+};
+coap_prepared_t tx_req;
 
 /**
  * ----------------------------------------------------------------------------------------------------
@@ -77,9 +79,11 @@ static volatile uint32_t g_msec_cnt = 0;
 static void set_clock_khz(void);
 
 /* Timer  */
-static void repeating_timer_callback(void);
 static time_t millis(void);
 
+/* COAP */
+static void coap_response_callback(int rc, const coap_packet_t *rsp, void *arg);
+
 /**
  * ----------------------------------------------------------------------------------------------------
  * Main
@@ -91,8 +95,8 @@ int main()
     /* Initialize */
     int retval = 0;
     int32_t ret;
-    uint8_t scratch_raw[ETHERNET_BUF_MAX_SIZE];
-    coap_rw_buffer_t scratch_buf = {scratch_raw, sizeof(scratch_raw)};
+    time_t last_submit = 0;
+    time_t idle;
     uint8_t payload[] = ""; 
     uint8_t uri_path[] = ".well-known/core"; 
     size_t payload_len = strlen((char *)payload);
@@ -109,21 +113,38 @@ int main()
     wizchip_initialize();
     wizchip_check();
 
-    wizchip_1ms_timer_initialize(repeating_timer_callback);
-
     network_initialize(g_net_info);
 
     /* Get network information */
     print_network_information(g_net_info);
 
-    coapClient_init(g_coap_send_buf, g_coap_recv_buf, SOCKET_COAP);
+    /* The 64 bit hardware timer is the time base, no 1 ms interrupt */
+    coapClient_setClock(time_us_64);
+    coapClient_init(g_coap_send_buf, sizeof(g_coap_send_buf), g_coap_recv_buf, sizeof(g_coap_recv_buf), SOCKET_COAP, get_rand_32());
+    coap_trace_setClock(time_us_64);
 
-    coap_make_request(&scratch_buf, &tx_pkt, uri_path, uri_path_len, payload, payload_len, 0x12, 0x34, NULL, COAP_METHOD_GET, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT);
+    /* Encoded once, each submit only stamps a message ID and token */
+    coap_prepare_request(&tx_req, g_coap_req_buf, sizeof(g_coap_req_buf), COAP_TYPE_CON, COAP_METHOD_GET, uri_path, uri_path_len, payload, payload_len, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT);
 
     while(1)
     {
+        /* Submit a request every second, coapClient_run() never blocks so the loop is free for other work */
+        if (millis() - last_submit >= 1000)
+        {
+            last_submit = millis();
+            if ((ret = coapClient_submitPrepared(NULL, 0, &tx_req, coap_response_callback, NULL)) != 0)
+                printf("Failed to submit CoAP request, error code: %ld\n", ret);
+        }
+
         coapClient_run();
-        sleep_ms(1000);
+
+        /* Nothing in flight, so nothing to receive : sleep until the next submit on a one-shot alarm */
+        idle = millis() - last_submit;
+        if (coapClient_pending() == 0 && idle < 1000)
+        {
+            wizchip_alarm_ms((uint32_t)(1000 - idle), NULL);
+            __wfe();
+        }
     }
     
 }
@@ -150,14 +171,20 @@ static void set_clock_khz(void)
 }
 
 /* Timer */
-static void repeating_timer_callback(void)
+static time_t millis(void)
 {
-    g_msec_cnt++;
-
-    MilliTimer_Handler();
+    return (time_t)(time_us_64() / 1000);
 }
 
-static time_t millis(void)
+/* COAP */
+static void coap_response_callback(int rc, const coap_packet_t *rsp, void *arg)
 {
-    return g_msec_cnt;
-}
\ No newline at end of file
+    (void)arg;
+
+    if (rc == COAP_ERR_TIMEOUT)
+        printf("Failed to receive response from the server: give up after 4 attempts\n");
+    else if (rc != 0)
+        printf("Request failed, error code: %d\n", rc);
+    else
+        coap_handle_response(rsp);
+}
@@ -5,10 +5,12 @@
 
 // static char light = '0';
 static uint8_t example_data[256] = {'0',};
+static size_t example_data_next = 0;    // offset the next Block1 block of an upload must start at
+static size_t example_data_prev = 0;    // offset of the last Block1 block, rewritten if it is sent again
 
-const uint16_t rsplen = 1500;
-static char rsp[1500] = "";
-void build_rsp(void);
+// /.well-known/core is generated block by block from endpoints[], its length is computed once
+static size_t link_format_len = 0;
+static int link_format_walk(coap_writer_t *w, size_t offset, size_t len, size_t *total);
 
 #include <stdio.h>
 
@@ -16,77 +18,119 @@ extern  uint8_t led_pin;
 
 void endpoint_setup(void)
 {
-    build_rsp();
+    link_format_walk(NULL, 0, 0, &link_format_len);
 }
 
 static const coap_endpoint_path_t path_well_known_core = {2, {".well-known", "core"}};
-static int handle_get_well_known_core(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+static int link_format_read(coap_writer_t *w, size_t offset, size_t len, void *arg)
 {
-    return coap_make_response(scratch, outpkt, (const uint8_t *)rsp, strlen(rsp), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT);
+    size_t total;
+
+    return link_format_walk(w, offset, len, &total);
 }
 
-static const coap_endpoint_path_t path_example_data = {1, {"example_data"}};
-static int handle_get_example_data(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+static int handle_get_well_known_core(coap_arena_t *arena, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
 {
-    return coap_make_response(scratch, outpkt, (const uint8_t *)example_data, strlen(example_data), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
+    return coap_make_block2_response(arena, outpkt, inpkt, link_format_read, NULL, link_format_len, id_hi, id_lo, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT);
 }
 
-static int handle_put_example_data(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+static const coap_endpoint_path_t path_example_data = {1, {"example_data"}};
+static int handle_get_example_data(coap_arena_t *arena, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
 {
-    if (inpkt->payload.len == 0)
-        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN);
+    return coap_make_response(arena, outpkt, (const uint8_t *)example_data, strlen(example_data), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
+}
 
-    memset(example_data, 0x0, 256 * sizeof(uint8_t));
-    memcpy(example_data, inpkt->payload.p, inpkt->payload.len);
-    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CHANGED, COAP_CONTENTTYPE_TEXT_PLAIN);
+static const coap_template_t tpl_bad_request = COAP_TEMPLATE_INIT(COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN, NULL, 0);
+static const coap_template_t tpl_changed = COAP_TEMPLATE_INIT(COAP_RSPCODE_CHANGED, COAP_CONTENTTYPE_TEXT_PLAIN, NULL, 0);
+static const coap_template_t tpl_too_large = COAP_TEMPLATE_INIT(COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE, COAP_CONTENTTYPE_TEXT_PLAIN, NULL, 0);
+static const coap_template_t tpl_incomplete = COAP_TEMPLATE_INIT(COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE, COAP_CONTENTTYPE_TEXT_PLAIN, NULL, 0);
+static int handle_put_example_data(coap_arena_t *arena, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    coap_block_t blk;
+    coap_block_result_t found = coap_block_get(inpkt, COAP_OPTION_BLOCK1, &blk);
+    bool block = (COAP_BLOCK_VALID == found);
+    size_t offset = block ? COAP_BLOCK_OFFSET(&blk) : 0;
+
+    if (COAP_BLOCK_INVALID == found || (!block && inpkt->payload.len == 0))
+        return coap_make_template_response(outpkt, &tpl_bad_request, id_hi, id_lo, &inpkt->tok);
+    // keep the terminating NUL
+    if (offset + inpkt->payload.len >= sizeof(example_data))
+        return coap_make_template_response(outpkt, &tpl_too_large, id_hi, id_lo, &inpkt->tok);
+    // only the last block may be shorter than the block size
+    if (block && blk.more && inpkt->payload.len != COAP_BLOCK_SIZE(blk.szx))
+        return coap_make_template_response(outpkt, &tpl_bad_request, id_hi, id_lo, &inpkt->tok);
+    // Block1 blocks are consumed in order as they arrive, a repeat of the last one is written again
+    if (offset != 0 && offset != example_data_next && offset != example_data_prev)
+        return coap_make_template_response(outpkt, &tpl_incomplete, id_hi, id_lo, &inpkt->tok);
+
+    if (offset == 0)
+        memset(example_data, 0x0, sizeof(example_data));
+    memcpy(example_data + offset, inpkt->payload.p, inpkt->payload.len);
+    example_data_prev = offset;
+    example_data_next = offset + inpkt->payload.len;
+
+    if (block && blk.more)
+        return coap_make_block1_response(arena, outpkt, &blk, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTINUE);
+
+    coapServer_notify(&path_example_data);
+    if (block)
+        return coap_make_block1_response(arena, outpkt, &blk, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CHANGED);
+    return coap_make_template_response(outpkt, &tpl_changed, id_hi, id_lo, &inpkt->tok);
 }
 
 const coap_endpoint_t endpoints[] =
 {
-    {COAP_METHOD_GET, handle_get_well_known_core, &path_well_known_core, "ct=40"},
-    {COAP_METHOD_GET, handle_get_example_data, &path_example_data, "ct=0"},
-    {COAP_METHOD_PUT, handle_put_example_data, &path_example_data, NULL},
-    {(coap_method_t)0, NULL, NULL, NULL}
+    {COAP_METHOD_GET, handle_get_well_known_core, &path_well_known_core, "ct=40", NULL},
+    {COAP_METHOD_GET, handle_get_example_data, &path_example_data, "ct=0;obs", NULL},
+    {COAP_METHOD_PUT, handle_put_example_data, &path_example_data, NULL, NULL},
+    {(coap_method_t)0, NULL, NULL, NULL, NULL}
 };
 
-void build_rsp(void)
+// Writes the part of s that falls in [offset, offset + len) of the link format, *pos is where s starts
+static int link_format_put(coap_writer_t *w, size_t *pos, const char *s, size_t offset, size_t len)
 {
-    uint16_t len = rsplen;
-    const coap_endpoint_t *ep = endpoints;
-    int i;
+    size_t n = strlen(s);
+    size_t lo = (*pos > offset) ? *pos : offset;
+    size_t hi = (*pos + n < offset + len) ? *pos + n : offset + len;
+    size_t start = *pos;
+
+    *pos += n;
+    if (NULL == w || lo >= hi)
+        return 0;
+    return coap_write_payload(w, (const uint8_t *)s + (lo - start), hi - lo);
+}
 
-    len--; // Null-terminated string
+// Walks the link format of endpoints[], writing bytes [offset, offset + len) if w is set.
+// Nothing is buffered, so the number of endpoints is not limited by a response buffer.
+static int link_format_walk(coap_writer_t *w, size_t offset, size_t len, size_t *total)
+{
+    const coap_endpoint_t *ep = endpoints;
+    size_t pos = 0;
+    int i, rc = 0;
 
-    while(NULL != ep->handler)
+    while(NULL != ep->path && 0 == rc)
     {
         if (NULL == ep->core_attr) {
             ep++;
             continue;
         }
 
-        if (0 < strlen(rsp)) {
-            strncat(rsp, ",", len);
-            len--;
-        }
+        if (0 < pos)
+            rc |= link_format_put(w, &pos, ",", offset, len);
 
-        strncat(rsp, "<", len);
-        len--;
+        rc |= link_format_put(w, &pos, "<", offset, len);
 
         for (i = 0; i < ep->path->count; i++) {
-            strncat(rsp, "/", len);
-            len--;
-
-            strncat(rsp, ep->path->elems[i], len);
-            len -= strlen(ep->path->elems[i]);
+            rc |= link_format_put(w, &pos, "/", offset, len);
+            rc |= link_format_put(w, &pos, ep->path->elems[i], offset, len);
         }
 
-        strncat(rsp, ">;", len);
-        len -= 2;
-
-        strncat(rsp, ep->core_attr, len);
-        len -= strlen(ep->core_attr);
+        rc |= link_format_put(w, &pos, ">;", offset, len);
+        rc |= link_format_put(w, &pos, ep->core_attr, offset, len);
 
         ep++;
     }
-}
 
+    *total = pos;
+    return rc;
+}
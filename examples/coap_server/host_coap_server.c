@@ -0,0 +1,152 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+#include "port_common.h"
+
+#include "coapServer.h"
+#include "coapPool.h"
+#include "coapTrace.h"
+
+#include "timer.h"
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_gpio_irq.h"
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Buffer */
+#define ETHERNET_BUF_MAX_SIZE (1024 * 2)
+
+/* Socket */
+#define SOCKET_COAP 0
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* COAP */
+static uint8_t g_coap_send_buf[ETHERNET_BUF_MAX_SIZE] = {
+    0,
+};
+static uint8_t g_coap_recv_buf[ETHERNET_BUF_MAX_SIZE] = {
+    0,
+};
+
+/* Stop */
+static volatile sig_atomic_t g_stop = 0;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+static void stop_handler(int sig);
+static void print_stats(void);
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------------------------------------
+ */
+
+int main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    bool irq_mode = (argc > 1 && 0 == strcmp(argv[1], "irq"));
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    // no SA_RESTART, so the signal also ends a poll() in wizchip_gpio_interrupt_wait()
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    endpoint_setup();
+
+    coapServer_init(g_coap_send_buf, g_coap_recv_buf, SOCKET_COAP);
+    coapServer_setClock(time_us_32);
+    coap_trace_setClock(time_us_64);
+
+    if (irq_mode)
+    {
+        printf("Interrupt mode\n");
+        wizchip_gpio_interrupt_initialize(SOCKET_COAP, coapServer_irqHandler);
+    }
+
+    while (!g_stop)
+    {
+        if (!irq_mode)
+            coapServer_run();
+        else if (!coapServer_runIrq())
+        {
+            wizchip_alarm_ms(coapServer_nextTimeoutMs(), coapServer_alarmHandler);
+            wizchip_gpio_interrupt_wait();
+        }
+    }
+
+    print_stats();
+#if COAP_TRACE
+    coap_trace_dump();
+#endif
+
+    return 0;
+}
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+static void stop_handler(int sig)
+{
+    (void)sig;
+
+    g_stop = 1;
+}
+
+static void print_stats(void)
+{
+    const coap_server_stats_t *st = coapServer_getStats();
+    uint32_t i;
+    const coap_pool_t *pool;
+    const coap_endpoint_stats_t *es;
+
+    printf("runs %u, idle runs %u, register reads %u\n", st->runs, st->idle_runs, st->rx_reg_reads);
+    printf("packets %u in %u batches, largest %u, budget hits %u packets %u time\n",
+           st->packets, st->batches, st->batch_max, st->budget_pkts, st->budget_time);
+    printf("batch sizes:");
+    for (i = 1; i <= COAP_SERVER_BATCH_MAX; i++)
+        printf(" %u%s:%u", i, (i == COAP_SERVER_BATCH_MAX) ? "+" : "", st->batch_hist[i]);
+    printf("\n");
+    printf("notifications %u, observers reclaimed %u, timed out %u\n", st->notifications, st->observe_reclaimed, st->observe_timeouts);
+    printf("replay cache hits %u, misses %u, uncached %u\n", st->dedup_hits, st->dedup_misses, st->dedup_uncached);
+    printf("scratch arena peak %u of %u bytes, failed allocations %u\n", st->arena_peak, (uint32_t)COAP_ARENA_SIZE, st->arena_failed);
+    printf("rx %u bytes, tx %u packets %u bytes, 4.04 %u, 4.05 %u, build failed %u, send failed %u\n", st->rx_bytes,
+           st->tx_packets, st->tx_bytes, st->not_found, st->method_not_allowed, st->build_failed, st->send_failed);
+    for (i = 0; NULL != (es = coapServer_getEndpointStats((uint8_t)i)); i++)
+        printf("endpoint %u: %u requests, %u errors\n", i, es->requests, es->errors);
+    for (pool = coap_pool_first(); NULL != pool; pool = pool->next)
+        printf("%s: %u of %u in use, peak %u, allocations %u, failed %u\n", pool->name, pool->used, pool->count,
+               pool->peak, pool->allocs, pool->failed);
+    if (st->irq_wakes > 0)
+        printf("interrupts %u, spurious %u, wake to response avg %u us max %u us\n", st->irq_wakes,
+               st->irq_spurious, st->latency_count ? (uint32_t)(st->latency_sum_us / st->latency_count) : 0,
+               st->latency_max_us);
+}
@@ -16,8 +16,10 @@
 
 #include "wizchip_conf.h"
 #include "w5x00_spi.h"
+#include "w5x00_gpio_irq.h"
 
 #include "coapServer.h"
+#include "coapTrace.h"
 
 #include "timer.h"
 
@@ -40,6 +42,9 @@
 /* Port */
 #define PORT_COAP 5683
 
+/* Server mode, 0 : poll Sn_RX_RSR, 1 : sleep until the socket interrupt */
+#define COAP_IRQ_MODE 1
+
 /**
  * ----------------------------------------------------------------------------------------------------
  * Variables
@@ -85,8 +90,6 @@ int main()
     int retval = 0;
     int32_t ret;
     uint8_t buf[ETHERNET_BUF_MAX_SIZE];
-    uint8_t scratch_raw[ETHERNET_BUF_MAX_SIZE];
-    coap_rw_buffer_t scratch_buf = {scratch_raw, sizeof(scratch_raw)};
 
     set_clock_khz();
 
@@ -107,11 +110,27 @@ int main()
     endpoint_setup();
 
     coapServer_init(g_coap_send_buf, g_coap_recv_buf, SOCKET_COAP);
+    coapServer_setClock(time_us_32);
+    coap_trace_setClock(time_us_64);
+
+#if (COAP_IRQ_MODE == 1)
+    wizchip_gpio_interrupt_initialize(SOCKET_COAP, coapServer_irqHandler);
 
+    while (1)
+    {
+        // the interrupt sets the event register, so an INTn between the two calls is not lost
+        if (!coapServer_runIrq())
+        {
+            wizchip_alarm_ms(coapServer_nextTimeoutMs(), coapServer_alarmHandler);
+            __wfe();
+        }
+    }
+#else
     while (1)
     {
         coapServer_run();
     }
+#endif
 }
 
 /**
@@ -1,674 +1,2154 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include <string.h>
-#include <stddef.h>
-#include "coapClient.h"
-
-#include "socket.h"
-#include "wizchip_conf.h"
-
-//#define DEBUG
-
-#define ACK_TIMEOUT 2000  // 2000ms
-#define ACK_RANDOM_FACTOR 1.5  // 타임아웃 랜덤 계수
-#define MAX_RETRANSMIT 4  // 최대 재전송 횟수
-#define MAX_TRANSMIT_SPAN 45000  // 최대 재전송 시간 (ms 단위)
-
-#define DATA_BUF_SIZE 2048
-
-extern coap_packet_t tx_pkt;
-
-static uint8_t destip[4] = {192, 168, 11, 3};  
-static uint16_t destport = 5683;
-
-uint8_t * pCOAP_TX = NULL;
-uint8_t * pCOAP_RX = NULL;
-
-static uint8_t COAPSock_Num = 0;
-
-unsigned long MilliTimer;
-
-/*
- * @brief MQTT MilliTimer handler
- * @note MUST BE register to your system 1m Tick timer handler.
- */
-void MilliTimer_Handler(void) {
-	MilliTimer++;
-}
-
-/*
- * @brief Timer Initialize
- * @param  timer : pointer to a Timer structure
- *         that contains the configuration information for the Timer.
- */
-void TimerInit(Timer* timer) {
-	timer->end_time = 0;
-}
-
-/*
- * @brief expired Timer
- * @param  timer : pointer to a Timer structure
- *         that contains the configuration information for the Timer.
- */
-char TimerIsExpired(Timer* timer) {
-	long left = timer->end_time - MilliTimer;
-	return (left < 0);
-}
-
-/*
- * @brief Countdown millisecond Timer
- * @param  timer : pointer to a Timer structure
- *         that contains the configuration information for the Timer.
- *         timeout : setting timeout millisecond.
- */
-void TimerCountdownMS(Timer* timer, unsigned int timeout) {
-	timer->end_time = MilliTimer + timeout;
-}
-
-/*
- * @brief Countdown second Timer
- * @param  timer : pointer to a Timer structure
- *         that contains the configuration information for the Timer.
- *         timeout : setting timeout millisecond.
- */
-void TimerCountdown(Timer* timer, unsigned int timeout) {
-	timer->end_time = MilliTimer + (timeout * 1000);
-}
-
-/*
- * @brief left millisecond Timer
- * @param  timer : pointer to a Timer structure
- *         that contains the configuration information for the Timer.
- */
-int TimerLeftMS(Timer* timer) {
-	long left = timer->end_time - MilliTimer;
-	return (left < 0) ? 0 : left;
-}
-
-#ifdef DEBUG
-void coap_dumpHeader(coap_header_t *hdr)
-{
-    printf("Header:\n");
-    printf("  ver  0x%02X\n", hdr->ver);
-    printf("  t    0x%02X\n", hdr->t);
-    printf("  tkl  0x%02X\n", hdr->tkl);
-    printf("  code 0x%02X\n", hdr->code);
-    printf("  id   0x%02X%02X\n", hdr->id[0], hdr->id[1]);
-}
-#endif
-
-#ifdef DEBUG
-void coap_dump(const uint8_t *buf, size_t buflen, bool bare)
-{
-    if (bare)
-    {
-        while(buflen--)
-            printf("%02X%s", *buf++, (buflen > 0) ? " " : "");
-    }
-    else
-    {
-        printf("Dump: ");
-        while(buflen--)
-            printf("%02X%s", *buf++, (buflen > 0) ? " " : "");
-        printf("\n");
-    }
-}
-#endif
-
-int coap_parseHeader(coap_header_t *hdr, const uint8_t *buf, size_t buflen)
-{
-    if (buflen < 4)
-        return COAP_ERR_HEADER_TOO_SHORT;
-    hdr->ver = (buf[0] & 0xC0) >> 6;
-    if (hdr->ver != 1)
-        return COAP_ERR_VERSION_NOT_1;
-    hdr->t = (buf[0] & 0x30) >> 4;
-    hdr->tkl = buf[0] & 0x0F;
-    hdr->code = buf[1];
-    hdr->id[0] = buf[2];
-    hdr->id[1] = buf[3];
-    return 0;
-}
-
-int coap_parseToken(coap_buffer_t *tokbuf, const coap_header_t *hdr, const uint8_t *buf, size_t buflen)
-{
-    if (hdr->tkl == 0)
-    {
-        tokbuf->p = NULL;
-        tokbuf->len = 0;
-        return 0;
-    }
-    else
-    if (hdr->tkl <= 8)
-    {
-        if (4U + hdr->tkl > buflen)
-            return COAP_ERR_TOKEN_TOO_SHORT;   // tok bigger than packet
-        tokbuf->p = buf+4;  // past header
-        tokbuf->len = hdr->tkl;
-        return 0;
-    }
-    else
-    {
-        // invalid size
-        return COAP_ERR_TOKEN_TOO_SHORT;
-    }
-}
-
-// advances p
-int coap_parseOption(coap_option_t *option, uint16_t *running_delta, const uint8_t **buf, size_t buflen)
-{
-    const uint8_t *p = *buf;
-    uint8_t headlen = 1;
-    uint16_t len, delta;
-
-    if (buflen < headlen) // too small
-        return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-
-    delta = (p[0] & 0xF0) >> 4;
-    len = p[0] & 0x0F;
-
-    // These are untested and may be buggy
-    if (delta == 13)
-    {
-        headlen++;
-        if (buflen < headlen)
-            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-        delta = p[1] + 13;
-        p++;
-    }
-    else
-    if (delta == 14)
-    {
-        headlen += 2;
-        if (buflen < headlen)
-            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-        delta = ((p[1] << 8) | p[2]) + 269;
-        p+=2;
-    }
-    else
-    if (delta == 15)
-        return COAP_ERR_OPTION_DELTA_INVALID;
-
-    if (len == 13)
-    {
-        headlen++;
-        if (buflen < headlen)
-            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-        len = p[1] + 13;
-        p++;
-    }
-    else
-    if (len == 14)
-    {
-        headlen += 2;
-        if (buflen < headlen)
-            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-        len = ((p[1] << 8) | p[2]) + 269;
-        p+=2;
-    }
-    else
-    if (len == 15)
-        return COAP_ERR_OPTION_LEN_INVALID;
-
-    if ((p + 1 + len) > (*buf + buflen))
-        return COAP_ERR_OPTION_TOO_BIG;
-
-    //printf("option num=%d\n", delta + *running_delta);
-    option->num = delta + *running_delta;
-    option->buf.p = p+1;
-    option->buf.len = len;
-    //coap_dump(p+1, len, false);
-
-    // advance buf
-    *buf = p + 1 + len;
-    *running_delta += delta;
-
-    return 0;
-}
-
-// http://tools.ietf.org/html/rfc7252#section-3.1
-int coap_parseOptionsAndPayload(coap_option_t *options, uint8_t *numOptions, coap_buffer_t *payload, const coap_header_t *hdr, const uint8_t *buf, size_t buflen)
-{
-    size_t optionIndex = 0;
-    uint16_t delta = 0;
-    const uint8_t *p = buf + 4 + hdr->tkl;
-    const uint8_t *end = buf + buflen;
-    int rc;
-    if (p > end)
-        return COAP_ERR_OPTION_OVERRUNS_PACKET;   // out of bounds
-
-    //coap_dump(p, end - p);
-
-    // 0xFF is payload marker
-    while((optionIndex < *numOptions) && (p < end) && (*p != 0xFF))
-    {
-        if (0 != (rc = coap_parseOption(&options[optionIndex], &delta, &p, end-p)))
-            return rc;
-        optionIndex++;
-    }
-    *numOptions = optionIndex;
-
-    if (p+1 < end && *p == 0xFF)  // payload marker
-    {
-        payload->p = p+1;
-        payload->len = end-(p+1);
-    }
-    else
-    {
-        payload->p = NULL;
-        payload->len = 0;
-    }
-
-    return 0;
-}
-
-#ifdef DEBUG
-void coap_dumpOptions(coap_option_t *opts, size_t numopt)
-{
-    size_t i;
-    printf(" Options:\n");
-    for (i=0;i<numopt;i++)
-    {
-        printf("  0x%02X [ ", opts[i].num);
-        coap_dump(opts[i].buf.p, opts[i].buf.len, true);
-        printf(" ]\n");
-    }
-}
-#endif
-
-#ifdef DEBUG
-void coap_dumpPacket(coap_packet_t *pkt)
-{
-    coap_dumpHeader(&pkt->hdr);
-    coap_dumpOptions(pkt->opts, pkt->numopts);
-    printf("Payload: ");
-    coap_dump(pkt->payload.p, pkt->payload.len, true);
-    printf("\n");
-}
-#endif
-
-int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen)
-{
-    int rc;
-
-    // coap_dump(buf, buflen, false);
-
-    if (0 != (rc = coap_parseHeader(&pkt->hdr, buf, buflen)))
-        return rc;
-//    coap_dumpHeader(&hdr);
-    if (0 != (rc = coap_parseToken(&pkt->tok, &pkt->hdr, buf, buflen)))
-        return rc;
-    pkt->numopts = MAXOPT;
-    if (0 != (rc = coap_parseOptionsAndPayload(pkt->opts, &(pkt->numopts), &(pkt->payload), &pkt->hdr, buf, buflen)))
-        return rc;
-//    coap_dumpOptions(opts, numopt);
-    return 0;
-}
-
-// options are always stored consecutively, so can return a block with same option num
-const coap_option_t *coap_findOptions(const coap_packet_t *pkt, uint8_t num, uint8_t *count)
-{
-    // FIXME, options is always sorted, can find faster than this
-    size_t i;
-    const coap_option_t *first = NULL;
-    *count = 0;
-    for (i=0;i<pkt->numopts;i++)
-    {
-        if (pkt->opts[i].num == num)
-        {
-            if (NULL == first)
-                first = &pkt->opts[i];
-            (*count)++;
-        }
-        else
-        {
-            if (NULL != first)
-                break;
-        }
-    }
-    return first;
-}
-
-int coap_buffer_to_string(char *strbuf, size_t strbuflen, const coap_buffer_t *buf)
-{
-    if (buf->len+1 > strbuflen)
-        return COAP_ERR_BUFFER_TOO_SMALL;
-    memcpy(strbuf, buf->p, buf->len);
-    strbuf[buf->len] = 0;
-    return 0;
-}
-
-void coap_option_nibble(uint32_t value, uint8_t *nibble)
-{
-    if (value<13)
-    {
-        *nibble = (0xFF & value);
-    }
-    else
-    if (value<=0xFF+13)
-    {
-        *nibble = 13;
-    } else if (value<=0xFFFF+269)
-    {
-        *nibble = 14;
-    }
-}
-
-int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt)
-{
-    size_t opts_len = 0;
-    size_t i;
-    uint8_t *p;
-    uint16_t running_delta = 0;
-
-    // build header
-    if (*buflen < (4U + pkt->hdr.tkl))
-        return COAP_ERR_BUFFER_TOO_SMALL;
-
-    buf[0] = (pkt->hdr.ver & 0x03) << 6;
-    buf[0] |= (pkt->hdr.t & 0x03) << 4;
-    buf[0] |= (pkt->hdr.tkl & 0x0F);
-    buf[1] = pkt->hdr.code;
-    buf[2] = pkt->hdr.id[0];
-    buf[3] = pkt->hdr.id[1];
-
-    // inject token
-    p = buf + 4;
-    if ((pkt->hdr.tkl > 0) && (pkt->hdr.tkl != pkt->tok.len))
-        return COAP_ERR_UNSUPPORTED;
-    
-    if (pkt->hdr.tkl > 0)
-        memcpy(p, pkt->tok.p, pkt->hdr.tkl);
-
-    // // http://tools.ietf.org/html/rfc7252#section-3.1
-    // inject options
-    p += pkt->hdr.tkl;
-
-    for (i=0;i<pkt->numopts;i++)
-    {
-        uint32_t optDelta;
-        uint8_t len, delta = 0;
-
-        if (((size_t)(p-buf)) > *buflen)
-             return COAP_ERR_BUFFER_TOO_SMALL;
-        optDelta = pkt->opts[i].num - running_delta;
-        coap_option_nibble(optDelta, &delta);
-        coap_option_nibble((uint32_t)pkt->opts[i].buf.len, &len);
-
-        *p++ = (0xFF & (delta << 4 | len));
-        if (delta == 13)
-        {
-            *p++ = (optDelta - 13);
-        }
-        else
-        if (delta == 14)
-        {
-            *p++ = ((optDelta-269) >> 8);
-            *p++ = (0xFF & (optDelta-269));
-        }
-        if (len == 13)
-        {
-            *p++ = (pkt->opts[i].buf.len - 13);
-        }
-        else
-        if (len == 14)
-  	    {
-            *p++ = (pkt->opts[i].buf.len >> 8);
-            *p++ = (0xFF & (pkt->opts[i].buf.len-269));
-        }
-        memcpy(p, pkt->opts[i].buf.p, pkt->opts[i].buf.len);
-        p += pkt->opts[i].buf.len;
-        running_delta = pkt->opts[i].num;
-    }
-
-    opts_len = (p - buf) - 4;   // number of bytes used by options
-
-    if (pkt->payload.len > 0)
-    {
-        if (*buflen < 4 + 1 + pkt->payload.len + opts_len)
-        {
-            return COAP_ERR_BUFFER_TOO_SMALL;
-        }
-        buf[4 + opts_len] = 0xFF;  // payload marker
-        memcpy(buf+5 + opts_len, pkt->payload.p, pkt->payload.len);
-        *buflen = opts_len + 5 + pkt->payload.len;
-    }
-    else
-        *buflen = opts_len + 4;
-    return 0;
-}
-
-int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint8_t *uri_path, size_t uri_path_len, const uint8_t *payload, size_t payload_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_method_t method, coap_content_type_t content_type)
-{
-    uint32_t scratch_idx = 0;
-
-    pkt->hdr.ver = 0x01;  
-    pkt->hdr.t = COAP_TYPE_NONCON;  
-    pkt->hdr.tkl = 0;  
-    pkt->hdr.code = method;  
-    pkt->hdr.id[0] = msgid_hi;  
-    pkt->hdr.id[1] = msgid_lo; 
-    pkt->numopts = 0;  
-
-    // 요청에 토큰을 포함해야 하는 경우
-    if (tok) {
-        pkt->hdr.tkl = tok->len;
-        pkt->tok = *tok;
-    }
-
-    if (uri_path && uri_path_len > 0) {
-        const char* delim = "/";
-        char* token;
-        char uri_path_copy[256];
-        strncpy(uri_path_copy, (char *)uri_path, uri_path_len);
-        uri_path_copy[uri_path_len] = '\0';  
-
-        if (scratch->len < 2)  
-            return COAP_ERR_BUFFER_TOO_SMALL;
-
-        token = strtok(uri_path_copy, delim);
-
-        while (token != NULL) {
-            pkt->opts[pkt->numopts].num = COAP_OPTION_URI_PATH;
-            pkt->opts[pkt->numopts].buf.p = &scratch->p[scratch_idx];
-            memcpy(&scratch->p[scratch_idx], (uint8_t *)token, strlen(token));
-            pkt->opts[pkt->numopts].buf.len = strlen(token);
-            pkt->numopts++;
-            scratch_idx += strlen(token);
-            token = strtok(NULL, delim);
-        }
-    }
-
-    // Content-Format 옵션 추가
-    if (content_type != COAP_CONTENTTYPE_NONE) {
-        if (scratch->len < 2)  
-            return COAP_ERR_BUFFER_TOO_SMALL;
-        pkt->opts[pkt->numopts].num = COAP_OPTION_CONTENT_FORMAT;
-        pkt->opts[pkt->numopts].buf.p = &scratch->p[scratch_idx];  
-        scratch->p[scratch_idx + 0] = ((uint16_t)content_type & 0xFF00) >> 8;
-        scratch->p[scratch_idx + 1] = ((uint16_t)content_type & 0x00FF);
-        pkt->opts[pkt->numopts].buf.len = 2;
-        pkt->numopts++;
-    }
-
-    // 페이로드 추가
-    if (payload && payload_len > 0) {
-        pkt->payload.p = payload;
-        pkt->payload.len = payload_len;
-    } else {
-        pkt->payload.p = NULL;
-        pkt->payload.len = 0;
-    }
-
-    return 0;  
-}
-
-int coap_handle_response(const coap_packet_t *pkt)
-{
-    uint8_t count;
-    const coap_option_t *opt;
-    
-    // 응답 헤더 처리
-    if (pkt->hdr.ver != 1) {
-        printf("Unsupported CoAP version: %d\n", pkt->hdr.ver);
-        return COAP_ERR_VERSION_NOT_1;
-    }
-  
-    // 응답 코드 확인
-    if (pkt->hdr.code == COAP_RSPCODE_NOT_FOUND) {
-        printf("Resource not found (404)\n");
-        return COAP_ERR_NOT_FOUND;
-    } else if (pkt->hdr.code == COAP_RSPCODE_METHOD_NOT_ALLOWED) {
-        printf("Method not allowed (405)\n");
-        return COAP_ERR_METHOD_NOT_ALLOWED;
-    } else if (pkt->hdr.code >= 0x80) {
-        printf("Error response code: 0x%02X\n", pkt->hdr.code);
-        return COAP_ERR_RESPONSE_CODE;
-    }
-
-    // URI-Path 옵션 처리
-    opt = coap_findOptions(pkt, COAP_OPTION_URI_PATH, &count);
-#ifdef DEBUG
-    if (opt && count > 0) {
-        printf("Received URI Path: ");
-        for (int i = 0; i < count; i++) {
-            char uri_path[256];
-            memset(uri_path, 0, sizeof(uri_path));
-            memcpy(uri_path, opt[i].buf.p, opt[i].buf.len);
-            printf("/%s", uri_path);
-        }
-        printf("\n");
-    }
-#endif
-
-    // Content-Format 옵션 처리
-    opt = coap_findOptions(pkt, COAP_OPTION_CONTENT_FORMAT, &count);
-#ifdef DEBUG
-    if (opt && count == 1) {
-        uint16_t content_format = (opt->buf.p[0] << 8) | opt->buf.p[1];
-        printf("Content-Format: %u\n", content_format);
-    }
-#endif
-
-    // 페이로드 처리
-    if (pkt->payload.len > 0) {
-#ifdef DEBUG
-        printf("Received Payload: ");
-        for (size_t i = 0; i < pkt->payload.len; i++) {
-            printf("%02X ", pkt->payload.p[i]);  // Hexadecimal 출력
-        }
-        printf("\n");
-#endif
-
-        char payload_str[256];
-        memset(payload_str, 0, sizeof(payload_str));
-        memcpy(payload_str, pkt->payload.p, pkt->payload.len);
-        printf("%s\n", payload_str);
-    } else {
-        printf("No payload received.\n");
-    }
-
-    return 0;  
-}
-
-static void coapClient_Sockinit(uint8_t sock)
-{
-	uint8_t i;
-
-    COAPSock_Num = sock;
-
-}
-
-void coapClient_init(uint8_t * tx_buf, uint8_t * rx_buf, uint8_t sock)
-{
-	pCOAP_TX = tx_buf;
-	pCOAP_RX = rx_buf;
-
-	coapClient_Sockinit(sock);
-}
-
-
-void coapClient_run()
-{
-    int32_t ret;
-    uint16_t size = 0;
-    coap_packet_t rx_pkt;
-    size_t rsplen = DATA_BUF_SIZE * sizeof(uint8_t);
-    Timer timer;
-    unsigned int timeout = 0;
-    int retransmit_count = 0;  
-    int ack_ok = 0;
-
-    if ((ret = coap_build(pCOAP_TX, &rsplen, &tx_pkt)) != 0) {
-        printf("Failed to build CoAP request, error code: %d\n", ret);
-        return;
-    }
-
-    switch (getSn_SR(COAPSock_Num)) {
-        case SOCK_UDP:
-
-            ret = sendto(COAPSock_Num, pCOAP_TX, rsplen, destip, destport);
-            if (ret < 0) {
-                printf("Failed to send request to the server, error code: %ld\n", ret);
-                return;
-            }
-
-            timeout = ACK_TIMEOUT + (unsigned int)(((double)rand() / RAND_MAX) * (ACK_TIMEOUT * (ACK_RANDOM_FACTOR - 1.0)));
-
-            ack_ok = 0;
-            TimerInit(&timer);
-
-            while(retransmit_count < MAX_RETRANSMIT)
-            {
-                TimerCountdownMS(&timer, timeout);
-
-                while(1)
-                {
-                    size = getSn_RX_RSR(COAPSock_Num);  
-                    if (size > 0) {
-                        if (size > DATA_BUF_SIZE) 
-                            size = DATA_BUF_SIZE;
-            
-                        ret = recvfrom(COAPSock_Num, pCOAP_RX, size, destip, &destport);
-                        if (ret < 0) {
-                            printf("Failed to receive response from the server, error code: %ld\n", ret);
-                            return;
-                        }
-
-                        if ((ret = coap_parse(&rx_pkt, pCOAP_RX, ret)) != 0) {
-                            printf("Failed to parse CoAP response, error code: %d\n", ret);
-                            return;
-                        }
-                        coap_handle_response(&rx_pkt);
-                        ack_ok = 1;
-                        break;
-                    }
-                    if(TimerIsExpired(&timer))
-                        break;
-                }
-                if(ack_ok)
-                    break;
-
-                retransmit_count++;
-                timeout *= 2;  
-            }  
-
-            if(!ack_ok)
-            {
-                printf("Failed to receive response from the server: give up after 4 attempts\n");
-            }
-
-            break;
-        
-        case SOCK_CLOSED:
-            if (socket(COAPSock_Num, Sn_MR_UDP, destport, 0x00) == COAPSock_Num) {
-                printf("Opened UDP socket, port: %d\n", destport);
-            }
-            break;
-        
-        default:
-            break;
-    }
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include "coapClient.h"
+#include "coapTimer.h"
+#include "coapPool.h"
+#include "coapTrace.h"
+
+#include "socket.h"
+#include "wizchip_conf.h"
+
+//#define DEBUG
+
+#define ACK_TIMEOUT 2000  // 2000ms, RTO of a server without RTT samples
+#define MAX_RETRANSMIT 4  // 최대 재전송 횟수
+#define COAP_RTO_WEAK_MAX 2  // retransmissions after which an exchange gives no RTT sample
+#define MAX_TRANSMIT_SPAN 45000  // 최대 재전송 시간 (ms 단위)
+#define EXCHANGE_LIFETIME 247000  // ms, RFC 7252 section 4.8.2
+
+#define MAX_AGE_DEFAULT 60  // seconds, RFC 7252 section 5.10.5
+#define MAX_AGE_LIMIT 0x1FFFFF  // seconds, keeps an expiry within half the 32 bit millisecond range
+#define OBSERVE_REORDER_MS 128000  // RFC 7641 section 3.4, a notification this much newer is always fresh
+
+// options and payload coap_wire_add_option() re-encodes on the stack
+#define COAP_WIRE_REENCODE_SIZE ((COAP_CLIENT_OBSERVE_REQ_SIZE > COAP_CLIENT_TXN_SIZE) ? COAP_CLIENT_OBSERVE_REQ_SIZE : COAP_CLIENT_TXN_SIZE)
+
+typedef enum
+{
+    COAP_TXN_FREE = 0,
+    COAP_TXN_QUEUED,            /* waiting for an NSTART slot of its server */
+    COAP_TXN_CACHED,            /* answered from the cache, completed by the next coapClient_run() */
+    COAP_TXN_SENT,              /* sent, waiting for the ACK or the response */
+    COAP_TXN_ACKED              /* empty ACK received, waiting for the separate response */
+} coap_txn_state_t;
+
+// RTT estimator of RFC 6298, in 1/8 ms
+typedef struct
+{
+    uint32_t srtt;
+    uint32_t rttvar;
+    bool valid;                 /* got a sample */
+} coap_rtt_t;
+
+// Server state, kept while idle so the RTO survives between requests.
+// Entries are reused least recently used first.
+typedef struct
+{
+    uint8_t ip[4];
+    uint16_t port;
+    bool used;
+    bool pinned;                /* RTO bounds were set for it, never reused */
+    uint8_t inflight;           /* transactions SENT or ACKED, at most COAP_CLIENT_NSTART */
+    uint8_t refs;               /* transactions using this entry */
+    uint32_t last;              /* coap_millis() of the last submit */
+    coap_rtt_t strong;          /* samples of exchanges without retransmission */
+    coap_rtt_t weak;            /* samples of retransmitted exchanges, from the first transmission */
+    uint32_t rto;               /* overall RTO in ms, CoCoA (draft-ietf-core-cocoa) */
+    uint32_t rto_stamp;         /* coap_millis() of the last RTO update or aging */
+    uint32_t rto_min;
+    uint32_t rto_max;
+} coap_peer_t;
+
+typedef struct
+{
+    uint8_t state;              /* coap_txn_state_t */
+    uint8_t peer;               /* index in coap_peers */
+    uint8_t retransmit;         /* retransmissions so far */
+    uint16_t len;               /* length of the wire image */
+    uint8_t *buf;               /* wire image, holds the message ID and token to match on */
+    uint16_t size;              /* room at buf, COAP_CLIENT_TXN_SIZE or the shared slot for a larger request */
+    uint32_t timeout;           /* current retransmission timeout in ms, backed off on each retransmission */
+    uint32_t rto;               /* RTO of the server when the request was first sent, picks the backoff */
+    uint32_t sent;              /* coap_millis() of the first transmission, for the RTT sample */
+    coap_timer_t timer;         /* next retransmission or giving up */
+    int8_t cache;               /* cache entry being served or revalidated, -1 if none */
+    coap_response_func cb;
+    void *arg;
+} coap_txn_t;
+
+// Observation of a resource (RFC 7641), kept alive by re-registering before Max-Age runs out
+typedef struct
+{
+    bool used;
+    bool registering;           /* a registration request is outstanding */
+    bool seq_valid;             /* a notification with a sequence number was delivered */
+    uint8_t ip[4];
+    uint16_t port;
+    uint16_t len;               /* length of the registration request */
+    uint8_t buf[COAP_CLIENT_OBSERVE_REQ_SIZE];  /* registration request, its token identifies the notifications */
+    uint32_t seq;               /* Observe value of the last notification delivered */
+    uint32_t seq_time;          /* coap_millis() when it arrived */
+    coap_timer_t timer;         /* re-registration */
+    coap_response_func cb;      /* NULL once cancelled */
+    void *arg;
+} coap_observation_t;
+
+// Block-wise download (RFC 7959), each block is its own transaction
+typedef struct
+{
+    bool last_known;            /* last is set, from Size2 or a block without the M bit */
+    bool etag_seen;
+    uint8_t ip[4];
+    uint16_t port;
+    const uint8_t *req;         /* GET request the Block2 option is added to, owned by the caller */
+    uint16_t req_len;
+    uint8_t szx;                /* block size in use, the server may lower it in its first response */
+    uint8_t window;             /* blocks requested at once once last is known */
+    uint8_t inflight;
+    uint8_t etag_len;
+    uint8_t etag[8];            /* of the first block, the others must match */
+    uint32_t next;              /* next block to request */
+    uint32_t last;              /* number of the last block */
+    uint32_t received;          /* blocks written to the sink */
+    size_t total;               /* bytes written to the sink */
+    int rc;                     /* first error, the download ends once nothing is in flight */
+    coap_sink_func sink;
+    coap_download_func done;
+    void *arg;
+} coap_download_t;
+
+// CON separate response already handed to its transaction. The server sends it again
+// if our ACK got lost, and that copy is acknowledged again, not reset (RFC 7252 section 4.5).
+typedef struct
+{
+    bool used;
+    uint8_t ip[4];
+    uint16_t port;
+    uint8_t mid[2];
+    uint8_t tkl;
+    uint8_t tok[8];
+    coap_timer_t timer;         /* forgets it after EXCHANGE_LIFETIME */
+} coap_done_t;
+
+#if COAP_CLIENT_CACHE_ENTRIES > 0
+#define COAP_CACHE_SLOT_SIZE (COAP_CLIENT_CACHE_SIZE / COAP_CLIENT_CACHE_ENTRIES)
+
+// Cached GET response. Its slot of the arena holds the options of the request,
+// which are the key, followed by the response as received.
+typedef struct
+{
+    bool used;
+    uint8_t ip[4];
+    uint16_t port;
+    uint8_t refs;               /* transactions serving or revalidating it, not evicted while set */
+    uint8_t etag_len;
+    uint8_t etag[8];
+    uint16_t key_len;
+    uint16_t rsp_len;
+    uint32_t hash;              /* of the key */
+    uint32_t expire;            /* coap_millis() when Max-Age runs out */
+    uint32_t last;              /* coap_millis() of the last use, LRU */
+} coap_cache_entry_t;
+#endif
+
+static uint8_t destip[4] = {192, 168, 11, 3};  
+static uint16_t destport = 5683;
+
+uint8_t * pCOAP_TX = NULL;
+uint8_t * pCOAP_RX = NULL;
+static size_t coap_rx_len;
+
+static uint8_t COAPSock_Num = 0;
+static bool COAPSock_Open = false;  // cached Sn_SR == SOCK_UDP, cleared when a send or receive fails
+
+static coap_txn_t coap_txns[COAP_CLIENT_MAX_TXN];
+static uint16_t coap_txn_stack[COAP_CLIENT_MAX_TXN];
+static coap_pool_t coap_txn_pool = COAP_POOL_INIT("coap_txn_pool", coap_txns, coap_txn_stack, COAP_CLIENT_MAX_TXN);
+static coap_peer_t coap_peers[COAP_CLIENT_MAX_PEERS];
+static uint8_t coap_txn_queued;     // transactions QUEUED
+static uint8_t *coap_txn_large;     // rest of the tx buffer, for one request larger than COAP_CLIENT_TXN_SIZE
+static uint16_t coap_txn_large_size;
+static coap_txn_t *coap_txn_large_owner;    // transaction holding it, NULL if free
+static coap_timer_wheel_t coap_wheel;   // retransmission and expiry of the transactions, runs on coap_millis()
+static uint16_t coap_mid;
+static uint32_t coap_token;
+
+// stored in order, so the next one to overwrite is always the oldest
+static coap_done_t coap_done[COAP_CLIENT_DONE_ENTRIES];
+static uint8_t coap_done_next;
+
+// observations are looked up by token and handle, so the array stays visible
+static coap_observation_t coap_observations[COAP_CLIENT_OBSERVE_MAX];
+static uint16_t coap_observation_stack[COAP_CLIENT_OBSERVE_MAX];
+static coap_pool_t coap_observation_pool = COAP_POOL_INIT("coap_observation_pool", coap_observations, coap_observation_stack, COAP_CLIENT_OBSERVE_MAX);
+COAP_POOL_DEFINE(coap_download_pool, coap_download_t, COAP_CLIENT_DOWNLOAD_MAX);
+
+#if COAP_CLIENT_CACHE_ENTRIES > 0
+static bool coap_cache_on = false;
+static uint8_t coap_txn_cached;     // transactions CACHED
+static coap_cache_entry_t coap_cache[COAP_CLIENT_CACHE_ENTRIES];
+static uint8_t coap_cache_arena[COAP_CLIENT_CACHE_ENTRIES * COAP_CACHE_SLOT_SIZE];
+static coap_client_cache_stats_t coap_cache_stats;
+#endif
+
+// 64 bits like the clock, so a deadline of the Timer functions never wraps
+volatile uint64_t MilliTimer;
+static uint64_t (*coap_client_clock)(void) = NULL;
+
+/*
+ * @brief MQTT MilliTimer handler
+ * @note Only needed without coapClient_setClock(), then MUST BE register to your system 1m Tick timer handler.
+ */
+void MilliTimer_Handler(void) {
+	MilliTimer++;
+}
+
+// Milliseconds from the microsecond clock, without one from the MilliTimer tick
+static uint64_t coap_millis64(void)
+{
+    uint64_t ms;
+
+    if (NULL != coap_client_clock)
+        return coap_client_clock() / 1000U;
+    // a 32 bit core reads it in two halves, read again if the tick came in between
+    do
+        ms = MilliTimer;
+    while (ms != MilliTimer);
+    return ms;
+}
+
+// Stamps and the timer wheel only take differences, so they wrap safely in 32 bits
+static uint32_t coap_millis(void)
+{
+    return (uint32_t)coap_millis64();
+}
+
+/*
+ * @brief Timer Initialize
+ * @param  timer : pointer to a Timer structure
+ *         that contains the configuration information for the Timer.
+ */
+void TimerInit(Timer* timer) {
+	timer->end_time = 0;
+}
+
+/*
+ * @brief expired Timer
+ * @param  timer : pointer to a Timer structure
+ *         that contains the configuration information for the Timer.
+ */
+char TimerIsExpired(Timer* timer) {
+	return timer->end_time < coap_millis64();
+}
+
+/*
+ * @brief Countdown millisecond Timer
+ * @param  timer : pointer to a Timer structure
+ *         that contains the configuration information for the Timer.
+ *         timeout : setting timeout millisecond.
+ */
+void TimerCountdownMS(Timer* timer, unsigned int timeout) {
+	timer->end_time = coap_millis64() + timeout;
+}
+
+/*
+ * @brief Countdown second Timer
+ * @param  timer : pointer to a Timer structure
+ *         that contains the configuration information for the Timer.
+ *         timeout : setting timeout millisecond.
+ */
+void TimerCountdown(Timer* timer, unsigned int timeout) {
+	timer->end_time = coap_millis64() + (uint64_t)timeout * 1000;
+}
+
+/*
+ * @brief left millisecond Timer
+ * @param  timer : pointer to a Timer structure
+ *         that contains the configuration information for the Timer.
+ */
+int TimerLeftMS(Timer* timer) {
+	uint64_t now = coap_millis64();
+	return (timer->end_time <= now) ? 0 : (int)(timer->end_time - now);
+}
+
+#ifdef DEBUG
+void coap_dumpHeader(coap_header_t *hdr)
+{
+    printf("Header:\n");
+    printf("  ver  0x%02X\n", hdr->ver);
+    printf("  t    0x%02X\n", hdr->t);
+    printf("  tkl  0x%02X\n", hdr->tkl);
+    printf("  code 0x%02X\n", hdr->code);
+    printf("  id   0x%02X%02X\n", hdr->id[0], hdr->id[1]);
+}
+#endif
+
+#ifdef DEBUG
+void coap_dump(const uint8_t *buf, size_t buflen, bool bare)
+{
+    if (bare)
+    {
+        while(buflen--)
+            printf("%02X%s", *buf++, (buflen > 0) ? " " : "");
+    }
+    else
+    {
+        printf("Dump: ");
+        while(buflen--)
+            printf("%02X%s", *buf++, (buflen > 0) ? " " : "");
+        printf("\n");
+    }
+}
+#endif
+
+int coap_parseHeader(coap_header_t *hdr, const uint8_t *buf, size_t buflen)
+{
+    if (buflen < 4)
+        return COAP_ERR_HEADER_TOO_SHORT;
+    hdr->ver = (buf[0] & 0xC0) >> 6;
+    if (hdr->ver != 1)
+        return COAP_ERR_VERSION_NOT_1;
+    hdr->t = (buf[0] & 0x30) >> 4;
+    hdr->tkl = buf[0] & 0x0F;
+    hdr->code = buf[1];
+    hdr->id[0] = buf[2];
+    hdr->id[1] = buf[3];
+    return 0;
+}
+
+int coap_parseToken(coap_buffer_t *tokbuf, const coap_header_t *hdr, const uint8_t *buf, size_t buflen)
+{
+    if (hdr->tkl == 0)
+    {
+        tokbuf->p = NULL;
+        tokbuf->len = 0;
+        return 0;
+    }
+    else
+    if (hdr->tkl <= 8)
+    {
+        if (4U + hdr->tkl > buflen)
+            return COAP_ERR_TOKEN_TOO_SHORT;   // tok bigger than packet
+        tokbuf->p = buf+4;  // past header
+        tokbuf->len = hdr->tkl;
+        return 0;
+    }
+    else
+    {
+        // invalid size
+        return COAP_ERR_TOKEN_TOO_SHORT;
+    }
+}
+
+// advances p
+int coap_parseOption(coap_option_t *option, uint16_t *running_delta, const uint8_t **buf, size_t buflen)
+{
+    const uint8_t *p = *buf;
+    uint8_t headlen = 1;
+    uint16_t len, delta;
+
+    if (buflen < headlen) // too small
+        return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
+
+    delta = (p[0] & 0xF0) >> 4;
+    len = p[0] & 0x0F;
+
+    // These are untested and may be buggy
+    if (delta == 13)
+    {
+        headlen++;
+        if (buflen < headlen)
+            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
+        delta = p[1] + 13;
+        p++;
+    }
+    else
+    if (delta == 14)
+    {
+        headlen += 2;
+        if (buflen < headlen)
+            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
+        delta = ((p[1] << 8) | p[2]) + 269;
+        p+=2;
+    }
+    else
+    if (delta == 15)
+        return COAP_ERR_OPTION_DELTA_INVALID;
+
+    if (len == 13)
+    {
+        headlen++;
+        if (buflen < headlen)
+            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
+        len = p[1] + 13;
+        p++;
+    }
+    else
+    if (len == 14)
+    {
+        headlen += 2;
+        if (buflen < headlen)
+            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
+        len = ((p[1] << 8) | p[2]) + 269;
+        p+=2;
+    }
+    else
+    if (len == 15)
+        return COAP_ERR_OPTION_LEN_INVALID;
+
+    if ((p + 1 + len) > (*buf + buflen))
+        return COAP_ERR_OPTION_TOO_BIG;
+
+    //printf("option num=%d\n", delta + *running_delta);
+    option->num = delta + *running_delta;
+    option->buf.p = p+1;
+    option->buf.len = len;
+    //coap_dump(p+1, len, false);
+
+    // advance buf
+    *buf = p + 1 + len;
+    *running_delta += delta;
+
+    return 0;
+}
+
+// http://tools.ietf.org/html/rfc7252#section-3.1
+// Only validates the options and finds where they end, they are decoded
+// again on demand by coap_option_next()
+int coap_parseOptionsAndPayload(coap_buffer_t *options, coap_buffer_t *payload, const coap_header_t *hdr, const uint8_t *buf, size_t buflen)
+{
+    coap_option_t option;
+    uint16_t delta = 0;
+    const uint8_t *p = buf + 4 + hdr->tkl;
+    const uint8_t *end = buf + buflen;
+    int rc;
+    if (p > end)
+        return COAP_ERR_OPTION_OVERRUNS_PACKET;   // out of bounds
+
+    //coap_dump(p, end - p);
+
+    options->p = p;
+
+    // 0xFF is payload marker
+    while((p < end) && (*p != 0xFF))
+    {
+        if (0 != (rc = coap_parseOption(&option, &delta, &p, end-p)))
+            return rc;
+    }
+    options->len = p - options->p;
+
+    if (p+1 < end && *p == 0xFF)  // payload marker
+    {
+        payload->p = p+1;
+        payload->len = end-(p+1);
+    }
+    else
+    {
+        payload->p = NULL;
+        payload->len = 0;
+    }
+
+    return 0;
+}
+
+#ifdef DEBUG
+void coap_dumpOptions(const coap_packet_t *pkt)
+{
+    coap_option_iter_t it;
+    coap_option_t opt;
+    printf(" Options:\n");
+    coap_option_iter_init(&it, pkt);
+    while (coap_option_next(&it, &opt))
+    {
+        printf("  0x%02X [ ", opt.num);
+        coap_dump(opt.buf.p, opt.buf.len, true);
+        printf(" ]\n");
+    }
+}
+#endif
+
+#ifdef DEBUG
+void coap_dumpPacket(coap_packet_t *pkt)
+{
+    coap_dumpHeader(&pkt->hdr);
+    coap_dumpOptions(pkt);
+    printf("Payload: ");
+    coap_dump(pkt->payload.p, pkt->payload.len, true);
+    printf("\n");
+}
+#endif
+
+int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen)
+{
+    int rc;
+
+    // coap_dump(buf, buflen, false);
+
+    if (0 != (rc = coap_parseHeader(&pkt->hdr, buf, buflen)))
+        return rc;
+//    coap_dumpHeader(&hdr);
+    if (0 != (rc = coap_parseToken(&pkt->tok, &pkt->hdr, buf, buflen)))
+        return rc;
+    if (0 != (rc = coap_parseOptionsAndPayload(&pkt->opts, &pkt->payload, &pkt->hdr, buf, buflen)))
+        return rc;
+//    coap_dumpOptions(opts, numopt);
+    return 0;
+}
+
+void coap_option_nibble(uint32_t value, uint8_t *nibble)
+{
+    if (value<13)
+    {
+        *nibble = (0xFF & value);
+    }
+    else
+    if (value<=0xFF+13)
+    {
+        *nibble = 13;
+    } else if (value<=0xFFFF+269)
+    {
+        *nibble = 14;
+    }
+}
+
+void coap_option_iter_init(coap_option_iter_t *it, const coap_packet_t *pkt)
+{
+    it->p = pkt->opts.p;
+    it->end = pkt->opts.p + pkt->opts.len;
+    it->delta = 0;
+}
+
+// option region was validated by coap_parse(), so decoding can't fail here
+bool coap_option_next(coap_option_iter_t *it, coap_option_t *option)
+{
+    if (it->p >= it->end)
+        return false;
+    return 0 == coap_parseOption(option, &it->delta, &it->p, it->end - it->p);
+}
+
+// options are sorted, so repeats of an option are consecutive. Leaves it
+// before the first one found, coap_option_next() then returns the count repeats
+uint8_t coap_findOptions(const coap_packet_t *pkt, uint16_t num, coap_option_iter_t *it)
+{
+    coap_option_iter_t cur;
+    coap_option_t opt;
+    uint8_t count = 0;
+
+    coap_option_iter_init(&cur, pkt);
+    *it = cur;
+    while (coap_option_next(&cur, &opt))
+    {
+        if (opt.num < num)
+        {
+            *it = cur;
+            continue;
+        }
+        if (opt.num > num)
+            break;
+        count++;
+    }
+    return count;
+}
+
+void coap_option_writer_init(coap_option_writer_t *w, uint8_t *buf, size_t buflen)
+{
+    w->p = buf;
+    w->end = buf + buflen;
+    w->delta = 0;
+}
+
+// http://tools.ietf.org/html/rfc7252#section-3.1
+int coap_option_add(coap_option_writer_t *w, uint16_t num, const uint8_t *val, size_t len)
+{
+    uint32_t optDelta;
+    uint8_t delta = 0, nlen = 0;
+    uint8_t *p = w->p;
+
+    if (num < w->delta || len > 0xFFFF + 269)
+        return COAP_ERR_UNSUPPORTED;
+
+    optDelta = num - w->delta;
+    coap_option_nibble(optDelta, &delta);
+    coap_option_nibble((uint32_t)len, &nlen);
+
+    if ((size_t)(w->end - p) < 1U + (delta == 13) + 2U * (delta == 14) + (nlen == 13) + 2U * (nlen == 14) + len)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    *p++ = (0xFF & (delta << 4 | nlen));
+    if (delta == 13)
+    {
+        *p++ = (optDelta - 13);
+    }
+    else
+    if (delta == 14)
+    {
+        *p++ = ((optDelta-269) >> 8);
+        *p++ = (0xFF & (optDelta-269));
+    }
+    if (nlen == 13)
+    {
+        *p++ = (len - 13);
+    }
+    else
+    if (nlen == 14)
+    {
+        *p++ = ((len-269) >> 8);
+        *p++ = (0xFF & (len-269));
+    }
+    if (len > 0)
+        memcpy(p, val, len);
+
+    w->p = p + len;
+    w->delta = num;
+    return 0;
+}
+
+static size_t coap_encode_uint(uint8_t *buf, uint32_t value)
+{
+    size_t len = 0;
+
+    if (value > 0xFFFFFF)
+        buf[len++] = (value >> 24) & 0xFF;
+    if (value > 0xFFFF)
+        buf[len++] = (value >> 16) & 0xFF;
+    if (value > 0xFF)
+        buf[len++] = (value >> 8) & 0xFF;
+    if (value > 0)
+        buf[len++] = value & 0xFF;
+    return len;
+}
+
+// Value of the first uint option num of pkt, false if there is none
+static bool coap_option_uint(const coap_packet_t *pkt, uint16_t num, uint32_t *value)
+{
+    coap_option_iter_t it;
+    coap_option_t opt;
+    size_t i;
+
+    if (0 == coap_findOptions(pkt, num, &it) || !coap_option_next(&it, &opt) || opt.buf.len > 4)
+        return false;
+    *value = 0;
+    for (i = 0; i < opt.buf.len; i++)
+        *value = (*value << 8) | opt.buf.p[i];
+    return true;
+}
+
+// Reads the Block1 or Block2 option of pkt, blk is only set if it is valid
+coap_block_result_t coap_block_get(const coap_packet_t *pkt, uint16_t num, coap_block_t *blk)
+{
+    coap_option_iter_t it;
+    uint32_t value;
+
+    if (0 == coap_findOptions(pkt, num, &it))
+        return COAP_BLOCK_ABSENT;
+    if (!coap_option_uint(pkt, num, &value) || value > 0xFFFFFF || 7 == (value & 0x07))
+        return COAP_BLOCK_INVALID;
+    blk->num = value >> 4;
+    blk->more = (value & 0x08) != 0;
+    blk->szx = value & 0x07;
+    return COAP_BLOCK_VALID;
+}
+
+int coap_buffer_to_string(char *strbuf, size_t strbuflen, const coap_buffer_t *buf)
+{
+    if (buf->len+1 > strbuflen)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    memcpy(strbuf, buf->p, buf->len);
+    strbuf[buf->len] = 0;
+    return 0;
+}
+
+int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt)
+{
+    size_t opts_len = 0;
+    uint8_t *p;
+
+    // build header
+    if (*buflen < (4U + pkt->hdr.tkl))
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    buf[0] = (pkt->hdr.ver & 0x03) << 6;
+    buf[0] |= (pkt->hdr.t & 0x03) << 4;
+    buf[0] |= (pkt->hdr.tkl & 0x0F);
+    buf[1] = pkt->hdr.code;
+    buf[2] = pkt->hdr.id[0];
+    buf[3] = pkt->hdr.id[1];
+
+    // inject token
+    p = buf + 4;
+    if ((pkt->hdr.tkl > 0) && (pkt->hdr.tkl != pkt->tok.len))
+        return COAP_ERR_UNSUPPORTED;
+    
+    if (pkt->hdr.tkl > 0)
+        memcpy(p, pkt->tok.p, pkt->hdr.tkl);
+
+    // // http://tools.ietf.org/html/rfc7252#section-3.1
+    // inject options, already in wire format
+    p += pkt->hdr.tkl;
+
+    if (*buflen < (4U + pkt->hdr.tkl + pkt->opts.len))
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    if (pkt->opts.len > 0)
+        memcpy(p, pkt->opts.p, pkt->opts.len);
+    p += pkt->opts.len;
+
+    opts_len = (p - buf) - 4;   // number of bytes used by options
+
+    if (pkt->payload.len > 0)
+    {
+        if (*buflen < 4 + 1 + pkt->payload.len + opts_len)
+        {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        buf[4 + opts_len] = 0xFF;  // payload marker
+        memcpy(buf+5 + opts_len, pkt->payload.p, pkt->payload.len);
+        *buflen = opts_len + 5 + pkt->payload.len;
+    }
+    else
+        *buflen = opts_len + 4;
+    return 0;
+}
+
+// Uri-Path options, one per segment of uri_path, then Content-Format.
+// Empty segments, as in a leading or doubled '/', are skipped.
+static int coap_request_options(coap_option_writer_t *w, const uint8_t *uri_path, size_t uri_path_len, coap_content_type_t content_type)
+{
+    const uint8_t *p = uri_path, *end = uri_path + uri_path_len, *seg;
+    int rc;
+
+    while (NULL != uri_path && p < end)
+    {
+        if (NULL == (seg = memchr(p, '/', end - p)))
+            seg = end;
+        if (seg > p && 0 != (rc = coap_option_add(w, COAP_OPTION_URI_PATH, p, seg - p)))
+            return rc;
+        p = seg + 1;
+    }
+
+    // Content-Format 옵션 추가
+    if (content_type != COAP_CONTENTTYPE_NONE) {
+        uint8_t ct[2];
+        ct[0] = ((uint16_t)content_type & 0xFF00) >> 8;
+        ct[1] = ((uint16_t)content_type & 0x00FF);
+        if (0 != (rc = coap_option_add(w, COAP_OPTION_CONTENT_FORMAT, ct, 2)))
+            return rc;
+    }
+    return 0;
+}
+
+int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint8_t *uri_path, size_t uri_path_len, const uint8_t *payload, size_t payload_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_method_t method, coap_content_type_t content_type)
+{
+    coap_option_writer_t w;
+    int rc;
+
+    pkt->hdr.ver = 0x01;  
+    pkt->hdr.t = COAP_TYPE_NONCON;  
+    pkt->hdr.tkl = 0;  
+    pkt->hdr.code = method;  
+    pkt->hdr.id[0] = msgid_hi;  
+    pkt->hdr.id[1] = msgid_lo; 
+
+    // 요청에 토큰을 포함해야 하는 경우
+    if (tok) {
+        pkt->hdr.tkl = tok->len;
+        pkt->tok = *tok;
+    }
+
+    // 옵션은 scratch 에 wire format 으로 인코딩
+    coap_option_writer_init(&w, scratch->p, scratch->len);
+    if (0 != (rc = coap_request_options(&w, uri_path, uri_path_len, content_type)))
+        return rc;
+    pkt->opts.p = scratch->p;
+    pkt->opts.len = w.p - scratch->p;
+
+    // 페이로드 추가
+    if (payload && payload_len > 0) {
+        pkt->payload.p = payload;
+        pkt->payload.len = payload_len;
+    } else {
+        pkt->payload.p = NULL;
+        pkt->payload.len = 0;
+    }
+
+    return 0;  
+}
+
+// Encodes the whole request into buf once. The message ID and a 4 byte token are left
+// as placeholders, coapClient_submitPrepared() fills them in for each send.
+int coap_prepare_request(coap_prepared_t *req, uint8_t *buf, size_t buflen, coap_msgtype_t type, coap_method_t method, const uint8_t *uri_path, size_t uri_path_len, const uint8_t *payload, size_t payload_len, coap_content_type_t content_type)
+{
+    coap_option_writer_t w;
+    int rc;
+
+    if (buflen < COAP_PREPARED_HDR_LEN)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    buf[0] = (0x01 << 6) | ((type & 0x03) << 4) | COAP_PREPARED_TKL;
+    buf[1] = method;
+    memset(buf + 2, 0, COAP_PREPARED_HDR_LEN - 2);
+
+    coap_option_writer_init(&w, buf + COAP_PREPARED_HDR_LEN, buflen - COAP_PREPARED_HDR_LEN);
+    if (0 != (rc = coap_request_options(&w, uri_path, uri_path_len, content_type)))
+        return rc;
+
+    if (payload && payload_len > 0)
+    {
+        if ((size_t)(w.end - w.p) < 1 + payload_len)
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        *w.p++ = 0xFF;  // payload marker
+        memcpy(w.p, payload, payload_len);
+        w.p += payload_len;
+    }
+
+    req->buf = buf;
+    req->len = w.p - buf;
+    return 0;
+}
+
+int coap_handle_response(const coap_packet_t *pkt)
+{
+#ifdef DEBUG
+    coap_option_iter_t it;
+    coap_option_t opt;
+    uint8_t count;
+#endif
+    
+    // 응답 헤더 처리
+    if (pkt->hdr.ver != 1) {
+        printf("Unsupported CoAP version: %d\n", pkt->hdr.ver);
+        return COAP_ERR_VERSION_NOT_1;
+    }
+  
+    // 응답 코드 확인
+    if (pkt->hdr.code == COAP_RSPCODE_NOT_FOUND) {
+        printf("Resource not found (404)\n");
+        return COAP_ERR_NOT_FOUND;
+    } else if (pkt->hdr.code == COAP_RSPCODE_METHOD_NOT_ALLOWED) {
+        printf("Method not allowed (405)\n");
+        return COAP_ERR_METHOD_NOT_ALLOWED;
+    } else if (pkt->hdr.code >= 0x80) {
+        printf("Error response code: 0x%02X\n", pkt->hdr.code);
+        return COAP_ERR_RESPONSE_CODE;
+    }
+
+    // URI-Path 옵션 처리
+#ifdef DEBUG
+    count = coap_findOptions(pkt, COAP_OPTION_URI_PATH, &it);
+    if (count > 0) {
+        printf("Received URI Path: ");
+        for (int i = 0; i < count; i++) {
+            coap_option_next(&it, &opt);
+            printf("/%.*s", (int)opt.buf.len, (const char *)opt.buf.p);
+        }
+        printf("\n");
+    }
+#endif
+
+    // Content-Format 옵션 처리
+#ifdef DEBUG
+    count = coap_findOptions(pkt, COAP_OPTION_CONTENT_FORMAT, &it);
+    if (count == 1 && coap_option_next(&it, &opt) && opt.buf.len == 2) {
+        uint16_t content_format = (opt.buf.p[0] << 8) | opt.buf.p[1];
+        printf("Content-Format: %u\n", content_format);
+    }
+#endif
+
+    // 페이로드 처리
+    if (pkt->payload.len > 0) {
+#ifdef DEBUG
+        printf("Received Payload: ");
+        for (size_t i = 0; i < pkt->payload.len; i++) {
+            printf("%02X ", pkt->payload.p[i]);  // Hexadecimal 출력
+        }
+        printf("\n");
+#endif
+
+        printf("%.*s\n", (int)pkt->payload.len, (const char *)pkt->payload.p);
+    } else {
+        printf("No payload received.\n");
+    }
+
+    return 0;  
+}
+
+static void coapClient_Sockinit(uint8_t sock)
+{
+    COAPSock_Num = sock;
+}
+
+int coapClient_init(uint8_t * tx_buf, size_t tx_len, uint8_t * rx_buf, size_t rx_len, uint8_t sock, uint32_t seed)
+{
+    uint8_t i;
+
+    if (tx_len < COAP_CLIENT_MAX_TXN * COAP_CLIENT_TXN_SIZE)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    pCOAP_TX = tx_buf;
+    pCOAP_RX = rx_buf;
+    coap_rx_len = (rx_len > 0xFFFF) ? 0xFFFF : rx_len;
+
+    // each transaction keeps its wire image in its own slice of the tx buffer
+    for (i = 0; i < COAP_CLIENT_MAX_TXN; i++)
+    {
+        coap_txns[i].buf = tx_buf + i * COAP_CLIENT_TXN_SIZE;
+        coap_txns[i].size = COAP_CLIENT_TXN_SIZE;
+    }
+    tx_len -= COAP_CLIENT_MAX_TXN * COAP_CLIENT_TXN_SIZE;
+    coap_txn_large = tx_buf + COAP_CLIENT_MAX_TXN * COAP_CLIENT_TXN_SIZE;
+    coap_txn_large_size = (tx_len > 0xFFFF) ? 0xFFFF : tx_len;
+    coap_txn_large_owner = NULL;
+
+    coap_pool_register(&coap_txn_pool);
+    coap_pool_register(&coap_observation_pool);
+    coap_pool_register(&coap_download_pool);
+
+    coap_timer_wheel_init(&coap_wheel, coap_millis());
+    coap_rand_seed(seed);
+    coap_mid = (uint16_t)coap_rand();
+    coap_token = coap_rand();
+
+    coapClient_Sockinit(sock);
+    return 0;
+}
+
+void coapClient_setDestination(const uint8_t * ip, uint16_t port)
+{
+    memcpy(destip, ip, sizeof(destip));
+    destport = port;
+}
+
+int coapClient_pending(void)
+{
+    return coap_txn_pool.used;
+}
+
+static void coap_peer_reset(coap_peer_t *peer, const uint8_t *ip, uint16_t port)
+{
+    memset(peer, 0, sizeof(*peer));
+    memcpy(peer->ip, ip, 4);
+    peer->port = port;
+    peer->used = true;
+    peer->rto = ACK_TIMEOUT;
+    peer->rto_stamp = coap_millis();
+    peer->rto_min = COAP_CLIENT_RTO_MIN;
+    peer->rto_max = COAP_CLIENT_RTO_MAX;
+}
+
+// Finds the entry of ip:port. If create is set and there is none, takes an unused entry
+// or the least recently used one without transactions.
+static coap_peer_t *coap_peer_get(const uint8_t *ip, uint16_t port, bool create)
+{
+    coap_peer_t *peer, *victim = NULL;
+
+    for (peer = coap_peers; peer < coap_peers + COAP_CLIENT_MAX_PEERS; peer++)
+    {
+        if (peer->used && peer->port == port && 0 == memcmp(peer->ip, ip, 4))
+            return peer;
+        if (!peer->used)
+        {
+            if (NULL == victim || victim->used)
+                victim = peer;
+        }
+        else if (0 == peer->refs && !peer->pinned
+                 && (NULL == victim || (victim->used && (int32_t)(peer->last - victim->last) < 0)))
+            victim = peer;
+    }
+    if (!create || NULL == victim)
+        return NULL;
+    coap_peer_reset(victim, ip, port);
+    return victim;
+}
+
+// One estimator update, returns SRTT + k * RTTVAR in ms
+static uint32_t coap_rtt_update(coap_rtt_t *e, uint32_t rtt, uint8_t k)
+{
+    uint32_t r = rtt << 3, delta;
+
+    if (!e->valid)
+    {
+        e->srtt = r;
+        e->rttvar = r >> 1;
+        e->valid = true;
+    }
+    else
+    {
+        delta = (e->srtt > r) ? e->srtt - r : r - e->srtt;
+        e->rttvar = e->rttvar - (e->rttvar >> 2) + (delta >> 2);
+        e->srtt = e->srtt - (e->srtt >> 3) + rtt;
+    }
+    return (e->srtt + k * e->rttvar) >> 3;
+}
+
+// Feeds the RTT of an answered CON request to the strong or the weak estimator
+// and blends it into the overall RTO, strong 1/2 and weak 1/4
+static void coap_peer_sample(coap_peer_t *peer, uint32_t rtt, uint8_t retransmit)
+{
+    uint32_t e;
+
+    if (0 == retransmit)
+    {
+        e = coap_rtt_update(&peer->strong, rtt, 4);
+        peer->rto = (e + peer->rto) >> 1;
+    }
+    else if (retransmit <= COAP_RTO_WEAK_MAX)
+    {
+        e = coap_rtt_update(&peer->weak, rtt, 1);
+        peer->rto = (e + 3 * peer->rto) >> 2;
+    }
+    else
+        return;
+
+    if (peer->rto < peer->rto_min)
+        peer->rto = peer->rto_min;
+    if (peer->rto > peer->rto_max)
+        peer->rto = peer->rto_max;
+    peer->rto_stamp = coap_millis();
+}
+
+// RTO of a server, aged towards ACK_TIMEOUT when it has not been updated for a while:
+// a small one is doubled after 16 RTOs, a large one halved towards 1 s after 4 RTOs
+static uint32_t coap_peer_rto(coap_peer_t *peer)
+{
+    uint32_t idle = coap_millis() - peer->rto_stamp;
+
+    if (peer->rto < 1000 && idle > 16 * peer->rto)
+    {
+        peer->rto *= 2;
+        peer->rto_stamp = coap_millis();
+    }
+    else if (peer->rto > 3000 && idle > 4 * peer->rto)
+    {
+        peer->rto = 1000 + peer->rto / 2;
+        peer->rto_stamp = coap_millis();
+    }
+    if (peer->rto < peer->rto_min)
+        peer->rto = peer->rto_min;
+    if (peer->rto > peer->rto_max)
+        peer->rto = peer->rto_max;
+    return peer->rto;
+}
+
+int coapClient_setRtoBounds(const uint8_t *ip, uint16_t port, uint32_t min_ms, uint32_t max_ms)
+{
+    coap_peer_t *peer;
+
+    // the jitter of the first timeout is drawn below 65536 ms
+    if (0 == min_ms || min_ms > max_ms || max_ms > 2 * 65535U)
+        return COAP_ERR_UNSUPPORTED;
+    if (NULL == (peer = coap_peer_get(ip, port, true)))
+        return COAP_ERR_NO_TRANSACTION;
+    peer->pinned = true;
+    peer->rto_min = min_ms;
+    peer->rto_max = max_ms;
+    coap_peer_rto(peer);
+    return 0;
+}
+
+uint32_t coapClient_getRto(const uint8_t *ip, uint16_t port)
+{
+    coap_peer_t *peer = coap_peer_get(ip, port, false);
+
+    return (NULL != peer) ? peer->rto : ACK_TIMEOUT;
+}
+
+// Adds an option to the message of len bytes at buf, which has room for size bytes.
+// The options are re-encoded because the deltas of the later ones change.
+static int coap_wire_add_option(uint8_t *buf, uint16_t *len, size_t size, uint16_t num, const uint8_t *val, size_t vlen)
+{
+    uint8_t tmp[COAP_WIRE_REENCODE_SIZE];
+    coap_packet_t pkt;
+    coap_option_writer_t w;
+    coap_option_iter_t it;
+    coap_option_t opt;
+    size_t hdr;
+    bool added = false;
+    int rc;
+
+    if (0 != (rc = coap_parse(&pkt, buf, *len)))
+        return rc;
+    hdr = 4 + pkt.hdr.tkl;
+    if (size > hdr + sizeof(tmp))
+        size = hdr + sizeof(tmp);
+
+    coap_option_writer_init(&w, tmp, size - hdr);
+    coap_option_iter_init(&it, &pkt);
+    while (coap_option_next(&it, &opt))
+    {
+        if (!added && opt.num > num)
+        {
+            if (0 != (rc = coap_option_add(&w, num, val, vlen)))
+                return rc;
+            added = true;
+        }
+        if (0 != (rc = coap_option_add(&w, opt.num, opt.buf.p, opt.buf.len)))
+            return rc;
+    }
+    if (!added && 0 != (rc = coap_option_add(&w, num, val, vlen)))
+        return rc;
+    if (pkt.payload.len > 0)
+    {
+        if ((size_t)(w.end - w.p) < 1 + pkt.payload.len)
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        *w.p++ = 0xFF;
+        memcpy(w.p, pkt.payload.p, pkt.payload.len);
+        w.p += pkt.payload.len;
+    }
+
+    // header and token stay where they are
+    memcpy(buf + hdr, tmp, w.p - tmp);
+    *len = hdr + (w.p - tmp);
+    return 0;
+}
+
+// Max-Age of a response in seconds
+static uint32_t coap_max_age(const coap_packet_t *rsp)
+{
+    coap_option_iter_t it;
+    coap_option_t opt;
+    uint32_t age = 0;
+    size_t i;
+
+    if (0 == coap_findOptions(rsp, COAP_OPTION_MAX_AGE, &it) || !coap_option_next(&it, &opt) || opt.buf.len > 4)
+        return MAX_AGE_DEFAULT;
+    for (i = 0; i < opt.buf.len; i++)
+        age = (age << 8) | opt.buf.p[i];
+    return (age > MAX_AGE_LIMIT) ? MAX_AGE_LIMIT : age;
+}
+
+#if COAP_CLIENT_CACHE_ENTRIES > 0
+// Where the cache key ends and whether the request may use the cache: a GET
+// without ETag, Observe or Block2 of its own
+static bool coap_cache_key(const coap_txn_t *t, coap_packet_t *req)
+{
+    coap_option_iter_t it;
+    coap_option_t opt;
+
+    if (COAP_METHOD_GET != t->buf[1] || 0 != coap_parse(req, t->buf, t->len))
+        return false;
+    coap_option_iter_init(&it, req);
+    while (coap_option_next(&it, &opt))
+        if (COAP_OPTION_ETAG == opt.num || COAP_OPTION_OBSERVE == opt.num || COAP_OPTION_BLOCK2 == opt.num)
+            return false;
+    return req->opts.len <= COAP_CACHE_SLOT_SIZE;
+}
+
+// FNV-1a
+static uint32_t coap_cache_hash(const uint8_t *p, size_t len)
+{
+    uint32_t h = 2166136261U;
+
+    while (len--)
+        h = (h ^ *p++) * 16777619U;
+    return h;
+}
+
+static coap_cache_entry_t *coap_cache_find(const coap_peer_t *peer, const coap_packet_t *req, uint32_t hash)
+{
+    coap_cache_entry_t *e;
+
+    for (e = coap_cache; e < coap_cache + COAP_CLIENT_CACHE_ENTRIES; e++)
+    {
+        if (e->used && e->hash == hash && e->key_len == req->opts.len && e->port == peer->port
+            && 0 == memcmp(e->ip, peer->ip, 4)
+            && 0 == memcmp(coap_cache_arena + (e - coap_cache) * COAP_CACHE_SLOT_SIZE, req->opts.p, req->opts.len))
+            return e;
+    }
+    return NULL;
+}
+
+// Looks t up in the cache. Returns true if a fresh response is there, t is then
+// answered by coapClient_run(). A stale one with an ETag is revalidated.
+static bool coap_cache_begin(coap_txn_t *t, coap_peer_t *peer)
+{
+    coap_packet_t req;
+    coap_cache_entry_t *e;
+
+    if (!coap_cache_key(t, &req))
+        return false;
+    if (NULL == (e = coap_cache_find(peer, &req, coap_cache_hash(req.opts.p, req.opts.len))))
+    {
+        coap_cache_stats.misses++;
+        return false;
+    }
+
+    e->last = coap_millis();
+    if ((int32_t)(e->expire - coap_millis()) > 0)
+    {
+        coap_cache_stats.hits++;
+        e->refs++;
+        t->cache = e - coap_cache;
+        return true;
+    }
+
+    coap_cache_stats.stale++;
+    if (0 != e->etag_len && 0 == coap_wire_add_option(t->buf, &t->len, t->size, COAP_OPTION_ETAG, e->etag, e->etag_len))
+    {
+        e->refs++;
+        t->cache = e - coap_cache;
+    }
+    return false;
+}
+
+static void coap_cache_refresh(coap_cache_entry_t *e, const coap_packet_t *rsp)
+{
+    e->expire = coap_millis() + coap_max_age(rsp) * 1000U;
+    e->last = coap_millis();
+}
+
+// Takes the entry for a new response, unused first, else the least recently used one
+static coap_cache_entry_t *coap_cache_victim(void)
+{
+    coap_cache_entry_t *e, *victim = NULL;
+
+    for (e = coap_cache; e < coap_cache + COAP_CLIENT_CACHE_ENTRIES; e++)
+    {
+        if (!e->used)
+            return e;
+        if (0 == e->refs && (NULL == victim || (int32_t)(e->last - victim->last) < 0))
+            victim = e;
+    }
+    if (NULL != victim)
+        coap_cache_stats.evictions++;
+    return victim;
+}
+
+// Keeps a 2.05 response to the GET of t, in the entry of its key or in a new one
+static void coap_cache_store(coap_txn_t *t, const coap_packet_t *rsp)
+{
+    coap_peer_t *peer = &coap_peers[t->peer];
+    coap_packet_t req;
+    coap_cache_entry_t *e;
+    coap_option_iter_t it;
+    coap_option_t opt;
+    const uint8_t *start = rsp->opts.p - 4 - rsp->hdr.tkl;
+    const uint8_t *end = (rsp->payload.len > 0) ? rsp->payload.p + rsp->payload.len : rsp->opts.p + rsp->opts.len;
+    uint32_t hash;
+    uint8_t *slot;
+
+    // an entry being revalidated is replaced, else the request still has the options it was looked up with
+    if (t->cache >= 0)
+        e = &coap_cache[t->cache];
+    else
+    {
+        if (!coap_cache_key(t, &req))
+            return;
+        hash = coap_cache_hash(req.opts.p, req.opts.len);
+        if (NULL == (e = coap_cache_find(peer, &req, hash)))
+        {
+            if (NULL == (e = coap_cache_victim()))
+                return;
+            slot = coap_cache_arena + (e - coap_cache) * COAP_CACHE_SLOT_SIZE;
+            memcpy(slot, req.opts.p, req.opts.len);
+            e->key_len = req.opts.len;
+            e->hash = hash;
+            memcpy(e->ip, peer->ip, 4);
+            e->port = peer->port;
+            e->used = false;
+        }
+    }
+    slot = coap_cache_arena + (e - coap_cache) * COAP_CACHE_SLOT_SIZE;
+
+    e->etag_len = 0;
+    if ((size_t)(end - start) > COAP_CACHE_SLOT_SIZE - e->key_len)
+    {
+        // too large, an older copy must not be served any more
+        if (0 == e->refs)
+            e->used = false;
+        else
+            e->expire = coap_millis();
+        return;
+    }
+    memcpy(slot + e->key_len, start, end - start);
+    e->rsp_len = end - start;
+    if (1 == coap_findOptions(rsp, COAP_OPTION_ETAG, &it) && coap_option_next(&it, &opt) && opt.buf.len <= sizeof(e->etag))
+    {
+        memcpy(e->etag, opt.buf.p, opt.buf.len);
+        e->etag_len = opt.buf.len;
+    }
+    coap_cache_refresh(e, rsp);
+    e->used = true;
+    coap_cache_stats.stores++;
+}
+
+// Cache side of completing t. Returns 0 with the stored response in cached if that is
+// what the callback gets: for a fresh hit, and for 2.03 Valid to a revalidation.
+static int coap_cache_complete(coap_txn_t *t, int rc, const coap_packet_t *rsp, coap_packet_t *cached)
+{
+    coap_cache_entry_t *e = (t->cache >= 0) ? &coap_cache[t->cache] : NULL;
+    int ret = -1;
+
+    if (0 == rc && NULL != rsp && COAP_RSPCODE_CONTENT == rsp->hdr.code)
+        coap_cache_store(t, rsp);
+
+    if (NULL != e)
+    {
+        if (0 == rc && NULL != rsp && COAP_RSPCODE_VALID == rsp->hdr.code)
+        {
+            coap_cache_stats.revalidated++;
+            coap_cache_refresh(e, rsp);
+            rsp = NULL;
+        }
+        // a fresh hit has no response of its own
+        if (0 == rc && NULL == rsp && e->used
+            && 0 == coap_parse(cached, coap_cache_arena + (e - coap_cache) * COAP_CACHE_SLOT_SIZE + e->key_len, e->rsp_len))
+            ret = 0;
+        e->refs--;
+        t->cache = -1;
+    }
+    return ret;
+}
+
+#else
+static coap_client_cache_stats_t coap_cache_stats;
+#endif
+
+void coapClient_setClock(uint64_t (*clock)(void))
+{
+    coap_client_clock = clock;
+    // the wheel counts from the new time base, unless timers already run on the old one
+    if (0 == coap_wheel.count)
+        coap_timer_wheel_init(&coap_wheel, coap_millis());
+}
+
+int32_t coapClient_nextTimeoutMs(void)
+{
+    return coap_timer_next_ms(&coap_wheel, coap_millis());
+}
+
+void coapClient_setCache(bool enable)
+{
+#if COAP_CLIENT_CACHE_ENTRIES > 0
+    coap_cache_on = enable;
+#else
+    (void)enable;
+#endif
+}
+
+const coap_client_cache_stats_t *coapClient_getCacheStats(void)
+{
+    return &coap_cache_stats;
+}
+
+static bool coap_txn_confirmable(const coap_txn_t *t)
+{
+    return COAP_TYPE_CON == ((t->buf[0] >> 4) & 0x03);
+}
+
+// Sends the wire image of t, first transmission or retransmission
+static int32_t coap_txn_send(coap_txn_t *t)
+{
+    coap_peer_t *peer = &coap_peers[t->peer];
+    int32_t ret;
+
+    COAP_TRACE_BEGIN(COAP_TRACE_CLI_TX);
+    ret = sendto(COAPSock_Num, t->buf, t->len, peer->ip, peer->port);
+    COAP_TRACE_POINT(COAP_TRACE_CLI_SEND);
+    if (ret < 0)
+    {
+        printf("Failed to send request to the server, error code: %ld\n", (long)ret);
+        COAPSock_Open = false;
+    }
+    return ret;
+}
+
+static void coap_txn_complete(coap_txn_t *t, int rc, const coap_packet_t *rsp);
+static void coap_txn_release(coap_txn_t *t);
+
+// Timer of t expired, retransmits it or gives up
+static void coap_txn_expired(coap_timer_t *timer, void *arg)
+{
+    coap_txn_t *t = arg;
+
+    if (t->state != COAP_TXN_SENT || !coap_txn_confirmable(t) || t->retransmit >= MAX_RETRANSMIT)
+    {
+        coap_txn_complete(t, COAP_ERR_TIMEOUT, NULL);
+        return;
+    }
+    // CoCoA variable backoff, faster for a short RTO and slower for a long one
+    t->retransmit++;
+    if (t->rto < 1000)
+        t->timeout *= 3;
+    else if (t->rto > 3000)
+        t->timeout += t->timeout >> 1;
+    else
+        t->timeout *= 2;
+    coap_timer_start(&coap_wheel, timer, coap_millis(), t->timeout, coap_txn_expired, t);
+    coap_txn_send(t);
+}
+
+// Moves t from QUEUED to SENT, the peer must have a free NSTART slot
+static void coap_txn_start(coap_txn_t *t)
+{
+    if (t->state == COAP_TXN_QUEUED)
+        coap_txn_queued--;
+    t->state = COAP_TXN_SENT;
+    coap_peers[t->peer].inflight++;
+
+    // first timeout is the RTO times ACK_RANDOM_FACTOR, a random value in [1, 1.5)
+    if (coap_txn_confirmable(t))
+    {
+        t->rto = coap_peer_rto(&coap_peers[t->peer]);
+        t->timeout = t->rto + coap_rand_range(t->rto >> 1);
+    }
+    else
+        t->timeout = MAX_TRANSMIT_SPAN;
+    t->sent = coap_millis();
+    coap_timer_start(&coap_wheel, &t->timer, coap_millis(), t->timeout, coap_txn_expired, t);
+
+    coap_txn_send(t);
+}
+
+// Releases t, then reports the outcome. The slot is free again by the time cb runs,
+// so the callback may submit the next request.
+static void coap_txn_complete(coap_txn_t *t, int rc, const coap_packet_t *rsp)
+{
+    coap_peer_t *peer = &coap_peers[t->peer];
+    coap_response_func cb = t->cb;
+    void *arg = t->arg;
+
+#if COAP_CLIENT_CACHE_ENTRIES > 0
+    coap_packet_t cached;
+#endif
+
+    if (t->state == COAP_TXN_QUEUED)
+        coap_txn_queued--;
+#if COAP_CLIENT_CACHE_ENTRIES > 0
+    else if (t->state == COAP_TXN_CACHED)
+        coap_txn_cached--;
+#endif
+    else
+        peer->inflight--;
+    coap_timer_stop(&coap_wheel, &t->timer);
+    peer->refs--;
+    t->state = COAP_TXN_FREE;
+    coap_pool_free(&coap_txn_pool, t);
+
+#if COAP_CLIENT_CACHE_ENTRIES > 0
+    if ((coap_cache_on || t->cache >= 0) && 0 == coap_cache_complete(t, rc, rsp, &cached))
+        rsp = &cached;
+#endif
+    // the cache has taken the request from it
+    coap_txn_release(t);
+
+    if (NULL != cb)
+        cb(rc, rsp, arg);
+}
+
+// Takes a free transaction and the entry of its server
+static coap_txn_t *coap_txn_alloc(const uint8_t *ip, uint16_t port, coap_peer_t **peer)
+{
+    coap_txn_t *t;
+
+    if (NULL == (t = coap_pool_alloc(&coap_txn_pool)))
+        return NULL;
+    if (NULL == (*peer = coap_peer_get(ip, port, true)))
+    {
+        coap_pool_free(&coap_txn_pool, t);
+        return NULL;
+    }
+    return t;
+}
+
+// Gives t room for a request of len bytes, its own slot or else the shared slot of the larger requests
+static int coap_txn_reserve(coap_txn_t *t, size_t len)
+{
+    if (len <= t->size)
+        return 0;
+    if (len > coap_txn_large_size)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    if (NULL != coap_txn_large_owner)
+        return COAP_ERR_NO_TRANSACTION;
+    coap_txn_large_owner = t;
+    t->buf = coap_txn_large;
+    t->size = coap_txn_large_size;
+    return 0;
+}
+
+// Gives the shared slot back if t holds it, t is at its own slot again
+static void coap_txn_release(coap_txn_t *t)
+{
+    if (coap_txn_large_owner != t)
+        return;
+    coap_txn_large_owner = NULL;
+    t->buf = pCOAP_TX + (t - coap_txns) * COAP_CLIENT_TXN_SIZE;
+    t->size = COAP_CLIENT_TXN_SIZE;
+}
+
+// Writes the next message ID into the wire image at buf, and the next token if
+// the request gets a fresh one. Responses are matched on the token.
+static void coap_txn_stamp(uint8_t *buf, bool fresh_token)
+{
+    coap_mid++;
+    buf[2] = coap_mid >> 8;
+    buf[3] = coap_mid & 0xFF;
+    if (fresh_token)
+    {
+        coap_token++;
+        buf[4] = coap_token >> 24;
+        buf[5] = coap_token >> 16;
+        buf[6] = coap_token >> 8;
+        buf[7] = coap_token;
+    }
+}
+
+// Queues t, whose wire image of len bytes is in place, and sends it if there is an NSTART slot.
+// A GET with a fresh cached response is not sent at all.
+static void coap_txn_queue(coap_txn_t *t, coap_peer_t *peer, size_t len, coap_response_func cb, void *arg)
+{
+    t->len = len;
+    t->peer = peer - coap_peers;
+    t->retransmit = 0;
+    t->cache = -1;
+    t->cb = cb;
+    t->arg = arg;
+    t->state = COAP_TXN_QUEUED;
+    peer->refs++;
+    peer->last = coap_millis();
+
+#if COAP_CLIENT_CACHE_ENTRIES > 0
+    if (coap_cache_on && coap_cache_begin(t, peer))
+    {
+        t->state = COAP_TXN_CACHED;
+        coap_txn_cached++;
+        return;
+    }
+#endif
+    coap_txn_queued++;
+
+    if (COAPSock_Open && peer->inflight < COAP_CLIENT_NSTART)
+        coap_txn_start(t);
+}
+
+int coapClient_submit(const uint8_t *ip, uint16_t port, const coap_packet_t *req, coap_response_func cb, void *arg)
+{
+    coap_packet_t pkt = *req;
+    coap_peer_t *peer;
+    coap_txn_t *t;
+    uint8_t tok[COAP_PREPARED_TKL] = {0};
+    size_t len = COAP_CLIENT_TXN_SIZE;
+    bool fresh_token = (0 == pkt.hdr.tkl);
+    int rc;
+
+    if (NULL == ip)
+    {
+        ip = destip;
+        port = destport;
+    }
+
+    if (NULL == (t = coap_txn_alloc(ip, port, &peer)))
+        return COAP_ERR_NO_TRANSACTION;
+
+    // requests without a token get a fresh one
+    if (fresh_token)
+    {
+        pkt.hdr.tkl = sizeof(tok);
+        pkt.tok.p = tok;
+        pkt.tok.len = sizeof(tok);
+    }
+    rc = coap_build(t->buf, &len, &pkt);
+    // too large for its own slot, built again in the shared one
+    if (COAP_ERR_BUFFER_TOO_SMALL == rc && 0 == (rc = coap_txn_reserve(t, (size_t)COAP_CLIENT_TXN_SIZE + 1)))
+    {
+        len = t->size;
+        rc = coap_build(t->buf, &len, &pkt);
+    }
+    if (0 != rc)
+    {
+        coap_txn_release(t);
+        coap_pool_free(&coap_txn_pool, t);
+        return rc;
+    }
+    coap_txn_stamp(t->buf, fresh_token);
+
+    coap_txn_queue(t, peer, len, cb, arg);
+    return 0;
+}
+
+int coapClient_submitPrepared(const uint8_t *ip, uint16_t port, const coap_prepared_t *req, coap_response_func cb, void *arg)
+{
+    coap_peer_t *peer;
+    coap_txn_t *t;
+    int rc;
+
+    if (NULL == ip)
+    {
+        ip = destip;
+        port = destport;
+    }
+
+    if (req->len > COAP_CLIENT_TXN_SIZE && req->len > coap_txn_large_size)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    if (NULL == (t = coap_txn_alloc(ip, port, &peer)))
+        return COAP_ERR_NO_TRANSACTION;
+    if (0 != (rc = coap_txn_reserve(t, req->len)))
+    {
+        coap_pool_free(&coap_txn_pool, t);
+        return rc;
+    }
+
+    // the transaction keeps its own copy for the retransmissions, so one
+    // prepared request can be outstanding several times
+    memcpy(t->buf, req->buf, req->len);
+    coap_txn_stamp(t->buf, true);
+
+    coap_txn_queue(t, peer, req->len, cb, arg);
+    return 0;
+}
+
+static void coap_client_empty(uint8_t type, const uint8_t *mid, uint8_t *ip, uint16_t port)
+{
+    uint8_t msg[4];
+
+    msg[0] = (0x01 << 6) | (type << 4);
+    msg[1] = 0;
+    msg[2] = mid[0];
+    msg[3] = mid[1];
+    sendto(COAPSock_Num, msg, sizeof(msg), ip, port);
+}
+
+static void coap_observe_response(int rc, const coap_packet_t *rsp, void *arg);
+
+// Sends the registration request of o again, with a new message ID
+static int coap_observe_register(coap_observation_t *o)
+{
+    coap_peer_t *peer;
+    coap_txn_t *t;
+    int rc;
+
+    if (NULL == (t = coap_txn_alloc(o->ip, o->port, &peer)))
+        return COAP_ERR_NO_TRANSACTION;
+    if (0 != (rc = coap_txn_reserve(t, o->len)))
+    {
+        coap_pool_free(&coap_txn_pool, t);
+        return rc;
+    }
+    memcpy(t->buf, o->buf, o->len);
+    coap_txn_stamp(t->buf, false);
+    o->registering = true;
+    coap_txn_queue(t, peer, o->len, coap_observe_response, o);
+    return 0;
+}
+
+static void coap_observe_expired(coap_timer_t *timer, void *arg)
+{
+    coap_observation_t *o = arg;
+
+    // no free transaction, try again a second later
+    if (!o->registering && 0 != coap_observe_register(o))
+        coap_timer_start(&coap_wheel, timer, coap_millis(), 1000, coap_observe_expired, o);
+}
+
+static void coap_observe_free(coap_observation_t *o)
+{
+    o->used = false;
+    coap_pool_free(&coap_observation_pool, o);
+}
+
+static void coap_observe_end(coap_observation_t *o)
+{
+    coap_timer_stop(&coap_wheel, &o->timer);
+    o->cb = NULL;
+    if (!o->registering)
+        coap_observe_free(o);
+}
+
+// Hands a registration response or a notification to the callback. Returns false
+// if it was older than the last one delivered and was dropped.
+static bool coap_observe_deliver(coap_observation_t *o, const coap_packet_t *rsp, bool registration)
+{
+    coap_response_func cb = o->cb;
+    void *arg = o->arg;
+    coap_option_iter_t it;
+    coap_option_t opt;
+    uint32_t seq = 0, now = coap_millis(), delay;
+    size_t i;
+
+    if (rsp->hdr.code >= 0x80 || 1 != coap_findOptions(rsp, COAP_OPTION_OBSERVE, &it)
+        || !coap_option_next(&it, &opt) || opt.buf.len > 3)
+    {
+        // no Observe in the response, the observation is over
+        coap_observe_end(o);
+        cb(0, rsp, arg);
+        return true;
+    }
+    for (i = 0; i < opt.buf.len; i++)
+        seq = (seq << 8) | opt.buf.p[i];
+
+    // RFC 7641 section 3.4, sequence numbers are 24 bit and wrap
+    if (!registration && o->seq_valid && now - o->seq_time <= OBSERVE_REORDER_MS
+        && !((o->seq < seq && seq - o->seq < (1UL << 23)) || (o->seq > seq && o->seq - seq > (1UL << 23))))
+        return false;
+    o->seq = seq;
+    o->seq_time = now;
+    o->seq_valid = true;
+
+    // re-register when 7/8 of Max-Age has passed, so the server never sees it run out
+    delay = coap_max_age(rsp) * 1000U;
+    delay -= delay >> 3;
+    coap_timer_start(&coap_wheel, &o->timer, coap_millis(), (delay < 1000) ? 1000 : delay, coap_observe_expired, o);
+
+    cb(0, rsp, arg);
+    return true;
+}
+
+// Completion of a registration request
+static void coap_observe_response(int rc, const coap_packet_t *rsp, void *arg)
+{
+    coap_observation_t *o = arg;
+    coap_response_func cb = o->cb;
+
+    o->registering = false;
+    if (NULL == cb)
+    {
+        coap_observe_free(o);   // cancelled meanwhile
+        return;
+    }
+    if (0 != rc || NULL == rsp)
+    {
+        coap_observe_end(o);
+        cb(rc, rsp, o->arg);
+        return;
+    }
+    coap_observe_deliver(o, rsp, true);
+}
+
+// Takes a notification nobody has a transaction for. Returns true if it belongs to an observation.
+static bool coap_observe_recv(const coap_packet_t *pkt, uint8_t *ip, uint16_t port)
+{
+    coap_observation_t *o;
+
+    if (COAP_PREPARED_TKL != pkt->hdr.tkl)
+        return false;
+    for (o = coap_observations; o < coap_observations + COAP_CLIENT_OBSERVE_MAX; o++)
+    {
+        if (!o->used || NULL == o->cb || o->port != port || 0 != memcmp(o->ip, ip, 4)
+            || 0 != memcmp(o->buf + 4, pkt->tok.p, COAP_PREPARED_TKL))
+            continue;
+        if (pkt->hdr.t == COAP_TYPE_CON)
+            coap_client_empty(COAP_TYPE_ACK, pkt->hdr.id, ip, port);
+        coap_observe_deliver(o, pkt, false);
+        return true;
+    }
+    return false;
+}
+
+int coapClient_observe(const uint8_t *ip, uint16_t port, const coap_prepared_t *req, coap_response_func cb, void *arg, uint8_t *handle)
+{
+    static const uint8_t observe_register = 0;
+    coap_observation_t *o;
+    int rc;
+
+    if (NULL == ip)
+    {
+        ip = destip;
+        port = destport;
+    }
+    if (NULL == cb || req->len > COAP_CLIENT_OBSERVE_REQ_SIZE)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    if (NULL == (o = coap_pool_alloc(&coap_observation_pool)))
+        return COAP_ERR_NO_TRANSACTION;
+
+    // the token stays the same for the re-registrations, Observe 0 is a zero length value
+    memcpy(o->buf, req->buf, req->len);
+    o->len = req->len;
+    coap_txn_stamp(o->buf, true);
+    if (0 != (rc = coap_wire_add_option(o->buf, &o->len, sizeof(o->buf), COAP_OPTION_OBSERVE, &observe_register, 0)))
+    {
+        coap_pool_free(&coap_observation_pool, o);
+        return rc;
+    }
+
+    memcpy(o->ip, ip, 4);
+    o->port = port;
+    o->seq_valid = false;
+    o->cb = cb;
+    o->arg = arg;
+    if (0 != (rc = coap_observe_register(o)))
+    {
+        coap_pool_free(&coap_observation_pool, o);
+        return rc;
+    }
+    o->used = true;
+    *handle = coap_pool_index(&coap_observation_pool, o);
+    return 0;
+}
+
+// Forgets the observation, the server is sent a RST for its next notification (RFC 7641 section 3.6)
+void coapClient_cancelObserve(uint8_t handle)
+{
+    if (handle < COAP_CLIENT_OBSERVE_MAX && coap_observations[handle].used)
+        coap_observe_end(&coap_observations[handle]);
+}
+
+
+// Matches a received message to its transaction, ACK and RST by message ID,
+// responses by token. A message is only taken from the server the request went to.
+static void coap_download_response(int rc, const coap_packet_t *rsp, void *arg);
+
+// Sends the request for block num of d
+static int coap_download_request(coap_download_t *d, uint32_t num)
+{
+    coap_block_t blk = {num, false, d->szx};
+    coap_peer_t *peer;
+    coap_txn_t *t;
+    uint8_t val[4];
+    uint16_t len = d->req_len;
+    int rc;
+
+    if (NULL == (t = coap_txn_alloc(d->ip, d->port, &peer)))
+        return COAP_ERR_NO_TRANSACTION;
+    // room for a Block2 option of up to 3 bytes, its header and an extended delta
+    if (0 != (rc = coap_txn_reserve(t, (size_t)len + 5)))
+    {
+        coap_pool_free(&coap_txn_pool, t);
+        return rc;
+    }
+    memcpy(t->buf, d->req, len);
+    coap_txn_stamp(t->buf, true);
+    if (0 != (rc = coap_wire_add_option(t->buf, &len, t->size, COAP_OPTION_BLOCK2, val,
+                                        coap_encode_uint(val, (blk.num << 4) | blk.szx))))
+    {
+        coap_txn_release(t);
+        coap_pool_free(&coap_txn_pool, t);
+        return rc;
+    }
+    d->inflight++;
+    coap_txn_queue(t, peer, len, coap_download_response, d);
+    return 0;
+}
+
+// Keeps up to window blocks in flight once the size is known, else one
+static void coap_download_pump(coap_download_t *d)
+{
+    int rc;
+
+    while (0 == d->rc && d->inflight < (d->last_known ? d->window : 1) && (!d->last_known || d->next <= d->last))
+    {
+        if (0 != (rc = coap_download_request(d, d->next)))
+        {
+            // out of transactions, the next completion tries again
+            if (0 == d->inflight)
+                d->rc = rc;
+            break;
+        }
+        d->next++;
+    }
+}
+
+// Checks a block and hands it to the sink
+static int coap_download_block(coap_download_t *d, const coap_packet_t *rsp)
+{
+    coap_option_iter_t it;
+    coap_option_t opt;
+    coap_block_t blk;
+    coap_block_result_t found;
+    uint32_t size2;
+    int rc;
+
+    if (COAP_RSPCODE_CONTENT != rsp->hdr.code)
+        return COAP_ERR_RESPONSE_CODE;
+
+    // the representation must not change during the transfer
+    if (1 == coap_findOptions(rsp, COAP_OPTION_ETAG, &it) && coap_option_next(&it, &opt) && opt.buf.len <= sizeof(d->etag))
+    {
+        if (!d->etag_seen)
+        {
+            memcpy(d->etag, opt.buf.p, opt.buf.len);
+            d->etag_len = opt.buf.len;
+            d->etag_seen = true;
+        }
+        else if (opt.buf.len != d->etag_len || 0 != memcmp(d->etag, opt.buf.p, opt.buf.len))
+            return COAP_ERR_ETAG_MISMATCH;
+    }
+
+    found = coap_block_get(rsp, COAP_OPTION_BLOCK2, &blk);
+    if (COAP_BLOCK_INVALID == found)
+        return COAP_ERR_UNSUPPORTED;
+    if (COAP_BLOCK_ABSENT == found)
+    {
+        // small enough for one response, the server sent it whole
+        blk.num = 0;
+        blk.more = false;
+        blk.szx = d->szx;
+    }
+    else if (blk.szx != d->szx)
+    {
+        // the server may only ask for smaller blocks, and only in the first response
+        if (0 != d->received || blk.szx > d->szx || 0 != blk.num)
+            return COAP_ERR_UNSUPPORTED;
+        d->szx = blk.szx;
+    }
+
+    if (!d->last_known && coap_option_uint(rsp, COAP_OPTION_SIZE2, &size2))
+    {
+        d->last = (0 == size2) ? 0 : (size2 - 1) >> (d->szx + 4);
+        d->last_known = true;
+    }
+    if (!blk.more)
+    {
+        d->last = blk.num;
+        d->last_known = true;
+    }
+    if (blk.more && rsp->payload.len != COAP_BLOCK_SIZE(blk.szx))
+        return COAP_ERR_MESSAGE_INCOMPLETE;
+
+    if (rsp->payload.len > 0 && 0 != (rc = d->sink(COAP_BLOCK_OFFSET(&blk), rsp->payload.p, rsp->payload.len, d->arg)))
+        return rc;
+    d->received++;
+    d->total += rsp->payload.len;
+    return 0;
+}
+
+// Completion of a block request
+static void coap_download_response(int rc, const coap_packet_t *rsp, void *arg)
+{
+    coap_download_t *d = arg;
+
+    d->inflight--;
+    if (0 == d->rc)
+    {
+        if (0 == rc && NULL == rsp)
+            rc = COAP_ERR_RESPONSE_CODE;
+        if (0 == rc)
+            rc = coap_download_block(d, rsp);
+        d->rc = rc;
+    }
+
+    if (0 == d->rc && !(d->last_known && d->received == d->last + 1))
+        coap_download_pump(d);
+    if (0 != d->inflight)
+        return;
+    if (0 == d->rc && !(d->last_known && d->received == d->last + 1))
+        return;
+
+    coap_pool_free(&coap_download_pool, d);
+    d->done(d->rc, d->total, d->arg);
+}
+
+int coapClient_download(const uint8_t *ip, uint16_t port, const coap_prepared_t *req, uint8_t szx, uint8_t window, coap_sink_func sink, coap_download_func done, void *arg)
+{
+    coap_download_t *d;
+    int rc;
+
+    if (NULL == ip)
+    {
+        ip = destip;
+        port = destport;
+    }
+    if (NULL == sink || NULL == done)
+        return COAP_ERR_UNSUPPORTED;
+
+    if (NULL == (d = coap_pool_alloc(&coap_download_pool)))
+        return COAP_ERR_NO_TRANSACTION;
+
+    memset(d, 0, sizeof(*d));
+    memcpy(d->ip, ip, 4);
+    d->port = port;
+    d->req = req->buf;
+    d->req_len = req->len;
+    d->szx = (szx > 6) ? 6 : szx;
+    d->window = (0 == window) ? 1 : window;
+    d->sink = sink;
+    d->done = done;
+    d->arg = arg;
+
+    // block 0 alone first, its answer gives the block size and often the total size
+    if (0 != (rc = coap_download_request(d, 0)))
+    {
+        coap_pool_free(&coap_download_pool, d);
+        return rc;
+    }
+    d->next = 1;
+    return 0;
+}
+
+static void coap_done_expired(coap_timer_t *timer, void *arg)
+{
+    ((coap_done_t *)arg)->used = false;
+}
+
+static void coap_done_store(const coap_packet_t *pkt, const uint8_t *ip, uint16_t port)
+{
+    coap_done_t *d = &coap_done[coap_done_next];
+
+    coap_done_next = (coap_done_next + 1) % COAP_CLIENT_DONE_ENTRIES;
+    d->used = true;
+    memcpy(d->ip, ip, 4);
+    d->port = port;
+    memcpy(d->mid, pkt->hdr.id, 2);
+    d->tkl = pkt->hdr.tkl;
+    memcpy(d->tok, pkt->tok.p, pkt->hdr.tkl);
+    coap_timer_start(&coap_wheel, &d->timer, coap_millis(), EXCHANGE_LIFETIME, coap_done_expired, d);
+}
+
+static bool coap_done_find(const coap_packet_t *pkt, const uint8_t *ip, uint16_t port)
+{
+    const coap_done_t *d;
+
+    for (d = coap_done; d < coap_done + COAP_CLIENT_DONE_ENTRIES; d++)
+    {
+        if (d->used && d->port == port && 0 == memcmp(d->ip, ip, 4) && 0 == memcmp(d->mid, pkt->hdr.id, 2)
+            && d->tkl == pkt->hdr.tkl && 0 == memcmp(d->tok, pkt->tok.p, pkt->hdr.tkl))
+            return true;
+    }
+    return false;
+}
+
+static void coap_client_recv(const coap_packet_t *pkt, uint8_t *ip, uint16_t port)
+{
+    coap_peer_t *peer = coap_peer_get(ip, port, false);
+    coap_txn_t *t;
+    bool by_mid = (pkt->hdr.t == COAP_TYPE_ACK || pkt->hdr.t == COAP_TYPE_RESET);
+
+    for (t = coap_txns; NULL != peer && t < coap_txns + COAP_CLIENT_MAX_TXN; t++)
+    {
+        if (t->state < COAP_TXN_SENT || t->peer != peer - coap_peers)
+            continue;
+        if (by_mid)
+        {
+            if (t->state == COAP_TXN_SENT && 0 == memcmp(t->buf + 2, pkt->hdr.id, 2))
+                break;
+        }
+        else if (pkt->hdr.tkl == (t->buf[0] & 0x0F) && 0 == memcmp(t->buf + 4, pkt->tok.p, pkt->hdr.tkl))
+            break;
+    }
+
+    if (NULL == peer || t == coap_txns + COAP_CLIENT_MAX_TXN)
+    {
+        coap_option_iter_t it;
+
+        if (by_mid || coap_observe_recv(pkt, ip, port))
+            return;
+        // a separate response we already took, our ACK got lost
+        if (pkt->hdr.t == COAP_TYPE_CON && coap_done_find(pkt, ip, port))
+        {
+            coap_client_empty(COAP_TYPE_ACK, pkt->hdr.id, ip, port);
+            return;
+        }
+        // nobody is waiting for it, a CON must still be answered and
+        // a notification of a forgotten observation is rejected too
+        if (pkt->hdr.t == COAP_TYPE_CON || 0 != coap_findOptions(pkt, COAP_OPTION_OBSERVE, &it))
+            coap_client_empty(COAP_TYPE_RESET, pkt->hdr.id, ip, port);
+        return;
+    }
+
+    // first answer to a CON request, the ACK or a response that stands for it
+    if (t->state == COAP_TXN_SENT && pkt->hdr.t != COAP_TYPE_RESET && coap_txn_confirmable(t))
+        coap_peer_sample(peer, coap_millis() - t->sent, t->retransmit);
+
+    switch (pkt->hdr.t)
+    {
+        case COAP_TYPE_RESET:
+            coap_txn_complete(t, COAP_ERR_RESET, NULL);
+            break;
+        case COAP_TYPE_ACK:
+            if (0 != pkt->hdr.code)
+            {
+                // piggybacked response, the token must match too
+                if (pkt->hdr.tkl == (t->buf[0] & 0x0F) && 0 == memcmp(t->buf + 4, pkt->tok.p, pkt->hdr.tkl))
+                    coap_txn_complete(t, 0, pkt);
+                break;
+            }
+            // empty ACK, stop retransmitting and wait for the separate response
+            t->state = COAP_TXN_ACKED;
+            coap_timer_start(&coap_wheel, &t->timer, coap_millis(), MAX_TRANSMIT_SPAN, coap_txn_expired, t);
+            break;
+        case COAP_TYPE_CON:
+            coap_client_empty(COAP_TYPE_ACK, pkt->hdr.id, ip, port);
+            coap_done_store(pkt, ip, port);
+            // fall through
+        default:
+            coap_txn_complete(t, 0, pkt);
+            break;
+    }
+}
+
+// Opens the socket if needed, returns true once it is SOCK_UDP
+static bool coapClient_open(void)
+{
+    switch (getSn_SR(COAPSock_Num)) {
+        case SOCK_UDP:
+            COAPSock_Open = true;
+            break;
+        case SOCK_CLOSED:
+            // any local port, so a server on the same host can keep 5683
+            if (socket(COAPSock_Num, Sn_MR_UDP, 0, 0x00) == COAPSock_Num) {
+                printf("Opened UDP socket, server port: %d\n", destport);
+                COAPSock_Open = true;
+            }
+            break;
+        default:
+            break;
+    }
+    return COAPSock_Open;
+}
+
+// Starts queued transactions whose server got a free NSTART slot
+static void coapClient_dequeue(void)
+{
+    coap_txn_t *t;
+
+    for (t = coap_txns; t < coap_txns + COAP_CLIENT_MAX_TXN && 0 != coap_txn_queued; t++)
+        if (t->state == COAP_TXN_QUEUED && coap_peers[t->peer].inflight < COAP_CLIENT_NSTART)
+            coap_txn_start(t);
+}
+
+// Never blocks. Handles the datagrams that arrived since the last call, then the
+// retransmission timers. Call it from the main loop as often as possible.
+void coapClient_run()
+{
+    int32_t ret;
+    uint16_t size, n;
+    uint16_t port;
+    uint8_t ip[4];
+    coap_packet_t rx_pkt;
+#if COAP_CLIENT_CACHE_ENTRIES > 0
+    coap_txn_t *t;
+
+    // requests answered from the cache
+    for (t = coap_txns; t < coap_txns + COAP_CLIENT_MAX_TXN && 0 != coap_txn_cached; t++)
+        if (t->state == COAP_TXN_CACHED)
+            coap_txn_complete(t, 0, NULL);
+#endif
+
+    if (!COAPSock_Open && !coapClient_open())
+        return;
+
+    for (n = 0; n < COAP_CLIENT_RX_BATCH; n++)
+    {
+        if (0 == (size = getSn_RX_RSR(COAPSock_Num)))
+            break;
+        if (size > coap_rx_len)
+            size = coap_rx_len;
+
+        COAP_TRACE_BEGIN(COAP_TRACE_CLI_RX);
+        ret = recvfrom(COAPSock_Num, pCOAP_RX, size, ip, &port);
+        if (ret <= 0)
+        {
+            if (ret < 0)
+            {
+                printf("Failed to receive response from the server, error code: %ld\n", (long)ret);
+                COAPSock_Open = false;
+            }
+            break;
+        }
+        COAP_TRACE_POINT(COAP_TRACE_CLI_READ);
+
+        if ((ret = coap_parse(&rx_pkt, pCOAP_RX, ret)) != 0) {
+            printf("Failed to parse CoAP response, error code: %ld\n", (long)ret);
+            continue;
+        }
+        COAP_TRACE_POINT(COAP_TRACE_CLI_PARSE);
+        coap_client_recv(&rx_pkt, ip, port);
+        COAP_TRACE_POINT(COAP_TRACE_CLI_DISPATCH);
+    }
+
+    // retransmissions and timeouts, nothing is scanned
+    coap_timer_advance(&coap_wheel, coap_millis());
+    if (0 != coap_txn_queued)
+        coapClient_dequeue();
+}
@@ -1,207 +1,366 @@
-#ifndef	__COAPCLIENT_H__
-#define	__COAPCLIENT_H__
-
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-#include <stdint.h>
-#include <stdbool.h>
-#include <stddef.h>
-
-#define MAXOPT 16
-
-//http://tools.ietf.org/html/rfc7252#section-3
-typedef struct
-{
-    uint8_t ver;                /* CoAP version number */
-    uint8_t t;                  /* CoAP Message Type */
-    uint8_t tkl;                /* Token length: indicates length of the Token field */
-    uint8_t code;               /* CoAP status code. Can be request (0.xx), success reponse (2.xx), 
-                                 * client error response (4.xx), or rever error response (5.xx) 
-                                 * For possible values, see http://tools.ietf.org/html/rfc7252#section-12.1 */
-    uint8_t id[2];
-} coap_header_t;
-
-typedef struct
-{
-    const uint8_t *p;
-    size_t len;
-} coap_buffer_t;
-
-typedef struct
-{
-    uint8_t *p;
-    size_t len;
-} coap_rw_buffer_t;
-
-typedef struct
-{
-    uint8_t num;                /* Option number. See http://tools.ietf.org/html/rfc7252#section-5.10 */
-    coap_buffer_t buf;          /* Option value */
-} coap_option_t;
-
-typedef struct
-{
-    coap_header_t hdr;          /* Header of the packet */
-    coap_buffer_t tok;          /* Token value, size as specified by hdr.tkl */
-    uint8_t numopts;            /* Number of options */
-    coap_option_t opts[MAXOPT]; /* Options of the packet. For possible entries see
-                                 * http://tools.ietf.org/html/rfc7252#section-5.10 */
-    coap_buffer_t payload;      /* Payload carried by the packet */
-} coap_packet_t;
-
-/////////////////////////////////////////
-
-void MilliTimer_Handler(void);
-
-/*
- * @brief Timer structure
- */
-typedef struct Timer Timer;
-struct Timer {
-	unsigned long systick_period;
-	unsigned long end_time;
-};
-
-// void TimerInit(Timer*);
-// char TimerIsExpired(Timer*);
-// void TimerCountdownMS(Timer*, unsigned int);
-// void TimerCountdown(Timer*, unsigned int);
-// int TimerLeftMS(Timer*);
-
-//http://tools.ietf.org/html/rfc7252#section-12.2
-typedef enum
-{
-    COAP_OPTION_IF_MATCH = 1,
-    COAP_OPTION_URI_HOST = 3,
-    COAP_OPTION_ETAG = 4,
-    COAP_OPTION_IF_NONE_MATCH = 5,
-    COAP_OPTION_OBSERVE = 6,
-    COAP_OPTION_URI_PORT = 7,
-    COAP_OPTION_LOCATION_PATH = 8,
-    COAP_OPTION_URI_PATH = 11,
-    COAP_OPTION_CONTENT_FORMAT = 12,
-    COAP_OPTION_MAX_AGE = 14,
-    COAP_OPTION_URI_QUERY = 15,
-    COAP_OPTION_ACCEPT = 17,
-    COAP_OPTION_LOCATION_QUERY = 20,
-    COAP_OPTION_PROXY_URI = 35,
-    COAP_OPTION_PROXY_SCHEME = 39
-} coap_option_num_t;
-
-//http://tools.ietf.org/html/rfc7252#section-12.1.1
-typedef enum
-{
-    COAP_METHOD_GET = 1,
-    COAP_METHOD_POST = 2,
-    COAP_METHOD_PUT = 3,
-    COAP_METHOD_DELETE = 4
-} coap_method_t;
-
-//http://tools.ietf.org/html/rfc7252#section-12.1.1
-typedef enum
-{
-    COAP_TYPE_CON = 0,
-    COAP_TYPE_NONCON = 1,
-    COAP_TYPE_ACK = 2,
-    COAP_TYPE_RESET = 3
-} coap_msgtype_t;
-
-//http://tools.ietf.org/html/rfc7252#section-5.2
-//http://tools.ietf.org/html/rfc7252#section-12.1.2
-#define MAKE_RSPCODE(clas, det) ((clas << 5) | (det))
-
-typedef enum
-{
-    COAP_RSPCODE_CONTENT = MAKE_RSPCODE(2, 5),
-    COAP_RSPCODE_NOT_FOUND = MAKE_RSPCODE(4, 4),
-    COAP_RSPCODE_BAD_REQUEST = MAKE_RSPCODE(4, 0),
-    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4),
-    COAP_RSPCODE_CREATED = MAKE_RSPCODE(2, 1),
-    COAP_RSPCODE_DELETED = MAKE_RSPCODE(2, 2),
-    COAP_RSPCODE_VALID = MAKE_RSPCODE(2, 3),
-    COAP_RSPCODE_FORBIDDEN = MAKE_RSPCODE(4, 3),
-    COAP_RSPCODE_METHOD_NOT_ALLOWED = MAKE_RSPCODE(4, 5),
-    COAP_RSPCODE_NOT_ACCEPTABLE = MAKE_RSPCODE(4, 6),
-    COAP_RSPCODE_PRECONDITION_FAILED = MAKE_RSPCODE(4, 12),
-    COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE = MAKE_RSPCODE(4, 13),
-    COAP_RSPCODE_UNSUPPORTED_CONTENT_FORMAT = MAKE_RSPCODE(4, 15),
-    COAP_RSPCODE_INTERNAL_SERVER_ERROR = MAKE_RSPCODE(5, 0),
-    COAP_RSPCODE_NOT_IMPLEMENTED = MAKE_RSPCODE(5, 1),
-    COAP_RSPCODE_BAD_GATEWAY = MAKE_RSPCODE(5, 2),
-    COAP_RSPCODE_SERVICE_UNAVAILABLE = MAKE_RSPCODE(5, 3),
-    COAP_RSPCODE_GATEWAY_TIMEOUT = MAKE_RSPCODE(5, 4)
-} coap_responsecode_t;
-
-
-//http://tools.ietf.org/html/rfc7252#section-12.3
-typedef enum
-{
-    COAP_CONTENTTYPE_NONE = -1, // bodge to allow us not to send option block
-    COAP_CONTENTTYPE_TEXT_PLAIN = 0,
-    COAP_CONTENTTYPE_APPLICATION_LINKFORMAT = 40,
-    COAP_CONTENTTYPE_APPLICATION_XML = 41,
-    COAP_CONTENTTYPE_APPLICATION_OCTECT_STREAM = 42,
-    COAP_CONTENTTYPE_APPLICATION_EXI = 47,
-    COAP_CONTENTTYPE_APPLICATION_JSON = 50,
-} coap_content_type_t;
-
-///////////////////////
-
-typedef enum
-{
-    COAP_ERR_NONE = 0,
-    COAP_ERR_HEADER_TOO_SHORT = 1,
-    COAP_ERR_VERSION_NOT_1 = 2,
-    COAP_ERR_TOKEN_TOO_SHORT = 3,
-    COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER = 4,
-    COAP_ERR_OPTION_TOO_SHORT = 5,
-    COAP_ERR_OPTION_OVERRUNS_PACKET = 6,
-    COAP_ERR_OPTION_TOO_BIG = 7,
-    COAP_ERR_OPTION_LEN_INVALID = 8,
-    COAP_ERR_BUFFER_TOO_SMALL = 9,
-    COAP_ERR_UNSUPPORTED = 10,
-    COAP_ERR_OPTION_DELTA_INVALID = 11,
-    COAP_ERR_RESPONSE_CODE = 12,
-    COAP_ERR_METHOD_NOT_ALLOWED = 13,
-    COAP_ERR_NOT_FOUND = 14,
-    COAP_ERR_TIMEOUT = 15,
-    COAP_ERR_PAYLOAD_TOO_LARGE = 16,
-    COAP_ERR_MESSAGE_INCOMPLETE = 17,
-    COAP_ERR_DUPLICATE_MESSAGE = 18,
-    COAP_ERR_INTERNAL_SERVER = 19,
-    COAP_ERR_INVALID_URI = 20,
-} coap_error_t;
-
-///////////////////////
-
-typedef int (*coap_endpoint_func)(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
-#define MAX_SEGMENTS 2  // 2 = /foo/bar, 3 = /foo/bar/baz
-typedef struct
-{
-    int count;
-    const char *elems[MAX_SEGMENTS];
-} coap_endpoint_path_t;
-
-typedef struct
-{
-    coap_method_t method;               /* (i.e. POST, PUT or GET) */
-    coap_endpoint_func handler;         /* callback function which handles this 
-                                         * type of endpoint (and calls 
-                                         * coap_make_response() at some point) */
-    const coap_endpoint_path_t *path;   /* path towards a resource (i.e. foo/bar/) */ 
-    const char *core_attr;              /* the 'ct' attribute, as defined in RFC7252, section 7.2.1.:
-                                         * "The Content-Format code "ct" attribute 
-                                         * provides a hint about the 
-                                         * Content-Formats this resource returns." 
-                                         * (Section 12.3. lists possible ct values.) */
-} coap_endpoint_t;
-
-
-int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint8_t *uri_path, size_t uri_path_len, const uint8_t *payload, size_t payload_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_method_t method, coap_content_type_t content_type);
-int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt);
-void coapClient_init(uint8_t * tx_buf, uint8_t * rx_buf, uint8_t sock);
-void coapClient_run();
-
-#endif // __COAPCLIENT_H__
+#ifndef	__COAPCLIENT_H__
+#define	__COAPCLIENT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef COAP_CLIENT_MAX_TXN
+#define COAP_CLIENT_MAX_TXN     16  // outstanding requests over all servers
+#endif
+#ifndef COAP_CLIENT_TXN_SIZE
+#define COAP_CLIENT_TXN_SIZE    64  // tx buffer bytes of each transaction, the rest of the buffer is shared by larger requests
+#endif
+#ifndef COAP_CLIENT_MAX_PEERS
+#define COAP_CLIENT_MAX_PEERS   4   // servers whose in-flight requests and RTT estimate are tracked
+#endif
+#ifndef COAP_CLIENT_NSTART
+#define COAP_CLIENT_NSTART      4   // requests in flight per server, RFC 7252 section 4.7, more are queued
+#endif
+#ifndef COAP_CLIENT_RTO_MIN
+#define COAP_CLIENT_RTO_MIN     100     // default lower bound of the estimated RTO in ms
+#endif
+#ifndef COAP_CLIENT_RTO_MAX
+#define COAP_CLIENT_RTO_MAX     32000   // default upper bound of the estimated RTO in ms
+#endif
+#ifndef COAP_CLIENT_OBSERVE_MAX
+#define COAP_CLIENT_OBSERVE_MAX 2   // resources observed at the same time
+#endif
+#ifndef COAP_CLIENT_OBSERVE_REQ_SIZE
+#define COAP_CLIENT_OBSERVE_REQ_SIZE    128 // largest registration request, kept to renew it
+#endif
+#ifndef COAP_CLIENT_DOWNLOAD_MAX
+#define COAP_CLIENT_DOWNLOAD_MAX    1   // block-wise downloads at the same time
+#endif
+#ifndef COAP_CLIENT_CACHE_ENTRIES
+#define COAP_CLIENT_CACHE_ENTRIES   4   // cached GET responses, 0 leaves the cache out
+#endif
+#ifndef COAP_CLIENT_CACHE_SIZE
+#define COAP_CLIENT_CACHE_SIZE  1024    // arena shared by the entries, each gets an equal slot for request options and response
+#endif
+#ifndef COAP_CLIENT_DONE_ENTRIES
+#define COAP_CLIENT_DONE_ENTRIES    8   // separate responses remembered to ACK their retransmissions, the oldest is reused
+#endif
+#ifndef COAP_CLIENT_RX_BATCH
+#define COAP_CLIENT_RX_BATCH    8   // datagrams handled per coapClient_run() call
+#endif
+
+
+//http://tools.ietf.org/html/rfc7252#section-3
+typedef struct
+{
+    uint8_t ver;                /* CoAP version number */
+    uint8_t t;                  /* CoAP Message Type */
+    uint8_t tkl;                /* Token length: indicates length of the Token field */
+    uint8_t code;               /* CoAP status code. Can be request (0.xx), success reponse (2.xx), 
+                                 * client error response (4.xx), or rever error response (5.xx) 
+                                 * For possible values, see http://tools.ietf.org/html/rfc7252#section-12.1 */
+    uint8_t id[2];
+} coap_header_t;
+
+typedef struct
+{
+    const uint8_t *p;
+    size_t len;
+} coap_buffer_t;
+
+typedef struct
+{
+    uint8_t *p;
+    size_t len;
+} coap_rw_buffer_t;
+
+typedef struct
+{
+    uint16_t num;               /* Option number. See http://tools.ietf.org/html/rfc7252#section-5.10 */
+    coap_buffer_t buf;          /* Option value */
+} coap_option_t;
+
+//http://tools.ietf.org/html/rfc7959#section-2.2
+typedef struct
+{
+    uint32_t num;               /* Block number */
+    bool more;                  /* More blocks follow */
+    uint8_t szx;                /* Block size exponent, the block is 16 << szx bytes */
+} coap_block_t;
+
+// What coap_block_get() found
+typedef enum
+{
+    COAP_BLOCK_ABSENT = 0,      /* no such option */
+    COAP_BLOCK_VALID = 1,       /* the option is in blk */
+    COAP_BLOCK_INVALID = 2      /* too long or the reserved szx 7, answered with 4.00 (RFC 7959 section 2.2) */
+} coap_block_result_t;
+
+#define COAP_BLOCK_SIZE(szx)    (16U << (szx))
+#define COAP_BLOCK_OFFSET(blk)  ((size_t)(blk)->num << ((blk)->szx + 4))
+
+typedef struct
+{
+    coap_header_t hdr;          /* Header of the packet */
+    coap_buffer_t tok;          /* Token value, size as specified by hdr.tkl */
+    coap_buffer_t opts;         /* Options of the packet, still in wire format. They are decoded 
+                                 * on demand with a coap_option_iter_t. For possible entries see
+                                 * http://tools.ietf.org/html/rfc7252#section-5.10 */
+    coap_buffer_t payload;      /* Payload carried by the packet */
+} coap_packet_t;
+
+typedef struct
+{
+    const uint8_t *p;           /* Next option to decode */
+    const uint8_t *end;         /* End of the option region */
+    uint16_t delta;             /* Number of the last decoded option */
+} coap_option_iter_t;
+
+typedef struct
+{
+    uint8_t *p;                 /* Where the next option is written */
+    uint8_t *end;               /* End of the buffer */
+    uint16_t delta;             /* Number of the last written option, options must be added in order */
+} coap_option_writer_t;
+
+/////////////////////////////////////////
+
+void MilliTimer_Handler(void);
+
+/*
+ * @brief Timer structure
+ */
+typedef struct Timer Timer;
+struct Timer {
+	unsigned long systick_period;
+	uint64_t end_time;
+};
+
+// void TimerInit(Timer*);
+// char TimerIsExpired(Timer*);
+// void TimerCountdownMS(Timer*, unsigned int);
+// void TimerCountdown(Timer*, unsigned int);
+// int TimerLeftMS(Timer*);
+
+//http://tools.ietf.org/html/rfc7252#section-12.2
+typedef enum
+{
+    COAP_OPTION_IF_MATCH = 1,
+    COAP_OPTION_URI_HOST = 3,
+    COAP_OPTION_ETAG = 4,
+    COAP_OPTION_IF_NONE_MATCH = 5,
+    COAP_OPTION_OBSERVE = 6,
+    COAP_OPTION_URI_PORT = 7,
+    COAP_OPTION_LOCATION_PATH = 8,
+    COAP_OPTION_URI_PATH = 11,
+    COAP_OPTION_CONTENT_FORMAT = 12,
+    COAP_OPTION_MAX_AGE = 14,
+    COAP_OPTION_URI_QUERY = 15,
+    COAP_OPTION_ACCEPT = 17,
+    COAP_OPTION_LOCATION_QUERY = 20,
+    COAP_OPTION_PROXY_URI = 35,
+    COAP_OPTION_BLOCK2 = 23,
+    COAP_OPTION_BLOCK1 = 27,
+    COAP_OPTION_SIZE2 = 28,
+    COAP_OPTION_PROXY_SCHEME = 39,
+    COAP_OPTION_SIZE1 = 60
+} coap_option_num_t;
+
+//http://tools.ietf.org/html/rfc7252#section-12.1.1
+typedef enum
+{
+    COAP_METHOD_GET = 1,
+    COAP_METHOD_POST = 2,
+    COAP_METHOD_PUT = 3,
+    COAP_METHOD_DELETE = 4
+} coap_method_t;
+
+//http://tools.ietf.org/html/rfc7252#section-12.1.1
+typedef enum
+{
+    COAP_TYPE_CON = 0,
+    COAP_TYPE_NONCON = 1,
+    COAP_TYPE_ACK = 2,
+    COAP_TYPE_RESET = 3
+} coap_msgtype_t;
+
+//http://tools.ietf.org/html/rfc7252#section-5.2
+//http://tools.ietf.org/html/rfc7252#section-12.1.2
+#define MAKE_RSPCODE(clas, det) ((clas << 5) | (det))
+
+typedef enum
+{
+    COAP_RSPCODE_CONTENT = MAKE_RSPCODE(2, 5),
+    COAP_RSPCODE_NOT_FOUND = MAKE_RSPCODE(4, 4),
+    COAP_RSPCODE_BAD_REQUEST = MAKE_RSPCODE(4, 0),
+    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4),
+    COAP_RSPCODE_CREATED = MAKE_RSPCODE(2, 1),
+    COAP_RSPCODE_DELETED = MAKE_RSPCODE(2, 2),
+    COAP_RSPCODE_VALID = MAKE_RSPCODE(2, 3),
+    COAP_RSPCODE_FORBIDDEN = MAKE_RSPCODE(4, 3),
+    COAP_RSPCODE_METHOD_NOT_ALLOWED = MAKE_RSPCODE(4, 5),
+    COAP_RSPCODE_NOT_ACCEPTABLE = MAKE_RSPCODE(4, 6),
+    COAP_RSPCODE_PRECONDITION_FAILED = MAKE_RSPCODE(4, 12),
+    COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE = MAKE_RSPCODE(4, 13),
+    COAP_RSPCODE_UNSUPPORTED_CONTENT_FORMAT = MAKE_RSPCODE(4, 15),
+    COAP_RSPCODE_INTERNAL_SERVER_ERROR = MAKE_RSPCODE(5, 0),
+    COAP_RSPCODE_NOT_IMPLEMENTED = MAKE_RSPCODE(5, 1),
+    COAP_RSPCODE_BAD_GATEWAY = MAKE_RSPCODE(5, 2),
+    COAP_RSPCODE_SERVICE_UNAVAILABLE = MAKE_RSPCODE(5, 3),
+    COAP_RSPCODE_GATEWAY_TIMEOUT = MAKE_RSPCODE(5, 4)
+} coap_responsecode_t;
+
+
+//http://tools.ietf.org/html/rfc7252#section-12.3
+typedef enum
+{
+    COAP_CONTENTTYPE_NONE = -1, // bodge to allow us not to send option block
+    COAP_CONTENTTYPE_TEXT_PLAIN = 0,
+    COAP_CONTENTTYPE_APPLICATION_LINKFORMAT = 40,
+    COAP_CONTENTTYPE_APPLICATION_XML = 41,
+    COAP_CONTENTTYPE_APPLICATION_OCTECT_STREAM = 42,
+    COAP_CONTENTTYPE_APPLICATION_EXI = 47,
+    COAP_CONTENTTYPE_APPLICATION_JSON = 50,
+} coap_content_type_t;
+
+///////////////////////
+
+typedef enum
+{
+    COAP_ERR_NONE = 0,
+    COAP_ERR_HEADER_TOO_SHORT = 1,
+    COAP_ERR_VERSION_NOT_1 = 2,
+    COAP_ERR_TOKEN_TOO_SHORT = 3,
+    COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER = 4,
+    COAP_ERR_OPTION_TOO_SHORT = 5,
+    COAP_ERR_OPTION_OVERRUNS_PACKET = 6,
+    COAP_ERR_OPTION_TOO_BIG = 7,
+    COAP_ERR_OPTION_LEN_INVALID = 8,
+    COAP_ERR_BUFFER_TOO_SMALL = 9,
+    COAP_ERR_UNSUPPORTED = 10,
+    COAP_ERR_OPTION_DELTA_INVALID = 11,
+    COAP_ERR_RESPONSE_CODE = 12,
+    COAP_ERR_METHOD_NOT_ALLOWED = 13,
+    COAP_ERR_NOT_FOUND = 14,
+    COAP_ERR_TIMEOUT = 15,
+    COAP_ERR_PAYLOAD_TOO_LARGE = 16,
+    COAP_ERR_MESSAGE_INCOMPLETE = 17,
+    COAP_ERR_DUPLICATE_MESSAGE = 18,
+    COAP_ERR_INTERNAL_SERVER = 19,
+    COAP_ERR_INVALID_URI = 20,
+    COAP_ERR_RESET = 21,
+    COAP_ERR_NO_TRANSACTION = 22,
+    COAP_ERR_ETAG_MISMATCH = 23,
+} coap_error_t;
+
+///////////////////////
+
+typedef int (*coap_endpoint_func)(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
+#define MAX_SEGMENTS 2  // 2 = /foo/bar, 3 = /foo/bar/baz
+typedef struct
+{
+    int count;
+    const char *elems[MAX_SEGMENTS];
+} coap_endpoint_path_t;
+
+typedef struct
+{
+    coap_method_t method;               /* (i.e. POST, PUT or GET) */
+    coap_endpoint_func handler;         /* callback function which handles this 
+                                         * type of endpoint (and calls 
+                                         * coap_make_response() at some point) */
+    const coap_endpoint_path_t *path;   /* path towards a resource (i.e. foo/bar/) */ 
+    const char *core_attr;              /* the 'ct' attribute, as defined in RFC7252, section 7.2.1.:
+                                         * "The Content-Format code "ct" attribute 
+                                         * provides a hint about the 
+                                         * Content-Formats this resource returns." 
+                                         * (Section 12.3. lists possible ct values.) */
+} coap_endpoint_t;
+
+#define COAP_PREPARED_TKL       4   // token length of a prepared request
+#define COAP_PREPARED_HDR_LEN   (4 + COAP_PREPARED_TKL)
+
+/* Request encoded once by coap_prepare_request(). Only the message ID and
+ * the token are rewritten each time it is submitted */
+typedef struct
+{
+    const uint8_t *buf;         /* Wire image */
+    size_t len;                 /* Length of the wire image */
+} coap_prepared_t;
+
+typedef struct
+{
+    uint32_t hits;              /* GETs answered from a fresh entry without going to the wire */
+    uint32_t misses;            /* GETs not found in the cache */
+    uint32_t stale;             /* GETs found after Max-Age, revalidated if the entry has an ETag */
+    uint32_t revalidated;       /* revalidations answered with 2.03 Valid */
+    uint32_t stores;            /* 2.05 responses stored */
+    uint32_t evictions;         /* entries reused for another resource, least recently used first */
+} coap_client_cache_stats_t;
+
+/* Receives bytes [offset, offset + len) of a block-wise download, straight from the rx buffer.
+ * With more than one block in flight blocks may come out of order. A non zero return aborts the download */
+typedef int (*coap_sink_func)(size_t offset, const uint8_t *buf, size_t len, void *arg);
+
+/* End of a block-wise download, rc is 0 once total bytes went to the sink */
+typedef void (*coap_download_func)(int rc, size_t total, void *arg);
+
+/* Completion of a submitted request. rc is 0 with the response in rsp, or COAP_ERR_TIMEOUT or
+ * COAP_ERR_RESET with rsp NULL. rsp points into the rx buffer and is only valid during the call */
+typedef void (*coap_response_func)(int rc, const coap_packet_t *rsp, void *arg);
+
+
+int coap_make_request(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint8_t *uri_path, size_t uri_path_len, const uint8_t *payload, size_t payload_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_method_t method, coap_content_type_t content_type);
+int coap_prepare_request(coap_prepared_t *req, uint8_t *buf, size_t buflen, coap_msgtype_t type, coap_method_t method, const uint8_t *uri_path, size_t uri_path_len, const uint8_t *payload, size_t payload_len, coap_content_type_t content_type);
+int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen);
+int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt);
+void coap_option_iter_init(coap_option_iter_t *it, const coap_packet_t *pkt);
+bool coap_option_next(coap_option_iter_t *it, coap_option_t *option);
+uint8_t coap_findOptions(const coap_packet_t *pkt, uint16_t num, coap_option_iter_t *it);
+coap_block_result_t coap_block_get(const coap_packet_t *pkt, uint16_t num, coap_block_t *blk);
+void coap_option_writer_init(coap_option_writer_t *w, uint8_t *buf, size_t buflen);
+int coap_option_add(coap_option_writer_t *w, uint16_t num, const uint8_t *val, size_t len);
+int coap_handle_response(const coap_packet_t *pkt);
+// seed comes from an entropy source, e.g. get_rand_32() of pico_rand, and picks the first message ID and
+// token, so that they do not repeat after a reboot (RFC 7252 sections 4.4 and 5.3.1)
+// Each of the COAP_CLIENT_MAX_TXN transactions gets COAP_CLIENT_TXN_SIZE bytes of tx_buf for its request. The
+// rest of tx_buf holds one larger request at a time, a second one is refused with COAP_ERR_NO_TRANSACTION until
+// it completes. Returns COAP_ERR_BUFFER_TOO_SMALL if tx_len leaves the transactions short.
+int coapClient_init(uint8_t * tx_buf, size_t tx_len, uint8_t * rx_buf, size_t rx_len, uint8_t sock, uint32_t seed);
+void coapClient_setDestination(const uint8_t * ip, uint16_t port);
+// Microsecond clock of the client, e.g. time_us_64 of the Pico SDK. Retransmissions, RTO aging, Max-Age and
+// the Timer functions then read it instead of counting MilliTimer_Handler() calls, so no 1 ms interrupt is needed.
+void coapClient_setClock(uint64_t (*clock)(void));
+// Milliseconds until coapClient_run() has a retransmission or expiry to handle, -1 if none, so a caller
+// that sleeps can arm a one-shot alarm instead of waking every millisecond
+int32_t coapClient_nextTimeoutMs(void);
+// Queues req for ip:port (the destination set by coapClient_setDestination() if ip is NULL) and
+// returns at once. The message ID is assigned here, and a token too if req has none. CON requests
+// are retransmitted until answered, cb is called from coapClient_run() when the request completes
+int coapClient_submit(const uint8_t *ip, uint16_t port, const coap_packet_t *req, coap_response_func cb, void *arg);
+// Bounds of the RTO estimated for ip:port. The server keeps its entry, and its
+// RTT estimate, for good, so at most COAP_CLIENT_MAX_PEERS - 1 should be set
+int coapClient_setRtoBounds(const uint8_t *ip, uint16_t port, uint32_t min_ms, uint32_t max_ms);
+// Current RTO of ip:port in ms, ACK_TIMEOUT for a server not seen yet
+uint32_t coapClient_getRto(const uint8_t *ip, uint16_t port);
+// Like coapClient_submit() for a prepared request, it is copied and gets a fresh message ID and token
+int coapClient_submitPrepared(const uint8_t *ip, uint16_t port, const coap_prepared_t *req, coap_response_func cb, void *arg);
+// Turns the response cache on or off, it is off after coapClient_init(). While on, a GET whose 2.05 response
+// is still fresh (Max-Age) completes with the stored response, and a stale one is revalidated with its ETag.
+void coapClient_setCache(bool enable);
+const coap_client_cache_stats_t *coapClient_getCacheStats(void);
+// Observes the resource of the GET request req (RFC 7641). cb gets the registration response and then every
+// notification, in order, from coapClient_run(). The registration is renewed before Max-Age runs out. A response
+// without Observe, an error response, a timeout or a reset ends the observation, cb gets that one last
+int coapClient_observe(const uint8_t *ip, uint16_t port, const coap_prepared_t *req, coap_response_func cb, void *arg, uint8_t *handle);
+void coapClient_cancelObserve(uint8_t handle);
+// Fetches the resource of the GET request req block by block (RFC 7959 Block2), 16 << szx bytes per block
+// unless the server asks for less. Once the size is known up to window blocks are requested at once.
+// Each block goes to sink, done is called at the end. req must stay valid until then.
+// Returns at once, the transfer runs in coapClient_run()
+int coapClient_download(const uint8_t *ip, uint16_t port, const coap_prepared_t *req, uint8_t szx, uint8_t window, coap_sink_func sink, coap_download_func done, void *arg);
+// Number of submitted requests not completed yet
+int coapClient_pending(void);
+void coapClient_run();
+
+#endif // __COAPCLIENT_H__
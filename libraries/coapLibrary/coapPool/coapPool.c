@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "coapPool.h"
+
+static coap_pool_t *coap_pools = NULL;
+
+// Freed objects first, so the ones never used stay untouched as long as possible
+void *coap_pool_alloc(coap_pool_t *p)
+{
+    uint16_t i;
+
+    if (p->top > 0)
+        i = p->stack[--p->top];
+    else if (p->fresh < p->count)
+        i = p->fresh++;
+    else
+    {
+        p->failed++;
+        return NULL;
+    }
+
+    p->allocs++;
+    if (++p->used > p->peak)
+        p->peak = p->used;
+    return p->objs + (size_t)i * p->size;
+}
+
+void coap_pool_free(coap_pool_t *p, void *obj)
+{
+    if (NULL == obj)
+        return;
+    p->stack[p->top++] = coap_pool_index(p, obj);
+    p->used--;
+}
+
+uint16_t coap_pool_index(const coap_pool_t *p, const void *obj)
+{
+    return (uint16_t)(((const uint8_t *)obj - p->objs) / p->size);
+}
+
+void coap_pool_register(coap_pool_t *p)
+{
+    coap_pool_t *q;
+
+    for (q = coap_pools; NULL != q; q = q->next)
+        if (q == p)
+            return;
+    p->next = coap_pools;
+    coap_pools = p;
+}
+
+const coap_pool_t *coap_pool_first(void)
+{
+    return coap_pools;
+}
@@ -0,0 +1,59 @@
+#ifndef	__COAPPOOL_H__
+#define	__COAPPOOL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct coap_pool coap_pool_t;
+
+/* Fixed-size objects over a static array, sized at compile time. Freed objects are
+ * kept on a stack of indexes beside the array, so their memory is left as it was and
+ * the owner can still tell a free object from a live one by its own fields */
+struct coap_pool
+{
+    const char *name;           /* Shown in the statistics */
+    uint8_t *objs;              /* count objects of size bytes */
+    uint16_t *stack;            /* Indexes of freed objects, count entries */
+    uint16_t size;
+    uint16_t count;
+    uint16_t fresh;             /* Objects handed out at least once, the others follow them */
+    uint16_t top;               /* Entries in stack */
+    uint16_t used;              /* Objects allocated now */
+    uint16_t peak;              /* Most objects allocated at once */
+    uint32_t allocs;
+    uint32_t failed;            /* Allocations refused because all count objects were in use */
+    coap_pool_t *next;          /* Next registered pool */
+};
+
+/* Pool over the array objs of count objects, with stack an array of count uint16_t */
+#define COAP_POOL_INIT(name, objs, stack, count) \
+    {(name), (uint8_t *)(objs), (stack), sizeof((objs)[0]), (count), 0, 0, 0, 0, 0, 0, NULL}
+
+/* Defines a pool of n objects of type, when the owner does not need the array itself */
+#define COAP_POOL_DEFINE(pool, type, n) \
+    static type pool##_objs[n]; \
+    static uint16_t pool##_stack[n]; \
+    static coap_pool_t pool = COAP_POOL_INIT(#pool, pool##_objs, pool##_stack, n)
+
+// O(1), NULL once all objects are in use. The object is not cleared.
+void *coap_pool_alloc(coap_pool_t *p);
+// O(1), obj must have come from p and not be freed yet. NULL is ignored.
+void coap_pool_free(coap_pool_t *p, void *obj);
+// Index of obj in the array of p, stable for as long as obj is allocated
+uint16_t coap_pool_index(const coap_pool_t *p, const void *obj);
+
+// Adds p to the pools listed by coap_pool_first(), once
+void coap_pool_register(coap_pool_t *p);
+// Registered pools, follow next for the others
+const coap_pool_t *coap_pool_first(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __COAPPOOL_H__
@@ -1,536 +1,2069 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include <string.h>
-#include <stddef.h>
-#include "coapServer.h"
-
-#include "socket.h"
-#include "wizchip_conf.h"
-
-#define DATA_BUF_SIZE		2048
-
-//#define DEBUG
-
-uint8_t * pCOAP_TX;
-uint8_t * pCOAP_RX;
-
-static uint8_t COAPSock_Num = 0;
-
-static void coapServer_Sockinit(uint8_t sock);
-
-void coapServer_init(uint8_t * tx_buf, uint8_t * rx_buf, uint8_t sock);
-void coapServer_run();
-extern void endpoint_setup(void);
-extern const coap_endpoint_t endpoints[];
-
-#ifdef DEBUG
-void coap_dumpHeader(coap_header_t *hdr)
-{
-    printf("Header:\n");
-    printf("  ver  0x%02X\n", hdr->ver);
-    printf("  t    0x%02X\n", hdr->t);
-    printf("  tkl  0x%02X\n", hdr->tkl);
-    printf("  code 0x%02X\n", hdr->code);
-    printf("  id   0x%02X%02X\n", hdr->id[0], hdr->id[1]);
-}
-#endif
-
-#ifdef DEBUG
-void coap_dump(const uint8_t *buf, size_t buflen, bool bare)
-{
-    if (bare)
-    {
-        while(buflen--)
-            printf("%02X%s", *buf++, (buflen > 0) ? " " : "");
-    }
-    else
-    {
-        printf("Dump: ");
-        while(buflen--)
-            printf("%02X%s", *buf++, (buflen > 0) ? " " : "");
-        printf("\n");
-    }
-}
-#endif
-
-int coap_parseHeader(coap_header_t *hdr, const uint8_t *buf, size_t buflen)
-{
-    if (buflen < 4)
-        return COAP_ERR_HEADER_TOO_SHORT;
-    hdr->ver = (buf[0] & 0xC0) >> 6;
-    if (hdr->ver != 1)
-        return COAP_ERR_VERSION_NOT_1;
-    hdr->t = (buf[0] & 0x30) >> 4;
-    hdr->tkl = buf[0] & 0x0F;
-    hdr->code = buf[1];
-    hdr->id[0] = buf[2];
-    hdr->id[1] = buf[3];
-    return 0;
-}
-
-int coap_parseToken(coap_buffer_t *tokbuf, const coap_header_t *hdr, const uint8_t *buf, size_t buflen)
-{
-    if (hdr->tkl == 0)
-    {
-        tokbuf->p = NULL;
-        tokbuf->len = 0;
-        return 0;
-    }
-    else
-    if (hdr->tkl <= 8)
-    {
-        if (4U + hdr->tkl > buflen)
-            return COAP_ERR_TOKEN_TOO_SHORT;   // tok bigger than packet
-        tokbuf->p = buf+4;  // past header
-        tokbuf->len = hdr->tkl;
-        return 0;
-    }
-    else
-    {
-        // invalid size
-        return COAP_ERR_TOKEN_TOO_SHORT;
-    }
-}
-
-// advances p
-int coap_parseOption(coap_option_t *option, uint16_t *running_delta, const uint8_t **buf, size_t buflen)
-{
-    const uint8_t *p = *buf;
-    uint8_t headlen = 1;
-    uint16_t len, delta;
-
-    if (buflen < headlen) // too small
-        return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-
-    delta = (p[0] & 0xF0) >> 4;
-    len = p[0] & 0x0F;
-
-    // These are untested and may be buggy
-    if (delta == 13)
-    {
-        headlen++;
-        if (buflen < headlen)
-            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-        delta = p[1] + 13;
-        p++;
-    }
-    else
-    if (delta == 14)
-    {
-        headlen += 2;
-        if (buflen < headlen)
-            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-        delta = ((p[1] << 8) | p[2]) + 269;
-        p+=2;
-    }
-    else
-    if (delta == 15)
-        return COAP_ERR_OPTION_DELTA_INVALID;
-
-    if (len == 13)
-    {
-        headlen++;
-        if (buflen < headlen)
-            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-        len = p[1] + 13;
-        p++;
-    }
-    else
-    if (len == 14)
-    {
-        headlen += 2;
-        if (buflen < headlen)
-            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-        len = ((p[1] << 8) | p[2]) + 269;
-        p+=2;
-    }
-    else
-    if (len == 15)
-        return COAP_ERR_OPTION_LEN_INVALID;
-
-    if ((p + 1 + len) > (*buf + buflen))
-        return COAP_ERR_OPTION_TOO_BIG;
-
-    //printf("option num=%d\n", delta + *running_delta);
-    option->num = delta + *running_delta;
-    option->buf.p = p+1;
-    option->buf.len = len;
-    //coap_dump(p+1, len, false);
-
-    // advance buf
-    *buf = p + 1 + len;
-    *running_delta += delta;
-
-    return 0;
-}
-
-// http://tools.ietf.org/html/rfc7252#section-3.1
-int coap_parseOptionsAndPayload(coap_option_t *options, uint8_t *numOptions, coap_buffer_t *payload, const coap_header_t *hdr, const uint8_t *buf, size_t buflen)
-{
-    size_t optionIndex = 0;
-    uint16_t delta = 0;
-    const uint8_t *p = buf + 4 + hdr->tkl;
-    const uint8_t *end = buf + buflen;
-    int rc;
-    if (p > end)
-        return COAP_ERR_OPTION_OVERRUNS_PACKET;   // out of bounds
-
-    //coap_dump(p, end - p);
-
-    // 0xFF is payload marker
-    while((optionIndex < *numOptions) && (p < end) && (*p != 0xFF))
-    {
-        if (0 != (rc = coap_parseOption(&options[optionIndex], &delta, &p, end-p)))
-            return rc;
-        optionIndex++;
-    }
-    *numOptions = optionIndex;
-
-    if (p+1 < end && *p == 0xFF)  // payload marker
-    {
-        payload->p = p+1;
-        payload->len = end-(p+1);
-    }
-    else
-    {
-        payload->p = NULL;
-        payload->len = 0;
-    }
-
-    return 0;
-}
-
-#ifdef DEBUG
-void coap_dumpOptions(coap_option_t *opts, size_t numopt)
-{
-    size_t i;
-    printf(" Options:\n");
-    for (i=0;i<numopt;i++)
-    {
-        printf("  0x%02X [ ", opts[i].num);
-        coap_dump(opts[i].buf.p, opts[i].buf.len, true);
-        printf(" ]\n");
-    }
-}
-#endif
-
-#ifdef DEBUG
-void coap_dumpPacket(coap_packet_t *pkt)
-{
-    coap_dumpHeader(&pkt->hdr);
-    coap_dumpOptions(pkt->opts, pkt->numopts);
-    printf("Payload: ");
-    coap_dump(pkt->payload.p, pkt->payload.len, true);
-    printf("\n");
-}
-#endif
-
-int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen)
-{
-    int rc;
-
-    // coap_dump(buf, buflen, false);
-
-    if (0 != (rc = coap_parseHeader(&pkt->hdr, buf, buflen)))
-        return rc;
-//    coap_dumpHeader(&hdr);
-    if (0 != (rc = coap_parseToken(&pkt->tok, &pkt->hdr, buf, buflen)))
-        return rc;
-    pkt->numopts = MAXOPT;
-    if (0 != (rc = coap_parseOptionsAndPayload(pkt->opts, &(pkt->numopts), &(pkt->payload), &pkt->hdr, buf, buflen)))
-        return rc;
-//    coap_dumpOptions(opts, numopt);
-    return 0;
-}
-
-// options are always stored consecutively, so can return a block with same option num
-const coap_option_t *coap_findOptions(const coap_packet_t *pkt, uint8_t num, uint8_t *count)
-{
-    // FIXME, options is always sorted, can find faster than this
-    size_t i;
-    const coap_option_t *first = NULL;
-    *count = 0;
-    for (i=0;i<pkt->numopts;i++)
-    {
-        if (pkt->opts[i].num == num)
-        {
-            if (NULL == first)
-                first = &pkt->opts[i];
-            (*count)++;
-        }
-        else
-        {
-            if (NULL != first)
-                break;
-        }
-    }
-    return first;
-}
-
-int coap_buffer_to_string(char *strbuf, size_t strbuflen, const coap_buffer_t *buf)
-{
-    if (buf->len+1 > strbuflen)
-        return COAP_ERR_BUFFER_TOO_SMALL;
-    memcpy(strbuf, buf->p, buf->len);
-    strbuf[buf->len] = 0;
-    return 0;
-}
-
-void coap_option_nibble(uint32_t value, uint8_t *nibble)
-{
-    if (value<13)
-    {
-        *nibble = (0xFF & value);
-    }
-    else
-    if (value<=0xFF+13)
-    {
-        *nibble = 13;
-    } else if (value<=0xFFFF+269)
-    {
-        *nibble = 14;
-    }
-}
-
-int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt)
-{
-    size_t opts_len = 0;
-    size_t i;
-    uint8_t *p;
-    uint16_t running_delta = 0;
-
-    // build header
-    if (*buflen < (4U + pkt->hdr.tkl))
-        return COAP_ERR_BUFFER_TOO_SMALL;
-
-    buf[0] = (pkt->hdr.ver & 0x03) << 6;
-    buf[0] |= (pkt->hdr.t & 0x03) << 4;
-    buf[0] |= (pkt->hdr.tkl & 0x0F);
-    buf[1] = pkt->hdr.code;
-    buf[2] = pkt->hdr.id[0];
-    buf[3] = pkt->hdr.id[1];
-
-    // inject token
-    p = buf + 4;
-    if ((pkt->hdr.tkl > 0) && (pkt->hdr.tkl != pkt->tok.len))
-        return COAP_ERR_UNSUPPORTED;
-    
-    if (pkt->hdr.tkl > 0)
-        memcpy(p, pkt->tok.p, pkt->hdr.tkl);
-
-    // // http://tools.ietf.org/html/rfc7252#section-3.1
-    // inject options
-    p += pkt->hdr.tkl;
-
-    for (i=0;i<pkt->numopts;i++)
-    {
-        uint32_t optDelta;
-        uint8_t len, delta = 0;
-
-        if (((size_t)(p-buf)) > *buflen)
-             return COAP_ERR_BUFFER_TOO_SMALL;
-        optDelta = pkt->opts[i].num - running_delta;
-        coap_option_nibble(optDelta, &delta);
-        coap_option_nibble((uint32_t)pkt->opts[i].buf.len, &len);
-
-        *p++ = (0xFF & (delta << 4 | len));
-        if (delta == 13)
-        {
-            *p++ = (optDelta - 13);
-        }
-        else
-        if (delta == 14)
-        {
-            *p++ = ((optDelta-269) >> 8);
-            *p++ = (0xFF & (optDelta-269));
-        }
-        if (len == 13)
-        {
-            *p++ = (pkt->opts[i].buf.len - 13);
-        }
-        else
-        if (len == 14)
-  	    {
-            *p++ = (pkt->opts[i].buf.len >> 8);
-            *p++ = (0xFF & (pkt->opts[i].buf.len-269));
-        }
-
-        memcpy(p, pkt->opts[i].buf.p, pkt->opts[i].buf.len);
-        p += pkt->opts[i].buf.len;
-        running_delta = pkt->opts[i].num;
-    }
-
-    opts_len = (p - buf) - 4;   // number of bytes used by options
-
-    if (pkt->payload.len > 0)
-    {
-        if (*buflen < 4 + 1 + pkt->payload.len + opts_len)
-        {
-           // printf("len : %lu %lu %lu\n", *buflen, pkt->payload.len, opts_len);
-            return COAP_ERR_BUFFER_TOO_SMALL;
-        }
-        buf[4 + opts_len] = 0xFF;  // payload marker
-        memcpy(buf+5 + opts_len, pkt->payload.p, pkt->payload.len);
-        *buflen = opts_len + 5 + pkt->payload.len;
-    }
-    else
-        *buflen = opts_len + 4;
-    return 0;
-}
-
-int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint8_t *content, size_t content_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type)
-{
-    pkt->hdr.ver = 0x01;
-    pkt->hdr.t = COAP_TYPE_ACK;
-    pkt->hdr.tkl = 0;
-    pkt->hdr.code = rspcode;
-    pkt->hdr.id[0] = msgid_hi;
-    pkt->hdr.id[1] = msgid_lo;
-    pkt->numopts = 1;
-
-    // need token in response
-    if (tok) {
-        pkt->hdr.tkl = tok->len;
-        pkt->tok = *tok;
-    }
-
-    // safe because 1 < MAXOPT
-    pkt->opts[0].num = COAP_OPTION_CONTENT_FORMAT;
-    pkt->opts[0].buf.p = scratch->p;
-    if (scratch->len < 2)
-        return COAP_ERR_BUFFER_TOO_SMALL;
-    scratch->p[0] = ((uint16_t)content_type & 0xFF00) >> 8;
-    scratch->p[1] = ((uint16_t)content_type & 0x00FF);
-    pkt->opts[0].buf.len = 2;
-    pkt->payload.p = content;
-    pkt->payload.len = content_len;
-    return 0;
-}
-
-// FIXME, if this looked in the table at the path before the method then
-// it could more easily return 405 errors
-int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt)
-{
-    const coap_option_t *opt;
-    uint8_t count;
-    int i;
-    const coap_endpoint_t *ep = endpoints;
-
-    while(NULL != ep->handler)
-    {
-        if (ep->method != inpkt->hdr.code)
-            goto next;
-        if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
-        {
-            if (count != ep->path->count)
-                goto next;
-            for (i=0;i<count;i++)
-            {
-                if (opt[i].buf.len != strlen(ep->path->elems[i]))
-                    goto next;
-                if (0 != memcmp(ep->path->elems[i], opt[i].buf.p, opt[i].buf.len))
-                    goto next;
-            }
-            // match!
-            return ep->handler(scratch, inpkt, outpkt, inpkt->hdr.id[0], inpkt->hdr.id[1]);
-        }
-next:
-        ep++;
-    }
-
-    coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
-
-    return 0;
-}
-
-void coap_setup(void)
-{
-}
-
-static void coapServer_Sockinit(uint8_t sock)
-{
-	uint8_t i;
-
-    COAPSock_Num = sock;
-}
-
-void coapServer_init(uint8_t * tx_buf, uint8_t * rx_buf, uint8_t sock)
-{
-	// User's shared buffer
-	pCOAP_TX = tx_buf;
-	pCOAP_RX = rx_buf;
-
-	// H/W Socket number mapping
-	coapServer_Sockinit(sock);
-}
-
-void coapServer_run()
-{
-    int32_t ret, n;
-    coap_packet_t pkt;
-    uint16_t size = 0, sentsize=0;
-    uint8_t scratch_raw[DATA_BUF_SIZE];
-    coap_rw_buffer_t scratch_buf = {scratch_raw, sizeof(scratch_raw)};
-    uint8_t  destip[4];
-    uint16_t destport;
-#ifdef DEBUG
-    uint8_t buf[DATA_BUF_SIZE];
-#endif
-
-   switch(getSn_SR(COAPSock_Num))
-   {
-      case SOCK_UDP :
-         if((size = getSn_RX_RSR(COAPSock_Num)) > 0)
-         {
-            if(size > DATA_BUF_SIZE) 
-                size = DATA_BUF_SIZE;
-            ret = recvfrom(COAPSock_Num, pCOAP_RX, size, destip, (uint16_t*)&destport);
-
-#ifdef DEBUG
-
-            printf("Receive: ");
-            coap_dump(buf, ret, true);
-            printf("\n");
-#endif
-
-            if (0 != (ret = coap_parse(&pkt, pCOAP_RX, ret)))
-                printf("Bad packet rc=%d\n", ret);
-            else
-            {
-                size_t rsplen = DATA_BUF_SIZE * sizeof(uint8_t);
-                coap_packet_t rsppkt;
-#ifdef DEBUG
-                coap_dumpPacket(&pkt);
-#endif
-                coap_handle_req(&scratch_buf, &pkt, &rsppkt);
-
-                if (0 != (ret = coap_build(pCOAP_TX, &rsplen, &rsppkt)))
-                    printf("coap_build failed rc=%d\n", ret);
-                else
-                {
-#ifdef DEBUG
-                    printf("Sending: ");
-                    coap_dump(buf, rsplen, true);
-                    printf("\n");
-#endif
-#ifdef DEBUG
-                    coap_dumpPacket(&rsppkt);
-#endif
-                    ret = sendto(COAPSock_Num, pCOAP_TX, rsplen, destip, destport);
-                }
-            }
-         }
-         break;
-      case SOCK_CLOSED:
-         if(socket(COAPSock_Num, Sn_MR_UDP, COAP_SERVER_PORT, 0x00) == COAPSock_Num)
-        {
-            printf("%d:Opened, UDP loopback, port [%d]\r\n", COAPSock_Num, COAP_SERVER_PORT);
-        }
-         break;
-      default :
-         break;
-   }
-}
-
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include "coapServer.h"
+#include "coapTimer.h"
+#include "coapPool.h"
+#include "coapTrace.h"
+
+#include "socket.h"
+#include "wizchip_conf.h"
+
+#define DATA_BUF_SIZE		2048
+#define COAP_SERVER_SR_RECHECK  256     // idle coapServer_run() calls between Sn_SR reads
+#define COAP_SERVER_SR_RECHECK_MS   1000    // event mode, alarm period between Sn_SR reads
+#define COAP_SERVER_REOPEN_MS   100     // event mode, alarm period between socket open attempts
+
+//#define DEBUG
+
+uint8_t * pCOAP_TX;  // no longer used by coapServer_run(), responses go straight to the socket TX memory
+uint8_t * pCOAP_RX;
+
+static uint8_t COAPSock_Num = 0;
+static bool COAPSock_Open = false;  // cached Sn_SR == SOCK_UDP, cleared when the socket stops answering
+static uint16_t COAPSock_Idle = 0;  // idle runs since Sn_SR was last read
+
+// Batch budget of coapServer_run()
+static coap_clock_func coap_clock = NULL;
+static uint16_t coap_batch_max = COAP_SERVER_BATCH_MAX;
+static uint32_t coap_batch_us = COAP_SERVER_BATCH_US;
+static coap_server_stats_t coap_stats;
+static coap_endpoint_stats_t coap_ep_stats[COAP_STATS_ENDPOINTS];
+static uint8_t coap_endpoint_count = 0;    // entries of endpoints[]
+static uint8_t coap_req_ep;                 // endpoint the request being served was routed to
+
+// Scratch of the request being served, static so a request does not take it from the stack
+static uint8_t coap_arena_buf[COAP_ARENA_SIZE];
+static coap_arena_t coap_arena = COAP_ARENA_INIT(coap_arena_buf, sizeof(coap_arena_buf));
+
+// Observers, keyed by peer and token. A request is served for one peer at a time,
+// coapServer_serve() sets coap_peer_ip/port before routing it.
+// Every COAP_OBSERVE_NON_MAX notifications, or once COAP_OBSERVE_CON_MS passed, one is sent CON.
+// An observer not acknowledging it within EXCHANGE_LIFETIME is dropped, and when the table is
+// full the one heard from least recently makes room for a new registration.
+typedef struct
+{
+    const coap_endpoint_t *ep;          /* observed GET endpoint, NULL if the slot is free */
+    uint32_t stamp;                     /* order of registering or acknowledging, the lowest is the oldest */
+    uint8_t ip[4];
+    uint16_t port;
+    uint8_t tkl;
+    uint8_t tok[8];
+    uint8_t mid[2];                     /* message ID of the last notification, matched against ACK and RST */
+    uint8_t nons;                       /* NON notifications since the last CON one */
+    bool con;                           /* a CON notification waits for its ACK */
+    uint32_t con_ms;                    /* coap_wheel_ms of the last acknowledged CON notification or registration */
+    coap_timer_t timer;                 /* drops the observer if the CON notification is not acknowledged */
+} coap_observer_t;
+
+static coap_observer_t coap_observers[COAP_OBSERVE_MAX];
+static uint16_t coap_observer_stack[COAP_OBSERVE_MAX];
+static coap_pool_t coap_observer_pool = COAP_POOL_INIT("coap_observer_pool", coap_observers, coap_observer_stack, COAP_OBSERVE_MAX);
+static uint32_t coap_observe_seq = 0;
+static uint32_t coap_observe_stamp = 0;
+static uint16_t coap_mid = 0;
+static uint8_t coap_peer_ip[4];
+static uint16_t coap_peer_port = 0;
+
+// Replay cache of answered CON requests, keyed by peer and message ID (RFC 7252 section 4.5).
+// Entries are freed by their timer after EXCHANGE_LIFETIME, or the oldest one is reused when none is free.
+// A response larger than an entry is kept in coap_dedup_large until a newer large one takes its place.
+typedef struct
+{
+    bool used;
+    uint32_t stamp;                     /* order of storing, the lowest is the oldest */
+    uint8_t ip[4];
+    uint16_t port;
+    uint8_t mid[2];
+    coap_timer_t timer;                 /* frees the entry after EXCHANGE_LIFETIME */
+    uint16_t len;                       /* response length, 0 if it is not kept */
+    uint8_t rsp[COAP_DEDUP_RSP_SIZE];
+} coap_dedup_t;
+
+static coap_dedup_t coap_dedup[COAP_DEDUP_ENTRIES];
+static uint16_t coap_dedup_stack[COAP_DEDUP_ENTRIES];
+static coap_pool_t coap_dedup_pool = COAP_POOL_INIT("coap_dedup_pool", coap_dedup, coap_dedup_stack, COAP_DEDUP_ENTRIES);
+static uint32_t coap_dedup_stamp = 0;
+static uint8_t coap_dedup_large[COAP_DEDUP_LARGE_SIZE];
+static coap_dedup_t *coap_dedup_large_owner;    // entry whose response is in coap_dedup_large, NULL if none
+
+// Expiry of the replay cache and of unacknowledged notifications, runs on the milliseconds of coap_clock()
+static coap_timer_wheel_t coap_wheel;
+static uint32_t coap_wheel_us;          // coap_clock() accounted for in coap_wheel_ms
+static uint32_t coap_wheel_ms;
+
+// Event mode, set from the INTn interrupt
+static volatile bool coap_irq_pending = false;
+static volatile bool coap_irq_stamped = false;
+static volatile uint32_t coap_irq_stamp;
+static volatile bool coap_alarm_pending = false;
+
+// Brings the timer wheel up to coap_clock() and returns the time read, 0 without a clock.
+// Without a clock the wheel never moves and entries only age out by being reused.
+static uint32_t coap_wheel_advance(void)
+{
+    uint32_t now, elapsed;
+
+    if (NULL == coap_clock)
+        return 0;
+    now = coap_clock();
+    elapsed = (now - coap_wheel_us) / 1000U;
+    coap_wheel_us += elapsed * 1000U;
+    coap_wheel_ms += elapsed;
+    coap_timer_advance(&coap_wheel, coap_wheel_ms);
+    return now;
+}
+
+// Routing trie built from endpoints[] by coap_setup(). Node 0 is the root,
+// each other node is one Uri-Path segment under its parent.
+#define COAP_ROUTE_NONE 0xFF
+#define COAP_ROUTE_STATS 0xFE   // the built-in /stats resource instead of an index in endpoints[]
+#define COAP_ROUTE_TRACE 0xFD   // the built-in /trace resource
+#define COAP_ROUTE_METHODS 4    // GET, POST, PUT, DELETE
+
+typedef struct
+{
+    const char *seg;                    /* path segment */
+    uint8_t seg_len;                    /* strlen(seg), computed once */
+    uint8_t child;                      /* first child node */
+    uint8_t sibling;                    /* next node with the same parent */
+    uint8_t ep[COAP_ROUTE_METHODS];     /* index in endpoints[] per method */
+} coap_route_node_t;
+
+static coap_route_node_t coap_routes[COAP_ROUTER_MAX_NODES];
+static uint8_t coap_route_count = 0;
+
+static void coapServer_Sockinit(uint8_t sock);
+
+void coapServer_init(uint8_t * tx_buf, uint8_t * rx_buf, uint8_t sock);
+void coapServer_run();
+extern void endpoint_setup(void);
+extern const coap_endpoint_t endpoints[];
+
+#ifdef DEBUG
+void coap_dumpHeader(coap_header_t *hdr)
+{
+    printf("Header:\n");
+    printf("  ver  0x%02X\n", hdr->ver);
+    printf("  t    0x%02X\n", hdr->t);
+    printf("  tkl  0x%02X\n", hdr->tkl);
+    printf("  code 0x%02X\n", hdr->code);
+    printf("  id   0x%02X%02X\n", hdr->id[0], hdr->id[1]);
+}
+#endif
+
+#ifdef DEBUG
+void coap_dump(const uint8_t *buf, size_t buflen, bool bare)
+{
+    if (bare)
+    {
+        while(buflen--)
+            printf("%02X%s", *buf++, (buflen > 0) ? " " : "");
+    }
+    else
+    {
+        printf("Dump: ");
+        while(buflen--)
+            printf("%02X%s", *buf++, (buflen > 0) ? " " : "");
+        printf("\n");
+    }
+}
+#endif
+
+int coap_parseHeader(coap_header_t *hdr, const uint8_t *buf, size_t buflen)
+{
+    if (buflen < 4)
+        return COAP_ERR_HEADER_TOO_SHORT;
+    hdr->ver = (buf[0] & 0xC0) >> 6;
+    if (hdr->ver != 1)
+        return COAP_ERR_VERSION_NOT_1;
+    hdr->t = (buf[0] & 0x30) >> 4;
+    hdr->tkl = buf[0] & 0x0F;
+    hdr->code = buf[1];
+    hdr->id[0] = buf[2];
+    hdr->id[1] = buf[3];
+    return 0;
+}
+
+int coap_parseToken(coap_buffer_t *tokbuf, const coap_header_t *hdr, const uint8_t *buf, size_t buflen)
+{
+    if (hdr->tkl == 0)
+    {
+        tokbuf->p = NULL;
+        tokbuf->len = 0;
+        return 0;
+    }
+    else
+    if (hdr->tkl <= 8)
+    {
+        if (4U + hdr->tkl > buflen)
+            return COAP_ERR_TOKEN_TOO_SHORT;   // tok bigger than packet
+        tokbuf->p = buf+4;  // past header
+        tokbuf->len = hdr->tkl;
+        return 0;
+    }
+    else
+    {
+        // invalid size
+        return COAP_ERR_TOKEN_TOO_SHORT;
+    }
+}
+
+// advances p
+int coap_parseOption(coap_option_t *option, uint16_t *running_delta, const uint8_t **buf, size_t buflen)
+{
+    const uint8_t *p = *buf;
+    uint8_t headlen = 1;
+    uint16_t len, delta;
+
+    if (buflen < headlen) // too small
+        return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
+
+    delta = (p[0] & 0xF0) >> 4;
+    len = p[0] & 0x0F;
+
+    // These are untested and may be buggy
+    if (delta == 13)
+    {
+        headlen++;
+        if (buflen < headlen)
+            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
+        delta = p[1] + 13;
+        p++;
+    }
+    else
+    if (delta == 14)
+    {
+        headlen += 2;
+        if (buflen < headlen)
+            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
+        delta = ((p[1] << 8) | p[2]) + 269;
+        p+=2;
+    }
+    else
+    if (delta == 15)
+        return COAP_ERR_OPTION_DELTA_INVALID;
+
+    if (len == 13)
+    {
+        headlen++;
+        if (buflen < headlen)
+            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
+        len = p[1] + 13;
+        p++;
+    }
+    else
+    if (len == 14)
+    {
+        headlen += 2;
+        if (buflen < headlen)
+            return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
+        len = ((p[1] << 8) | p[2]) + 269;
+        p+=2;
+    }
+    else
+    if (len == 15)
+        return COAP_ERR_OPTION_LEN_INVALID;
+
+    if ((p + 1 + len) > (*buf + buflen))
+        return COAP_ERR_OPTION_TOO_BIG;
+
+    //printf("option num=%d\n", delta + *running_delta);
+    option->num = delta + *running_delta;
+    option->buf.p = p+1;
+    option->buf.len = len;
+    //coap_dump(p+1, len, false);
+
+    // advance buf
+    *buf = p + 1 + len;
+    *running_delta += delta;
+
+    return 0;
+}
+
+// http://tools.ietf.org/html/rfc7252#section-3.1
+// Only validates the options and finds where they end, they are decoded
+// again on demand by coap_option_next()
+int coap_parseOptionsAndPayload(coap_buffer_t *options, coap_buffer_t *payload, const coap_header_t *hdr, const uint8_t *buf, size_t buflen)
+{
+    coap_option_t option;
+    uint16_t delta = 0;
+    const uint8_t *p = buf + 4 + hdr->tkl;
+    const uint8_t *end = buf + buflen;
+    int rc;
+    if (p > end)
+        return COAP_ERR_OPTION_OVERRUNS_PACKET;   // out of bounds
+
+    //coap_dump(p, end - p);
+
+    options->p = p;
+
+    // 0xFF is payload marker
+    while((p < end) && (*p != 0xFF))
+    {
+        if (0 != (rc = coap_parseOption(&option, &delta, &p, end-p)))
+            return rc;
+    }
+    options->len = p - options->p;
+
+    if (p+1 < end && *p == 0xFF)  // payload marker
+    {
+        payload->p = p+1;
+        payload->len = end-(p+1);
+    }
+    else
+    {
+        payload->p = NULL;
+        payload->len = 0;
+    }
+
+    return 0;
+}
+
+#ifdef DEBUG
+void coap_dumpOptions(const coap_packet_t *pkt)
+{
+    coap_option_iter_t it;
+    coap_option_t opt;
+    printf(" Options:\n");
+    coap_option_iter_init(&it, pkt);
+    while (coap_option_next(&it, &opt))
+    {
+        printf("  0x%02X [ ", opt.num);
+        coap_dump(opt.buf.p, opt.buf.len, true);
+        printf(" ]\n");
+    }
+}
+#endif
+
+#ifdef DEBUG
+void coap_dumpPacket(coap_packet_t *pkt)
+{
+    coap_dumpHeader(&pkt->hdr);
+    coap_dumpOptions(pkt);
+    printf("Payload: ");
+    coap_dump(pkt->payload.p, pkt->payload.len, true);
+    printf("\n");
+}
+#endif
+
+int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen)
+{
+    int rc;
+
+    // coap_dump(buf, buflen, false);
+
+    if (0 != (rc = coap_parseHeader(&pkt->hdr, buf, buflen)))
+        return rc;
+//    coap_dumpHeader(&hdr);
+    if (0 != (rc = coap_parseToken(&pkt->tok, &pkt->hdr, buf, buflen)))
+        return rc;
+    if (0 != (rc = coap_parseOptionsAndPayload(&pkt->opts, &pkt->payload, &pkt->hdr, buf, buflen)))
+        return rc;
+    pkt->payload_fn = NULL;
+    pkt->payload_arg = NULL;
+//    coap_dumpOptions(opts, numopt);
+    return 0;
+}
+
+void coap_option_nibble(uint32_t value, uint8_t *nibble)
+{
+    if (value<13)
+    {
+        *nibble = (0xFF & value);
+    }
+    else
+    if (value<=0xFF+13)
+    {
+        *nibble = 13;
+    } else if (value<=0xFFFF+269)
+    {
+        *nibble = 14;
+    }
+}
+
+void coap_option_iter_init(coap_option_iter_t *it, const coap_packet_t *pkt)
+{
+    it->p = pkt->opts.p;
+    it->end = pkt->opts.p + pkt->opts.len;
+    it->delta = 0;
+}
+
+// option region was validated by coap_parse(), so decoding can't fail here
+bool coap_option_next(coap_option_iter_t *it, coap_option_t *option)
+{
+    if (it->p >= it->end)
+        return false;
+    return 0 == coap_parseOption(option, &it->delta, &it->p, it->end - it->p);
+}
+
+// options are sorted, so repeats of an option are consecutive. Leaves it
+// before the first one found, coap_option_next() then returns the count repeats
+uint8_t coap_findOptions(const coap_packet_t *pkt, uint16_t num, coap_option_iter_t *it)
+{
+    coap_option_iter_t cur;
+    coap_option_t opt;
+    uint8_t count = 0;
+
+    coap_option_iter_init(&cur, pkt);
+    *it = cur;
+    while (coap_option_next(&cur, &opt))
+    {
+        if (opt.num < num)
+        {
+            *it = cur;
+            continue;
+        }
+        if (opt.num > num)
+            break;
+        count++;
+    }
+    return count;
+}
+
+void coap_option_writer_init(coap_option_writer_t *w, uint8_t *buf, size_t buflen)
+{
+    w->p = buf;
+    w->end = buf + buflen;
+    w->delta = 0;
+}
+
+// http://tools.ietf.org/html/rfc7252#section-3.1
+int coap_option_add(coap_option_writer_t *w, uint16_t num, const uint8_t *val, size_t len)
+{
+    uint32_t optDelta;
+    uint8_t delta = 0, nlen = 0;
+    uint8_t *p = w->p;
+
+    if (num < w->delta || len > 0xFFFF + 269)
+        return COAP_ERR_UNSUPPORTED;
+
+    optDelta = num - w->delta;
+    coap_option_nibble(optDelta, &delta);
+    coap_option_nibble((uint32_t)len, &nlen);
+
+    if ((size_t)(w->end - p) < 1U + (delta == 13) + 2U * (delta == 14) + (nlen == 13) + 2U * (nlen == 14) + len)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    *p++ = (0xFF & (delta << 4 | nlen));
+    if (delta == 13)
+    {
+        *p++ = (optDelta - 13);
+    }
+    else
+    if (delta == 14)
+    {
+        *p++ = ((optDelta-269) >> 8);
+        *p++ = (0xFF & (optDelta-269));
+    }
+    if (nlen == 13)
+    {
+        *p++ = (len - 13);
+    }
+    else
+    if (nlen == 14)
+    {
+        *p++ = ((len-269) >> 8);
+        *p++ = (0xFF & (len-269));
+    }
+    if (len > 0)
+        memcpy(p, val, len);
+
+    w->p = p + len;
+    w->delta = num;
+    return 0;
+}
+
+int coap_buffer_to_string(char *strbuf, size_t strbuflen, const coap_buffer_t *buf)
+{
+    if (buf->len+1 > strbuflen)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    memcpy(strbuf, buf->p, buf->len);
+    strbuf[buf->len] = 0;
+    return 0;
+}
+
+void coap_writer_init(coap_writer_t *w, uint8_t sn)
+{
+    w->buf = NULL;
+    w->sn = sn;
+    w->wr = getSn_TX_WR(sn);
+    w->room = getSn_TX_FSR(sn);
+    w->len = 0;
+    w->marker = false;
+    w->nstage = 0;
+    w->tee = NULL;
+    w->tee_room = 0;
+    w->tee_len = 0;
+    w->spill = NULL;
+    w->spill_room = 0;
+}
+
+void coap_writer_init_buf(coap_writer_t *w, uint8_t *buf, size_t buflen)
+{
+    w->buf = buf;
+    w->sn = 0;
+    w->wr = 0;
+    w->room = buflen;
+    w->len = 0;
+    w->marker = false;
+    w->nstage = 0;
+    w->tee = NULL;
+    w->tee_room = 0;
+    w->tee_len = 0;
+    w->spill = NULL;
+    w->spill_room = 0;
+}
+
+// Keeps a RAM copy of the message while it is written, w->tee is NULL afterwards if it did not fit
+void coap_writer_tee(coap_writer_t *w, uint8_t *buf, size_t buflen)
+{
+    w->tee = buf;
+    w->tee_room = buflen;
+    w->tee_len = 0;
+}
+
+// A larger buffer the tee copy moves to when it outgrows its own, w->spill is NULL afterwards if it was written
+void coap_writer_spill(coap_writer_t *w, uint8_t *buf, size_t buflen)
+{
+    w->spill = buf;
+    w->spill_room = buflen;
+}
+
+static void coap_writer_flush(coap_writer_t *w)
+{
+    if (w->nstage > 0)
+    {
+        wiz_send_data(w->sn, w->stage, w->nstage);
+        w->nstage = 0;
+    }
+}
+
+// Writes at Sn_TX_WR. Small writes are staged so the header, token and
+// options go over SPI in one burst, large ones are written straight through.
+int coap_write(coap_writer_t *w, const uint8_t *buf, size_t len)
+{
+    if (len > w->room)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    if (NULL != w->tee && len > w->tee_room && NULL != w->spill)
+    {
+        if (w->tee_len + len <= w->spill_room)
+        {
+            memcpy(w->spill, w->tee - w->tee_len, w->tee_len);
+            w->tee = w->spill + w->tee_len;
+            w->tee_room = w->spill_room - w->tee_len;
+            w->spill = NULL;
+        }
+    }
+    if (NULL != w->tee)
+    {
+        if (len > w->tee_room)
+            w->tee = NULL;
+        else
+        {
+            memcpy(w->tee, buf, len);
+            w->tee += len;
+            w->tee_room -= len;
+            w->tee_len += len;
+        }
+    }
+
+    if (NULL != w->buf)
+    {
+        memcpy(w->buf + w->len, buf, len);
+    }
+    else
+    {
+        if (w->nstage + len > sizeof(w->stage))
+            coap_writer_flush(w);
+        if (len < sizeof(w->stage))
+        {
+            memcpy(w->stage + w->nstage, buf, len);
+            w->nstage += len;
+        }
+        else
+            wiz_send_data(w->sn, (uint8_t *)buf, (uint16_t)len);
+    }
+    w->len += len;
+    w->room -= len;
+    return 0;
+}
+
+// Payload marker goes in front of the first non-empty chunk
+int coap_write_payload(coap_writer_t *w, const uint8_t *buf, size_t len)
+{
+    static const uint8_t marker = 0xFF;
+    int rc;
+
+    if (len == 0)
+        return 0;
+    if (!w->marker)
+    {
+        if (len + 1 > w->room)
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        if (0 != (rc = coap_write(w, &marker, 1)))
+            return rc;
+        w->marker = true;
+    }
+    return coap_write(w, buf, len);
+}
+
+// Waits for the SEND command in flight on socket sn to complete
+static int32_t coap_writer_sendok(uint8_t sn)
+{
+    uint8_t tmp;
+
+    while (1)
+    {
+        tmp = getSn_IR(sn);
+        if (tmp & Sn_IR_SENDOK)
+        {
+            setSn_IR(sn, Sn_IR_SENDOK);
+            return SOCK_OK;
+        }
+        else if (tmp & Sn_IR_TIMEOUT)
+        {
+            setSn_IR(sn, Sn_IR_TIMEOUT);
+            return SOCKERR_TIMEOUT;
+        }
+    }
+}
+
+// Commits the message with a single SEND command, same completion handling as sendto()
+int32_t coap_writer_send(coap_writer_t *w, uint8_t *addr, uint16_t port)
+{
+    int32_t ret;
+
+    if (NULL != w->buf)
+        return SOCKERR_SOCKMODE;
+
+    coap_writer_flush(w);
+    if (0 == w->len)
+        return SOCKERR_DATALEN;
+
+    setSn_DIPR(w->sn, addr);
+    setSn_DPORT(w->sn, port);
+    setSn_CR(w->sn, Sn_CR_SEND);
+    while (getSn_CR(w->sn));
+
+    if (SOCK_OK != (ret = coap_writer_sendok(w->sn)))
+        return ret;
+    return (int32_t)w->len;
+}
+
+// Drops what was written, nothing reaches the wire before coap_writer_send()
+void coap_writer_abort(coap_writer_t *w)
+{
+    if (NULL == w->buf)
+        setSn_TX_WR(w->sn, w->wr);
+    w->room += w->len;
+    w->len = 0;
+    w->marker = false;
+    w->nstage = 0;
+}
+
+// http://tools.ietf.org/html/rfc7252#section-3
+int coap_write_packet(coap_writer_t *w, const coap_packet_t *pkt)
+{
+    uint8_t hdr[4];
+    int rc;
+
+    if ((pkt->hdr.tkl > 0) && (pkt->hdr.tkl != pkt->tok.len))
+        return COAP_ERR_UNSUPPORTED;
+
+    hdr[0] = (pkt->hdr.ver & 0x03) << 6;
+    hdr[0] |= (pkt->hdr.t & 0x03) << 4;
+    hdr[0] |= (pkt->hdr.tkl & 0x0F);
+    hdr[1] = pkt->hdr.code;
+    hdr[2] = pkt->hdr.id[0];
+    hdr[3] = pkt->hdr.id[1];
+    if (0 != (rc = coap_write(w, hdr, 4)))
+        return rc;
+
+    // inject token
+    if (pkt->hdr.tkl > 0 && 0 != (rc = coap_write(w, pkt->tok.p, pkt->hdr.tkl)))
+        return rc;
+
+    // inject options, already in wire format
+    if (pkt->opts.len > 0 && 0 != (rc = coap_write(w, pkt->opts.p, pkt->opts.len)))
+        return rc;
+
+    if (NULL != pkt->payload_fn)
+        return pkt->payload_fn(w, pkt->payload_arg);
+    return coap_write_payload(w, pkt->payload.p, pkt->payload.len);
+}
+
+int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt)
+{
+    coap_writer_t w;
+    int rc;
+
+    coap_writer_init_buf(&w, buf, *buflen);
+    if (0 != (rc = coap_write_packet(&w, pkt)))
+        return rc;
+    *buflen = w.len;
+    return 0;
+}
+
+void coap_arena_init(coap_arena_t *a, uint8_t *buf, size_t size)
+{
+    a->base = buf;
+    a->size = size;
+    a->used = 0;
+    a->peak = 0;
+    a->failed = 0;
+}
+
+// align must be a power of two. NULL if size bytes do not fit, the arena is left as it was
+void *coap_arena_alloc(coap_arena_t *a, size_t size, size_t align)
+{
+    size_t pad = (size_t)(0 - (uintptr_t)(a->base + a->used)) & (align - 1);
+    void *p;
+
+    if (pad > a->size - a->used || size > a->size - a->used - pad)
+    {
+        a->failed++;
+        return NULL;
+    }
+    p = a->base + a->used + pad;
+    a->used += pad + size;
+    if (a->used > a->peak)
+        a->peak = a->used;
+    return p;
+}
+
+coap_arena_mark_t coap_arena_mark(const coap_arena_t *a)
+{
+    return a->used;
+}
+
+void coap_arena_reset(coap_arena_t *a, coap_arena_mark_t mark)
+{
+    if (mark < a->used)
+        a->used = mark;
+}
+
+size_t coap_arena_left(const coap_arena_t *a)
+{
+    return a->size - a->used;
+}
+
+int coap_make_response(coap_arena_t *arena, coap_packet_t *pkt, const uint8_t *content, size_t content_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type)
+{
+    coap_option_writer_t w;
+    uint8_t *opts;
+    uint8_t ct[2];
+    int rc;
+
+    pkt->hdr.ver = 0x01;
+    pkt->hdr.t = COAP_TYPE_ACK;
+    pkt->hdr.tkl = 0;
+    pkt->hdr.code = rspcode;
+    pkt->hdr.id[0] = msgid_hi;
+    pkt->hdr.id[1] = msgid_lo;
+
+    // need token in response
+    if (tok) {
+        pkt->hdr.tkl = tok->len;
+        pkt->tok = *tok;
+    }
+
+    // options are encoded straight into the arena
+    pkt->opts.p = NULL;
+    pkt->opts.len = 0;
+    if (content_type != COAP_CONTENTTYPE_NONE)
+    {
+        if (NULL == (opts = coap_arena_alloc(arena, 3, 1)))
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        coap_option_writer_init(&w, opts, 3);
+        ct[0] = ((uint16_t)content_type & 0xFF00) >> 8;
+        ct[1] = ((uint16_t)content_type & 0x00FF);
+        if (0 != (rc = coap_option_add(&w, COAP_OPTION_CONTENT_FORMAT, ct, 2)))
+            return rc;
+        pkt->opts.p = opts;
+        pkt->opts.len = w.p - opts;
+    }
+    pkt->payload.p = content;
+    pkt->payload.len = content_len;
+    pkt->payload_fn = NULL;
+    pkt->payload_arg = NULL;
+    return 0;
+}
+
+int coap_make_stream_response(coap_arena_t *arena, coap_packet_t *pkt, coap_payload_func payload_fn, void *payload_arg, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type)
+{
+    int rc;
+
+    if (0 != (rc = coap_make_response(arena, pkt, NULL, 0, msgid_hi, msgid_lo, tok, rspcode, content_type)))
+        return rc;
+    pkt->payload_fn = payload_fn;
+    pkt->payload_arg = payload_arg;
+    return 0;
+}
+
+// Shortest big endian encoding of an option value, 0 has none
+static size_t coap_encode_uint(uint8_t *buf, uint32_t value)
+{
+    size_t len = 0;
+
+    if (value > 0xFFFFFF)
+        buf[len++] = (value >> 24) & 0xFF;
+    if (value > 0xFFFF)
+        buf[len++] = (value >> 16) & 0xFF;
+    if (value > 0xFF)
+        buf[len++] = (value >> 8) & 0xFF;
+    if (value > 0)
+        buf[len++] = value & 0xFF;
+    return len;
+}
+
+// Value of the first option num of pkt, false if there is none or it is longer than 3 bytes
+static bool coap_option_uint(const coap_packet_t *pkt, uint16_t num, uint32_t *value)
+{
+    coap_option_iter_t it;
+    coap_option_t opt;
+    size_t i;
+
+    if (0 == coap_findOptions(pkt, num, &it))
+        return false;
+    coap_option_next(&it, &opt);
+    if (opt.buf.len > 3)
+        return false;
+    *value = 0;
+    for (i = 0; i < opt.buf.len; i++)
+        *value = (*value << 8) | opt.buf.p[i];
+    return true;
+}
+
+// Reads the Block1 or Block2 option of pkt, blk is only set if it is valid
+coap_block_result_t coap_block_get(const coap_packet_t *pkt, uint16_t num, coap_block_t *blk)
+{
+    coap_option_iter_t it;
+    uint32_t value;
+
+    if (0 == coap_findOptions(pkt, num, &it))
+        return COAP_BLOCK_ABSENT;
+    if (!coap_option_uint(pkt, num, &value) || 7 == (value & 0x07))
+        return COAP_BLOCK_INVALID;
+    blk->num = value >> 4;
+    blk->more = (value & 0x08) != 0;
+    blk->szx = value & 0x07;
+    return COAP_BLOCK_VALID;
+}
+
+static int coap_block_add(coap_option_writer_t *w, uint16_t num, const coap_block_t *blk)
+{
+    uint8_t val[4];
+
+    return coap_option_add(w, num, val, coap_encode_uint(val, (blk->num << 4) | (blk->more ? 0x08 : 0) | blk->szx));
+}
+
+// Content-Format, Block2 and Size2 of a Block2 response at their longest
+#define COAP_BLOCK2_OPTS_SIZE   12
+// Block1 at its longest, the option number takes an extended delta byte
+#define COAP_BLOCK1_OPTS_SIZE   5
+
+// Block2 state, in the arena until the response is sent
+typedef struct
+{
+    coap_block_func fn;
+    void *arg;
+    size_t offset;
+    size_t len;
+} coap_block_ctx_t;
+
+static int coap_block_payload(coap_writer_t *w, void *arg)
+{
+    const coap_block_ctx_t *ctx = arg;
+
+    if (0 == ctx->len)
+        return 0;
+    return ctx->fn(w, ctx->offset, ctx->len, ctx->arg);
+}
+
+// Answers with the block of a total_len byte representation asked for by the Block2 option of inpkt.
+// A client block size above COAP_BLOCK_SZX_MAX is negotiated down, and without a Block2 option the
+// first block is sent if the representation does not fit one, a malformed one is answered with 4.00.
+// block_fn writes the block while the response is sent, so the representation never has to be held in RAM.
+int coap_make_block2_response(coap_arena_t *arena, coap_packet_t *pkt, const coap_packet_t *inpkt, coap_block_func block_fn, void *block_arg, size_t total_len, uint8_t msgid_hi, uint8_t msgid_lo, coap_responsecode_t rspcode, coap_content_type_t content_type)
+{
+    coap_option_writer_t w;
+    coap_block_t blk = {0, false, COAP_BLOCK_SZX_MAX};
+    coap_block_ctx_t *ctx;
+    uint8_t *opts;
+    uint8_t val[4];
+    size_t offset, len;
+    coap_block_result_t found;
+    bool block;
+    int rc;
+
+    found = coap_block_get(inpkt, COAP_OPTION_BLOCK2, &blk);
+    if (COAP_BLOCK_INVALID == found)
+        return coap_make_response(arena, pkt, NULL, 0, msgid_hi, msgid_lo, &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_NONE);
+    block = (COAP_BLOCK_VALID == found);
+    if (blk.szx > COAP_BLOCK_SZX_MAX)
+    {
+        blk.num = COAP_BLOCK_OFFSET(&blk) >> (COAP_BLOCK_SZX_MAX + 4);
+        blk.szx = COAP_BLOCK_SZX_MAX;
+    }
+    offset = COAP_BLOCK_OFFSET(&blk);
+    if (offset > total_len || (offset == total_len && offset > 0))
+        return coap_make_response(arena, pkt, NULL, 0, msgid_hi, msgid_lo, &inpkt->tok, COAP_RSPCODE_BAD_OPTION, COAP_CONTENTTYPE_NONE);
+    len = total_len - offset;
+    if (len > COAP_BLOCK_SIZE(blk.szx))
+        len = COAP_BLOCK_SIZE(blk.szx);
+    blk.more = (offset + len < total_len);
+    block = block || blk.more;
+
+    if (0 != (rc = coap_make_response(arena, pkt, NULL, 0, msgid_hi, msgid_lo, &inpkt->tok, rspcode, COAP_CONTENTTYPE_NONE)))
+        return rc;
+    if (NULL == (opts = coap_arena_alloc(arena, COAP_BLOCK2_OPTS_SIZE, 1)) || NULL == (ctx = COAP_ARENA_NEW(arena, coap_block_ctx_t)))
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    coap_option_writer_init(&w, opts, COAP_BLOCK2_OPTS_SIZE);
+    if (content_type != COAP_CONTENTTYPE_NONE)
+    {
+        val[0] = ((uint16_t)content_type & 0xFF00) >> 8;
+        val[1] = ((uint16_t)content_type & 0x00FF);
+        if (0 != (rc = coap_option_add(&w, COAP_OPTION_CONTENT_FORMAT, val, 2)))
+            return rc;
+    }
+    if (block && 0 != (rc = coap_block_add(&w, COAP_OPTION_BLOCK2, &blk)))
+        return rc;
+    // Size2 tells the client the total size up front (RFC 7959 section 4)
+    if (block && 0 == blk.num && 0 != (rc = coap_option_add(&w, COAP_OPTION_SIZE2, val, coap_encode_uint(val, total_len))))
+        return rc;
+    pkt->opts.p = opts;
+    pkt->opts.len = w.p - opts;
+
+    ctx->fn = block_fn;
+    ctx->arg = block_arg;
+    ctx->offset = offset;
+    ctx->len = len;
+    pkt->payload_fn = coap_block_payload;
+    pkt->payload_arg = ctx;
+    return 0;
+}
+
+// Acknowledges a Block1 request block, with 2.31 Continue while more blocks are expected.
+// A client block size above COAP_BLOCK_SZX_MAX is answered with the size to continue with.
+int coap_make_block1_response(coap_arena_t *arena, coap_packet_t *pkt, const coap_block_t *blk, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode)
+{
+    coap_option_writer_t w;
+    coap_block_t echo = *blk;
+    uint8_t *opts;
+    int rc;
+
+    if (0 != (rc = coap_make_response(arena, pkt, NULL, 0, msgid_hi, msgid_lo, tok, rspcode, COAP_CONTENTTYPE_NONE)))
+        return rc;
+    if (NULL == (opts = coap_arena_alloc(arena, COAP_BLOCK1_OPTS_SIZE, 1)))
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    if (echo.szx > COAP_BLOCK_SZX_MAX)
+        echo.szx = COAP_BLOCK_SZX_MAX;
+    coap_option_writer_init(&w, opts, COAP_BLOCK1_OPTS_SIZE);
+    if (0 != (rc = coap_block_add(&w, COAP_OPTION_BLOCK1, &echo)))
+        return rc;
+    pkt->opts.p = opts;
+    pkt->opts.len = w.p - opts;
+    return 0;
+}
+
+// Encodes the options once, typically at startup
+int coap_template_init(coap_template_t *tpl, coap_responsecode_t rspcode, coap_content_type_t content_type, const uint8_t *content, size_t content_len)
+{
+    coap_option_writer_t w;
+    uint8_t ct[2];
+    int rc;
+
+    tpl->code = rspcode;
+    coap_option_writer_init(&w, tpl->opts, sizeof(tpl->opts));
+    if (content_type != COAP_CONTENTTYPE_NONE)
+    {
+        ct[0] = ((uint16_t)content_type & 0xFF00) >> 8;
+        ct[1] = ((uint16_t)content_type & 0x00FF);
+        if (0 != (rc = coap_option_add(&w, COAP_OPTION_CONTENT_FORMAT, ct, 2)))
+            return rc;
+    }
+    tpl->opts_len = w.p - tpl->opts;
+    tpl->payload = content;
+    tpl->payload_len = content_len;
+    return 0;
+}
+
+// Nothing is encoded or copied, the packet only points into the template
+int coap_make_template_response(coap_packet_t *pkt, const coap_template_t *tpl, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok)
+{
+    pkt->hdr.ver = 0x01;
+    pkt->hdr.t = COAP_TYPE_ACK;
+    pkt->hdr.tkl = 0;
+    pkt->hdr.code = tpl->code;
+    pkt->hdr.id[0] = msgid_hi;
+    pkt->hdr.id[1] = msgid_lo;
+
+    if (tok) {
+        pkt->hdr.tkl = tok->len;
+        pkt->tok = *tok;
+    }
+
+    pkt->opts.p = tpl->opts;
+    pkt->opts.len = tpl->opts_len;
+    pkt->payload.p = tpl->payload;
+    pkt->payload.len = tpl->payload_len;
+    pkt->payload_fn = NULL;
+    pkt->payload_arg = NULL;
+    return 0;
+}
+
+#if COAP_STATS_RESOURCE
+// CBOR head of major type major (0 unsigned, 4 array) with argument value
+static int coap_cbor_head(coap_writer_t *w, uint8_t major, uint32_t value)
+{
+    uint8_t buf[5];
+    size_t len = 1;
+
+    if (value < 24)
+        buf[0] = (major << 5) | value;
+    else if (value <= 0xFF)
+    {
+        buf[0] = (major << 5) | 24;
+        buf[len++] = value;
+    }
+    else if (value <= 0xFFFF)
+    {
+        buf[0] = (major << 5) | 25;
+        buf[len++] = value >> 8;
+        buf[len++] = value & 0xFF;
+    }
+    else
+    {
+        buf[0] = (major << 5) | 26;
+        buf[len++] = value >> 24;
+        buf[len++] = (value >> 16) & 0xFF;
+        buf[len++] = (value >> 8) & 0xFF;
+        buf[len++] = value & 0xFF;
+    }
+    return coap_write_payload(w, buf, len);
+}
+
+static int coap_cbor_uints(coap_writer_t *w, const uint32_t *values, size_t count)
+{
+    size_t i;
+    int rc;
+
+    if (0 != (rc = coap_cbor_head(w, 4, count)))
+        return rc;
+    for (i = 0; i < count && 0 == rc; i++)
+        rc = coap_cbor_head(w, 0, values[i]);
+    return rc;
+}
+
+// [1, [packets, rx_bytes, tx_packets, tx_bytes, not_found, method_not_allowed, build_failed, send_failed,
+//      dedup_hits, notifications], [parse errors per coap_error_t],
+//  [[requests, errors, [latency histogram]] per endpoint]]
+// Histograms stop at their last non-zero bucket. Written while the response is sent, nothing is buffered.
+static int coap_stats_payload(coap_writer_t *w, void *arg)
+{
+    uint32_t global[10];
+    uint8_t i, n, len;
+    const coap_endpoint_stats_t *es;
+    int rc = 0;
+
+    global[0] = coap_stats.packets;
+    global[1] = coap_stats.rx_bytes;
+    global[2] = coap_stats.tx_packets;
+    global[3] = coap_stats.tx_bytes;
+    global[4] = coap_stats.not_found;
+    global[5] = coap_stats.method_not_allowed;
+    global[6] = coap_stats.build_failed;
+    global[7] = coap_stats.send_failed;
+    global[8] = coap_stats.dedup_hits;
+    global[9] = coap_stats.notifications;
+
+    n = (coap_endpoint_count < COAP_STATS_ENDPOINTS) ? coap_endpoint_count : COAP_STATS_ENDPOINTS;
+    rc |= coap_cbor_head(w, 4, 4);
+    rc |= coap_cbor_head(w, 0, 1);
+    rc |= coap_cbor_uints(w, global, sizeof(global) / sizeof(global[0]));
+    rc |= coap_cbor_uints(w, coap_stats.parse_errors, COAP_STATS_PARSE_ERRORS);
+    rc |= coap_cbor_head(w, 4, n);
+    for (i = 0; i < n && 0 == rc; i++)
+    {
+        es = &coap_ep_stats[i];
+        for (len = COAP_STATS_LATENCY_BUCKETS; len > 0 && 0 == es->latency_hist[len - 1]; len--)
+            ;
+        rc |= coap_cbor_head(w, 4, 3);
+        rc |= coap_cbor_head(w, 0, es->requests);
+        rc |= coap_cbor_head(w, 0, es->errors);
+        rc |= coap_cbor_uints(w, es->latency_hist, len);
+    }
+    return (0 != rc) ? COAP_ERR_BUFFER_TOO_SMALL : 0;
+}
+
+static int coap_stats_handler(coap_arena_t *arena, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    return coap_make_stream_response(arena, outpkt, coap_stats_payload, NULL, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_APPLICATION_CBOR);
+}
+
+static const coap_endpoint_path_t coap_stats_path = {1, {"stats"}};
+static const coap_endpoint_t coap_stats_endpoint = {COAP_METHOD_GET, coap_stats_handler, &coap_stats_path, "ct=60", NULL};
+
+#if COAP_TRACE
+// Newest trace events, copied into the arena before the response is written since the
+// response itself records events. Big endian: events ever recorded (4 bytes), then
+// per event its time in us (4), sequence (2) and phase (2), oldest first.
+typedef struct
+{
+    coap_trace_event_t *events;
+    size_t count;
+    uint32_t total;
+} coap_trace_snapshot_t;
+
+static int coap_trace_payload(coap_writer_t *w, void *arg)
+{
+    const coap_trace_snapshot_t *snap = arg;
+    const coap_trace_event_t *e;
+    uint8_t buf[8];
+    size_t i;
+    int rc;
+
+    buf[0] = snap->total >> 24;
+    buf[1] = (snap->total >> 16) & 0xFF;
+    buf[2] = (snap->total >> 8) & 0xFF;
+    buf[3] = snap->total & 0xFF;
+    if (0 != (rc = coap_write_payload(w, buf, 4)))
+        return rc;
+    for (i = 0; i < snap->count; i++)
+    {
+        e = &snap->events[i];
+        buf[0] = e->us >> 24;
+        buf[1] = (e->us >> 16) & 0xFF;
+        buf[2] = (e->us >> 8) & 0xFF;
+        buf[3] = e->us & 0xFF;
+        buf[4] = e->seq >> 8;
+        buf[5] = e->seq & 0xFF;
+        buf[6] = e->phase >> 8;
+        buf[7] = e->phase & 0xFF;
+        if (0 != (rc = coap_write_payload(w, buf, 8)))
+            return rc;
+    }
+    return 0;
+}
+
+static int coap_trace_handler(coap_arena_t *arena, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    coap_trace_snapshot_t *snap;
+    size_t max;
+    int rc;
+
+    if (0 != (rc = coap_make_stream_response(arena, outpkt, coap_trace_payload, NULL, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_APPLICATION_OCTECT_STREAM)))
+        return rc;
+    if (NULL == (snap = COAP_ARENA_NEW(arena, coap_trace_snapshot_t)))
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    // what fits the arena, and one response
+    max = (coap_arena_left(arena) - sizeof(uint32_t)) / sizeof(coap_trace_event_t);
+    if (max > COAP_TRACE_DUMP_MAX)
+        max = COAP_TRACE_DUMP_MAX;
+    if (NULL == (snap->events = COAP_ARENA_ARRAY(arena, coap_trace_event_t, max)))
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    snap->count = coap_trace_read(snap->events, max, &snap->total);
+    outpkt->payload_arg = snap;
+    return 0;
+}
+
+static const coap_endpoint_path_t coap_trace_path = {1, {"trace"}};
+static const coap_endpoint_t coap_trace_endpoint = {COAP_METHOD_GET, coap_trace_handler, &coap_trace_path, "ct=42", NULL};
+#endif
+#endif
+
+static const coap_endpoint_t *coap_route_endpoint(uint8_t index)
+{
+#if COAP_STATS_RESOURCE
+    if (COAP_ROUTE_STATS == index)
+        return &coap_stats_endpoint;
+#if COAP_TRACE
+    if (COAP_ROUTE_TRACE == index)
+        return &coap_trace_endpoint;
+#endif
+#endif
+    return &endpoints[index];
+}
+
+// Bucket of a latency in the log2 histograms
+static uint8_t coap_latency_bucket(uint32_t us)
+{
+    uint8_t b = 0;
+
+    while (us > 1 && b < COAP_STATS_LATENCY_BUCKETS - 1)
+    {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static uint8_t coap_route_child(uint8_t node, const uint8_t *seg, size_t seg_len)
+{
+    uint8_t c;
+
+    for (c = coap_routes[node].child; c != COAP_ROUTE_NONE; c = coap_routes[c].sibling)
+    {
+        if (coap_routes[c].seg_len == seg_len && 0 == memcmp(coap_routes[c].seg, seg, seg_len))
+            break;
+    }
+    return c;
+}
+
+static int coap_call_endpoint(const coap_endpoint_t *ep, coap_arena_t *arena, const coap_packet_t *inpkt, coap_packet_t *outpkt)
+{
+    int rc;
+
+    COAP_TRACE_POINT(COAP_TRACE_SRV_ROUTE);
+    if (NULL != ep->tpl)
+        rc = coap_make_template_response(outpkt, ep->tpl, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok);
+    else
+        rc = ep->handler(arena, inpkt, outpkt, inpkt->hdr.id[0], inpkt->hdr.id[1]);
+    COAP_TRACE_POINT(COAP_TRACE_SRV_HANDLER);
+    return rc;
+}
+
+// Observe option value of a request, -1 if there is none
+static int32_t coap_observe_value(const coap_packet_t *pkt)
+{
+    uint32_t value;
+
+    if (!coap_option_uint(pkt, COAP_OPTION_OBSERVE, &value))
+        return -1;
+    return (int32_t)value;
+}
+
+static void coap_observe_free(coap_observer_t *obs)
+{
+    coap_timer_stop(&coap_wheel, &obs->timer);
+    obs->ep = NULL;
+    coap_pool_free(&coap_observer_pool, obs);
+}
+
+// Finds the observer of peer ip:port with token tok, or allocates one for it if alloc is set.
+// A new observer has no endpoint until the registration succeeded.
+static coap_observer_t *coap_observe_find(const uint8_t *ip, uint16_t port, const coap_buffer_t *tok, bool alloc)
+{
+    coap_observer_t *obs, *slot = NULL;
+
+    for (obs = coap_observers; obs < coap_observers + COAP_OBSERVE_MAX; obs++)
+    {
+        if (NULL != obs->ep && obs->port == port && 0 == memcmp(obs->ip, ip, 4)
+            && obs->tkl == tok->len && 0 == memcmp(obs->tok, tok->p, tok->len))
+            return obs;
+    }
+
+    if (!alloc)
+        return NULL;
+    if (NULL == (slot = coap_pool_alloc(&coap_observer_pool)))
+    {
+        // all registered, an observer that went away without a RST must not hold its slot for good
+        for (obs = coap_observers; obs < coap_observers + COAP_OBSERVE_MAX; obs++)
+        {
+            if (NULL == slot || (int32_t)(obs->stamp - slot->stamp) < 0)
+                slot = obs;
+        }
+        coap_observe_free(slot);
+        slot = coap_pool_alloc(&coap_observer_pool);
+        coap_stats.observe_reclaimed++;
+    }
+    slot->ep = NULL;
+    memcpy(slot->ip, ip, 4);
+    slot->port = port;
+    slot->tkl = (uint8_t)tok->len;
+    memcpy(slot->tok, tok->p, tok->len);
+    slot->nons = 0;
+    slot->con = false;
+    return slot;
+}
+
+static void coap_observe_expired(coap_timer_t *timer, void *arg)
+{
+    coap_stats.observe_timeouts++;
+    coap_observe_free(arg);
+}
+
+// Re-encodes the options of pkt with an Observe option of value seq into buf and points pkt at them
+static int coap_observe_add_option(coap_packet_t *pkt, uint32_t seq, uint8_t *buf, size_t buflen)
+{
+    coap_option_writer_t w;
+    coap_option_iter_t it;
+    coap_option_t opt;
+    uint8_t val[4];
+    size_t len = coap_encode_uint(val, seq);
+    bool added = false;
+    int rc;
+
+    coap_option_writer_init(&w, buf, buflen);
+    coap_option_iter_init(&it, pkt);
+    while (coap_option_next(&it, &opt))
+    {
+        if (!added && opt.num >= COAP_OPTION_OBSERVE)
+        {
+            if (0 != (rc = coap_option_add(&w, COAP_OPTION_OBSERVE, val, len)))
+                return rc;
+            added = true;
+        }
+        if (opt.num == COAP_OPTION_OBSERVE)
+            continue;
+        if (0 != (rc = coap_option_add(&w, opt.num, opt.buf.p, opt.buf.len)))
+            return rc;
+    }
+    if (!added && 0 != (rc = coap_option_add(&w, COAP_OPTION_OBSERVE, val, len)))
+        return rc;
+
+    pkt->opts.p = buf;
+    pkt->opts.len = w.p - buf;
+    return 0;
+}
+
+// GET with Observe 0 registers the peer and token, Observe 1 deregisters it (RFC 7641 section 3.1).
+// Only a 2.xx response keeps the registration.
+static int coap_observe_req(const coap_endpoint_t *ep, coap_arena_t *arena, const coap_packet_t *inpkt, coap_packet_t *outpkt)
+{
+    coap_observer_t *obs = NULL;
+    uint8_t *opts = NULL;
+    int32_t value;
+    int rc;
+
+    if ((value = coap_observe_value(inpkt)) >= 0)
+    {
+        obs = coap_observe_find(coap_peer_ip, coap_peer_port, &inpkt->tok, 0 == value);
+        if (NULL != obs && 0 != value)
+        {
+            coap_observe_free(obs);
+            obs = NULL;
+        }
+    }
+    // taken before the handler runs, so it can't use up the room for the options re-encoded behind Observe
+    if (NULL != obs && NULL == (opts = coap_arena_alloc(arena, COAP_OBSERVE_OPTS_SIZE, 1)))
+        coap_observe_free(obs);
+    if (NULL == opts)
+        return coap_call_endpoint(ep, arena, inpkt, outpkt);
+
+    if (0 != (rc = coap_call_endpoint(ep, arena, inpkt, outpkt)))
+    {
+        coap_observe_free(obs);
+        return rc;
+    }
+    if (2 != (outpkt->hdr.code >> 5)
+        || 0 != coap_observe_add_option(outpkt, coap_observe_seq, opts, COAP_OBSERVE_OPTS_SIZE))
+    {
+        coap_observe_free(obs);
+        return 0;
+    }
+    coap_observe_seq = (coap_observe_seq + 1) & 0xFFFFFF;
+    obs->ep = ep;
+    // registering again counts as hearing from the observer, like an ACK
+    obs->stamp = coap_observe_stamp++;
+    obs->con_ms = coap_wheel_ms;
+    return 0;
+}
+
+// RST to a notification ends the observation (RFC 7641 section 3.6), an ACK to the
+// last CON one shows the observer is still there
+static void coap_observe_answer(const uint8_t *ip, uint16_t port, const uint8_t *mid, bool reset)
+{
+    coap_observer_t *obs;
+
+    for (obs = coap_observers; obs < coap_observers + COAP_OBSERVE_MAX; obs++)
+    {
+        if (NULL == obs->ep || obs->port != port || 0 != memcmp(obs->ip, ip, 4) || 0 != memcmp(obs->mid, mid, 2))
+            continue;
+        if (reset)
+            coap_observe_free(obs);
+        else if (obs->con)
+        {
+            coap_timer_stop(&coap_wheel, &obs->timer);
+            obs->con = false;
+            obs->con_ms = coap_wheel_ms;
+            obs->stamp = coap_observe_stamp++;
+        }
+    }
+}
+
+// Counts a notification of len bytes once its SEND completed with ret, returns 1 if it went out
+static int coap_notify_sent(int32_t ret, size_t len)
+{
+    if (SOCK_OK != ret)
+    {
+        coap_stats.send_failed++;
+        return 0;
+    }
+    coap_stats.tx_packets++;
+    coap_stats.tx_bytes += len;
+    return 1;
+}
+
+// The representation is produced once and written for every observer. Each notification
+// is written into the TX memory while the previous one is still being sent.
+// It takes the arena from where it stands, a handler calling this keeps what it allocated.
+int coapServer_notify(const coap_endpoint_path_t *path)
+{
+    coap_arena_mark_t mark = coap_arena_mark(&coap_arena);
+    uint8_t *opts;
+    coap_packet_t req, rsp;
+    coap_writer_t writer;
+    coap_observer_t *obs;
+    const coap_endpoint_t *ep = NULL;
+    bool last = false, inflight = false;
+    size_t inflight_len = 0;    // length of the notification being sent
+    int sent = 0;
+
+    if (!COAPSock_Open)
+        return 0;
+    COAP_TRACE_BEGIN(COAP_TRACE_SRV_NOTIFY);
+    coap_wheel_advance();
+
+    for (obs = coap_observers; obs < coap_observers + COAP_OBSERVE_MAX; obs++)
+    {
+        if (NULL == obs->ep || obs->ep->path != path)
+            continue;
+
+        if (NULL == ep)
+        {
+            ep = obs->ep;
+            memset(&req, 0, sizeof(req));
+            req.hdr.ver = 0x01;
+            req.hdr.t = COAP_TYPE_NONCON;
+            req.hdr.code = COAP_METHOD_GET;
+            if (0 != coap_call_endpoint(ep, &coap_arena, &req, &rsp))
+                break;
+            // an error response is sent without Observe and ends the observations
+            if (2 != (rsp.hdr.code >> 5))
+                last = true;
+            else if (NULL == (opts = coap_arena_alloc(&coap_arena, COAP_OBSERVE_OPTS_SIZE, 1))
+                     || 0 != coap_observe_add_option(&rsp, coap_observe_seq, opts, COAP_OBSERVE_OPTS_SIZE))
+                break;
+            coap_observe_seq = (coap_observe_seq + 1) & 0xFFFFFF;
+        }
+
+        // while a CON notification is unacknowledged the newer ones are CON too (RFC 7641 section 4.5.2)
+        if (!last && (obs->con || obs->nons >= COAP_OBSERVE_NON_MAX || coap_wheel_ms - obs->con_ms >= COAP_OBSERVE_CON_MS))
+        {
+            rsp.hdr.t = COAP_TYPE_CON;
+            obs->nons = 0;
+            if (!obs->con)
+                coap_timer_start(&coap_wheel, &obs->timer, coap_wheel_ms, COAP_EXCHANGE_LIFETIME_MS, coap_observe_expired, obs);
+            obs->con = true;
+        }
+        else
+        {
+            rsp.hdr.t = COAP_TYPE_NONCON;
+            obs->nons++;
+        }
+        rsp.hdr.tkl = obs->tkl;
+        rsp.tok.p = obs->tok;
+        rsp.tok.len = obs->tkl;
+        rsp.hdr.id[0] = obs->mid[0] = (coap_mid >> 8) & 0xFF;
+        rsp.hdr.id[1] = obs->mid[1] = coap_mid & 0xFF;
+        coap_mid++;
+
+        coap_writer_init(&writer, COAPSock_Num);
+        if (0 != coap_write_packet(&writer, &rsp))
+        {
+            coap_writer_abort(&writer);
+            continue;
+        }
+        coap_writer_flush(&writer);
+        COAP_TRACE_POINT(COAP_TRACE_SRV_BUILD);
+        if (inflight)
+            sent += coap_notify_sent(coap_writer_sendok(COAPSock_Num), inflight_len);
+        setSn_DIPR(COAPSock_Num, obs->ip);
+        setSn_DPORT(COAPSock_Num, obs->port);
+        setSn_CR(COAPSock_Num, Sn_CR_SEND);
+        while (getSn_CR(COAPSock_Num));
+        COAP_TRACE_POINT(COAP_TRACE_SRV_SEND);
+        inflight = true;
+        inflight_len = writer.len;
+
+        if (last)
+            coap_observe_free(obs);
+    }
+    if (inflight)
+        sent += coap_notify_sent(coap_writer_sendok(COAPSock_Num), inflight_len);
+    coap_arena_reset(&coap_arena, mark);
+
+    coap_stats.notifications += sent;
+    return sent;
+}
+
+// Path is looked up before the method, so a known path with the wrong
+// method gets 4.05 instead of 4.04
+int coap_handle_req(coap_arena_t *arena, const coap_packet_t *inpkt, coap_packet_t *outpkt)
+{
+    coap_option_iter_t it;
+    coap_option_t opt;
+    coap_responsecode_t rspcode = COAP_RSPCODE_NOT_FOUND;
+    uint8_t node = 0;
+    uint8_t i, index;
+    const coap_endpoint_t *ep;
+
+    if (0 == coap_route_count)
+        coap_setup();
+
+    // one pass over the Uri-Path options, walking down the trie
+    coap_option_iter_init(&it, inpkt);
+    while (coap_option_next(&it, &opt))
+    {
+        if (opt.num < COAP_OPTION_URI_PATH)
+            continue;
+        if (opt.num > COAP_OPTION_URI_PATH)
+            break;
+        if (COAP_ROUTE_NONE == (node = coap_route_child(node, opt.buf.p, opt.buf.len)))
+            goto fail;
+    }
+
+    if (inpkt->hdr.code >= 1 && inpkt->hdr.code <= COAP_ROUTE_METHODS
+        && COAP_ROUTE_NONE != (index = coap_routes[node].ep[inpkt->hdr.code - 1]))
+    {
+        ep = coap_route_endpoint(index);
+        coap_req_ep = index;
+        if (COAP_METHOD_GET == inpkt->hdr.code)
+            return coap_observe_req(ep, arena, inpkt, outpkt);
+        return coap_call_endpoint(ep, arena, inpkt, outpkt);
+    }
+
+    for (i = 0; i < COAP_ROUTE_METHODS; i++)
+    {
+        if (COAP_ROUTE_NONE != coap_routes[node].ep[i])
+            rspcode = COAP_RSPCODE_METHOD_NOT_ALLOWED;
+    }
+
+fail:
+    if (COAP_RSPCODE_NOT_FOUND == rspcode)
+        coap_stats.not_found++;
+    else
+        coap_stats.method_not_allowed++;
+    coap_make_response(arena, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok, rspcode, COAP_CONTENTTYPE_NONE);
+
+    return 0;
+}
+
+static uint8_t coap_route_add(void)
+{
+    coap_route_node_t *n;
+
+    if (coap_route_count >= COAP_ROUTER_MAX_NODES)
+        return COAP_ROUTE_NONE;
+    n = &coap_routes[coap_route_count];
+    memset(n, COAP_ROUTE_NONE, sizeof(*n));
+    n->seg = NULL;
+    n->seg_len = 0;
+    return coap_route_count++;
+}
+
+// Adds the path of ep to the trie, index is what the router hands back for it
+static void coap_route_insert(const coap_endpoint_t *ep, uint8_t index)
+{
+    uint8_t node, child;
+    size_t len;
+    int i;
+
+    node = 0;
+    for (i = 0; i < ep->path->count && COAP_ROUTE_NONE != node; i++)
+    {
+        len = strlen(ep->path->elems[i]);
+        child = coap_route_child(node, (const uint8_t *)ep->path->elems[i], len);
+        if (COAP_ROUTE_NONE == child && COAP_ROUTE_NONE != (child = coap_route_add()))
+        {
+            coap_routes[child].seg = ep->path->elems[i];
+            coap_routes[child].seg_len = (uint8_t)len;
+            coap_routes[child].sibling = coap_routes[node].child;
+            coap_routes[node].child = child;
+        }
+        node = child;
+    }
+
+    if (COAP_ROUTE_NONE == node)
+    {
+        printf("coap_setup: out of router nodes, raise COAP_ROUTER_MAX_NODES\n");
+        return;
+    }
+    // first entry wins, like the table order used to
+    if (ep->method >= 1 && ep->method <= COAP_ROUTE_METHODS && COAP_ROUTE_NONE == coap_routes[node].ep[ep->method - 1])
+        coap_routes[node].ep[ep->method - 1] = index;
+}
+
+// Builds the routing trie from endpoints[], called once before the first request
+void coap_setup(void)
+{
+    const coap_endpoint_t *ep;
+
+    coap_route_count = 0;
+    coap_route_add();   // root
+
+    for (ep = endpoints; NULL != ep->path; ep++)
+        coap_route_insert(ep, (uint8_t)(ep - endpoints));
+    coap_endpoint_count = (uint8_t)(ep - endpoints);
+#if COAP_STATS_RESOURCE
+    // after endpoints[], so an application resource of the same path wins
+    coap_route_insert(&coap_stats_endpoint, COAP_ROUTE_STATS);
+#if COAP_TRACE
+    coap_route_insert(&coap_trace_endpoint, COAP_ROUTE_TRACE);
+#endif
+#endif
+}
+
+static void coapServer_Sockinit(uint8_t sock)
+{
+	uint8_t i;
+
+    COAPSock_Num = sock;
+}
+
+void coapServer_init(uint8_t * tx_buf, uint8_t * rx_buf, uint8_t sock)
+{
+	// User's shared buffer
+	pCOAP_TX = tx_buf;
+	pCOAP_RX = rx_buf;
+
+	coap_pool_register(&coap_observer_pool);
+	coap_pool_register(&coap_dedup_pool);
+
+	// H/W Socket number mapping
+	coapServer_Sockinit(sock);
+
+	coap_setup();
+}
+
+static coap_dedup_t *coap_dedup_find(const uint8_t *ip, uint16_t port, const uint8_t *mid)
+{
+    coap_dedup_t *d;
+
+    for (d = coap_dedup; d < coap_dedup + COAP_DEDUP_ENTRIES; d++)
+    {
+        if (!d->used || d->port != port || 0 != memcmp(d->mid, mid, 2) || 0 != memcmp(d->ip, ip, 4))
+            continue;
+        return d;
+    }
+    return NULL;
+}
+
+static void coap_dedup_free(coap_dedup_t *d)
+{
+    if (coap_dedup_large_owner == d)
+        coap_dedup_large_owner = NULL;
+    coap_timer_stop(&coap_wheel, &d->timer);
+    d->used = false;
+    coap_pool_free(&coap_dedup_pool, d);
+}
+
+static void coap_dedup_expired(coap_timer_t *timer, void *arg)
+{
+    coap_dedup_free(arg);
+}
+
+// Answers a retransmitted CON request with the stored response, without parsing it again. A request
+// whose response is no longer kept is acknowledged empty, its handler is never run twice (RFC 7252
+// section 4.5). Returns false if the request has to be handled.
+static bool coapServer_replay(const uint8_t *ip, uint16_t port, const uint8_t *mid)
+{
+    coap_dedup_t *d;
+    coap_writer_t writer;
+    uint8_t ack[4] = {(0x01 << 6) | (COAP_TYPE_ACK << 4), 0, 0, 0};
+    const uint8_t *rsp;
+    uint16_t len;
+
+    if (NULL == (d = coap_dedup_find(ip, port, mid)))
+    {
+        coap_stats.dedup_misses++;
+        return false;
+    }
+    if (0 == d->len)
+    {
+        ack[2] = mid[0];
+        ack[3] = mid[1];
+        rsp = ack;
+        len = sizeof(ack);
+        coap_stats.dedup_uncached++;
+    }
+    else
+    {
+        rsp = (coap_dedup_large_owner == d) ? coap_dedup_large : d->rsp;
+        len = d->len;
+        coap_stats.dedup_hits++;
+    }
+
+    coap_writer_init(&writer, COAPSock_Num);
+    if (0 != coap_write(&writer, rsp, len))
+    {
+        coap_writer_abort(&writer);
+        return true;
+    }
+    COAP_TRACE_POINT(COAP_TRACE_SRV_BUILD);
+    if (coap_writer_send(&writer, (uint8_t *)ip, port) < 0)
+        coap_stats.send_failed++;
+    else
+    {
+        coap_stats.tx_packets++;
+        coap_stats.tx_bytes += len;
+    }
+    COAP_TRACE_POINT(COAP_TRACE_SRV_SEND);
+    return true;
+}
+
+// The entry stays allocated but unused until the response is sent, coap_dedup_free() it if that fails
+static coap_dedup_t *coap_dedup_store(const uint8_t *ip, uint16_t port, const uint8_t *mid)
+{
+    coap_dedup_t *d, *e;
+
+    if (NULL == (d = coap_dedup_find(ip, port, mid)) && NULL == (d = coap_pool_alloc(&coap_dedup_pool)))
+    {
+        // full, the oldest answer is the least likely to be asked for again
+        for (e = coap_dedup; e < coap_dedup + COAP_DEDUP_ENTRIES; e++)
+            if (e->used && (NULL == d || (int32_t)(e->stamp - d->stamp) < 0))
+                d = e;
+        if (NULL == d)
+            return NULL;
+        coap_timer_stop(&coap_wheel, &d->timer);
+    }
+    if (coap_dedup_large_owner == d)
+        coap_dedup_large_owner = NULL;
+    d->used = false;
+    d->stamp = coap_dedup_stamp++;
+    memcpy(d->ip, ip, 4);
+    d->port = port;
+    memcpy(d->mid, mid, 2);
+    return d;
+}
+
+// Serves one datagram of the given RX size, returns 1 if one was read, else what recvfrom() returned
+static int32_t coapServer_serve(uint16_t size)
+{
+    int32_t ret;
+    coap_packet_t pkt;
+    uint8_t  destip[4];
+    uint16_t destport;
+    coap_dedup_t *dedup = NULL;
+    coap_endpoint_stats_t *es;
+    uint32_t start;
+
+    if(size > DATA_BUF_SIZE) 
+        size = DATA_BUF_SIZE;
+    COAP_TRACE_BEGIN(COAP_TRACE_SRV_RX);
+    ret = recvfrom(COAPSock_Num, pCOAP_RX, size, destip, (uint16_t*)&destport);
+    if (ret <= 0)
+        return ret;
+    COAP_TRACE_POINT(COAP_TRACE_SRV_READ);
+
+    start = coap_wheel_advance();
+    coap_stats.rx_bytes += ret;
+
+    // only the type and message ID are looked at for a retransmission
+    if (ret >= 4 && COAP_TYPE_CON == ((pCOAP_RX[0] >> 4) & 0x03) && coapServer_replay(destip, destport, &pCOAP_RX[2]))
+        return 1;
+
+#ifdef DEBUG
+    printf("Receive: ");
+    coap_dump(pCOAP_RX, ret, true);
+    printf("\n");
+#endif
+
+    if (0 != (ret = coap_parse(&pkt, pCOAP_RX, ret)))
+    {
+        coap_stats.parse_errors[(ret < COAP_STATS_PARSE_ERRORS) ? ret : COAP_STATS_PARSE_ERRORS - 1]++;
+        printf("Bad packet rc=%d\n", ret);
+    }
+    else if (COAP_TYPE_RESET == pkt.hdr.t || COAP_TYPE_ACK == pkt.hdr.t)
+        coap_observe_answer(destip, destport, pkt.hdr.id, COAP_TYPE_RESET == pkt.hdr.t);
+    else
+    {
+        coap_packet_t rsppkt;
+        coap_writer_t writer;
+#ifdef DEBUG
+        coap_dumpPacket(&pkt);
+#endif
+        COAP_TRACE_POINT(COAP_TRACE_SRV_PARSE);
+        memcpy(coap_peer_ip, destip, 4);
+        coap_peer_port = destport;
+        coap_arena_reset(&coap_arena, 0);
+        coap_req_ep = COAP_ROUTE_NONE;
+        coap_handle_req(&coap_arena, &pkt, &rsppkt);
+
+        // response is serialized straight into the socket TX memory,
+        // and copied for replay if the request was confirmable
+        coap_writer_init(&writer, COAPSock_Num);
+        if (COAP_TYPE_CON == pkt.hdr.t && NULL != (dedup = coap_dedup_store(destip, destport, pkt.hdr.id)))
+        {
+            coap_writer_tee(&writer, dedup->rsp, sizeof(dedup->rsp));
+            coap_writer_spill(&writer, coap_dedup_large, sizeof(coap_dedup_large));
+        }
+        ret = coap_write_packet(&writer, &rsppkt);
+        // a spilled copy overwrote the previous large response
+        if (NULL != dedup && NULL == writer.spill)
+        {
+            if (NULL != coap_dedup_large_owner)
+                coap_dedup_large_owner->len = 0;
+            coap_dedup_large_owner = (NULL != writer.tee) ? dedup : NULL;
+        }
+        if (0 != ret)
+        {
+            coap_writer_abort(&writer);
+            if (NULL != dedup)
+                coap_dedup_free(dedup);
+            coap_stats.build_failed++;
+            printf("coap_build failed rc=%d\n", ret);
+        }
+        else
+        {
+            COAP_TRACE_POINT(COAP_TRACE_SRV_BUILD);
+#ifdef DEBUG
+            printf("Sending: ");
+            coap_dumpPacket(&rsppkt);
+#endif
+            if (NULL != dedup)
+            {
+                dedup->len = (NULL != writer.tee) ? (uint16_t)writer.len : 0;
+                dedup->used = true;
+                coap_timer_start(&coap_wheel, &dedup->timer, coap_wheel_ms, COAP_EXCHANGE_LIFETIME_MS, coap_dedup_expired, dedup);
+            }
+            ret = coap_writer_send(&writer, destip, destport);
+            COAP_TRACE_POINT(COAP_TRACE_SRV_SEND);
+            if (ret < 0)
+                coap_stats.send_failed++;
+            else
+            {
+                coap_stats.tx_packets++;
+                coap_stats.tx_bytes += ret;
+            }
+        }
+
+        // plain increments, the latency only with a clock
+        if (coap_req_ep < COAP_STATS_ENDPOINTS)
+        {
+            es = &coap_ep_stats[coap_req_ep];
+            es->requests++;
+            if ((rsppkt.hdr.code >> 5) >= 4)
+                es->errors++;
+            if (NULL != coap_clock)
+                es->latency_hist[coap_latency_bucket(coap_clock() - start)]++;
+        }
+    }
+
+    return 1;
+}
+
+void coapServer_setClock(coap_clock_func clock)
+{
+    coap_clock = clock;
+    if (NULL != clock)
+        coap_wheel_us = clock();
+}
+
+void coapServer_setBatch(uint16_t max_pkts, uint32_t max_us)
+{
+    coap_batch_max = (0 == max_pkts) ? 1 : max_pkts;
+    coap_batch_us = max_us;
+}
+
+const coap_endpoint_stats_t *coapServer_getEndpointStats(uint8_t index)
+{
+    if (index >= COAP_STATS_ENDPOINTS || index >= coap_endpoint_count)
+        return NULL;
+    return &coap_ep_stats[index];
+}
+
+const coap_server_stats_t *coapServer_getStats(void)
+{
+    coap_stats.arena_peak = coap_arena.peak;
+    coap_stats.arena_failed = coap_arena.failed;
+    return &coap_stats;
+}
+
+// Reads Sn_SR and opens the socket if needed, returns true once it is SOCK_UDP
+static bool coapServer_open(void)
+{
+    coap_stats.rx_reg_reads++;
+    switch(getSn_SR(COAPSock_Num))
+    {
+        case SOCK_UDP :
+            COAPSock_Open = true;
+            break;
+        case SOCK_CLOSED:
+            if(socket(COAPSock_Num, Sn_MR_UDP, COAP_SERVER_PORT, 0x00) == COAPSock_Num)
+            {
+                printf("%d:Opened, UDP loopback, port [%d]\r\n", COAPSock_Num, COAP_SERVER_PORT);
+                COAPSock_Open = true;
+            }
+            break;
+        default :
+            break;
+    }
+    return COAPSock_Open;
+}
+
+// Serves datagrams while Sn_RX_RSR reports data, up to the packet and time budget.
+// Sets *more if a budget ran out, so data may be left in the RX buffer.
+static uint16_t coapServer_drain(bool timed, bool *more)
+{
+    int32_t ret;
+    uint16_t size, npkt = 0;
+    uint32_t start = 0, now;
+
+    *more = false;
+
+    if (NULL != coap_clock && 0 != coap_batch_us)
+        start = coap_clock();
+
+    while (1)
+    {
+        coap_stats.rx_reg_reads++;
+        if (0 == (size = getSn_RX_RSR(COAPSock_Num)))
+            break;
+        if ((ret = coapServer_serve(size)) <= 0)
+        {
+            if (ret < 0)
+                COAPSock_Open = false;
+            break;
+        }
+        if (timed && 0 == npkt && NULL != coap_clock)
+        {
+            now = coap_clock() - coap_irq_stamp;
+            coap_stats.latency_count++;
+            coap_stats.latency_last_us = now;
+            coap_stats.latency_sum_us += now;
+            if (now > coap_stats.latency_max_us)
+                coap_stats.latency_max_us = now;
+        }
+        if (++npkt >= coap_batch_max)
+        {
+            coap_stats.budget_pkts++;
+            *more = true;
+            break;
+        }
+        if (NULL != coap_clock && 0 != coap_batch_us && (uint32_t)(coap_clock() - start) >= coap_batch_us)
+        {
+            coap_stats.budget_time++;
+            *more = true;
+            break;
+        }
+    }
+
+    if (0 < npkt)
+    {
+        coap_stats.batches++;
+        coap_stats.packets += npkt;
+        if (npkt > coap_stats.batch_max)
+            coap_stats.batch_max = npkt;
+        coap_stats.batch_hist[(npkt < COAP_SERVER_BATCH_MAX) ? npkt : COAP_SERVER_BATCH_MAX]++;
+    }
+    return npkt;
+}
+
+// Polling mode, serves whatever is in the RX buffer.
+// Sn_SR is only read again once the socket has failed or after COAP_SERVER_SR_RECHECK idle runs.
+void coapServer_run()
+{
+    bool more;
+
+    coap_stats.runs++;
+
+    if (!COAPSock_Open && !coapServer_open())
+        return;
+
+    if (0 == coapServer_drain(false, &more))
+    {
+        coap_stats.idle_runs++;
+        if (++COAPSock_Idle >= COAP_SERVER_SR_RECHECK)
+        {
+            COAPSock_Idle = 0;
+            COAPSock_Open = false;
+        }
+    }
+    else
+        COAPSock_Idle = 0;
+}
+
+// INTn callback, only flags the work so it is safe in interrupt context
+void coapServer_irqHandler(void)
+{
+    if (NULL != coap_clock)
+    {
+        coap_irq_stamp = coap_clock();
+        coap_irq_stamped = true;
+    }
+    coap_irq_pending = true;
+}
+
+// Alarm callback, Sn_SR is read again on the next coapServer_runIrq()
+void coapServer_alarmHandler(void)
+{
+    coap_alarm_pending = true;
+}
+
+// Time the caller may sleep before coapServer_alarmHandler() has to run
+uint32_t coapServer_nextTimeoutMs(void)
+{
+    int32_t next;
+
+    if (!COAPSock_Open)
+        return COAP_SERVER_REOPEN_MS;
+
+    coap_wheel_advance();
+    next = coap_timer_next_ms(&coap_wheel, coap_wheel_ms);
+    return (next >= 0 && next < COAP_SERVER_SR_RECHECK_MS) ? (uint32_t)next : COAP_SERVER_SR_RECHECK_MS;
+}
+
+// Event mode, touches the chip only after an interrupt or an alarm. Returns false if there was
+// nothing to do, the caller can then sleep until the next interrupt or coapServer_nextTimeoutMs().
+bool coapServer_runIrq(void)
+{
+    uint8_t ir;
+    bool timed, more;
+
+    if (coap_alarm_pending)
+    {
+        coap_alarm_pending = false;
+        coap_wheel_advance();
+        // a socket closed meanwhile raises no interrupt, so only the alarm notices it
+        if (COAPSock_Open)
+        {
+            COAPSock_Open = false;
+            if (!coapServer_open())
+                return false;
+        }
+    }
+
+    if (!COAPSock_Open)
+    {
+        // one Sn_SR read per wakeup, no retry until the next interrupt or alarm
+        if (!coapServer_open())
+            return false;
+        // serve whatever arrived before the socket was seen open
+        coap_irq_pending = true;
+    }
+
+    if (!coap_irq_pending)
+        return false;
+    coap_irq_pending = false;
+    timed = coap_irq_stamped;
+    coap_irq_stamped = false;
+
+    coap_stats.runs++;
+    coap_stats.irq_wakes++;
+
+    // clear before draining so a datagram arriving meanwhile raises INTn again
+    coap_stats.rx_reg_reads++;
+    ir = getSn_IR(COAPSock_Num);
+    setSn_IR(COAPSock_Num, ir);
+
+    if (0 == (ir & Sn_IR_RECV))
+    {
+        coap_stats.irq_spurious++;
+        return true;
+    }
+
+    coapServer_drain(timed, &more);
+    if (more)
+        coap_irq_pending = true;
+
+    return true;
+}
@@ -1,180 +1,417 @@
-#ifndef	__COAPSERVER_H__
-#define	__COAPSERVER_H__
-
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-#include <stdint.h>
-#include <stdbool.h>
-#include <stddef.h>
-
-#define COAP_SERVER_PORT        5683
-#define MAXOPT 16
-
-//http://tools.ietf.org/html/rfc7252#section-3
-typedef struct
-{
-    uint8_t ver;                /* CoAP version number */
-    uint8_t t;                  /* CoAP Message Type */
-    uint8_t tkl;                /* Token length: indicates length of the Token field */
-    uint8_t code;               /* CoAP status code. Can be request (0.xx), success reponse (2.xx), 
-                                 * client error response (4.xx), or rever error response (5.xx) 
-                                 * For possible values, see http://tools.ietf.org/html/rfc7252#section-12.1 */
-    uint8_t id[2];
-} coap_header_t;
-
-typedef struct
-{
-    const uint8_t *p;
-    size_t len;
-} coap_buffer_t;
-
-typedef struct
-{
-    uint8_t *p;
-    size_t len;
-} coap_rw_buffer_t;
-
-typedef struct
-{
-    uint8_t num;                /* Option number. See http://tools.ietf.org/html/rfc7252#section-5.10 */
-    coap_buffer_t buf;          /* Option value */
-} coap_option_t;
-
-typedef struct
-{
-    coap_header_t hdr;          /* Header of the packet */
-    coap_buffer_t tok;          /* Token value, size as specified by hdr.tkl */
-    uint8_t numopts;            /* Number of options */
-    coap_option_t opts[MAXOPT]; /* Options of the packet. For possible entries see
-                                 * http://tools.ietf.org/html/rfc7252#section-5.10 */
-    coap_buffer_t payload;      /* Payload carried by the packet */
-} coap_packet_t;
-
-/////////////////////////////////////////
-
-//http://tools.ietf.org/html/rfc7252#section-12.2
-typedef enum
-{
-    COAP_OPTION_IF_MATCH = 1,
-    COAP_OPTION_URI_HOST = 3,
-    COAP_OPTION_ETAG = 4,
-    COAP_OPTION_IF_NONE_MATCH = 5,
-    COAP_OPTION_OBSERVE = 6,
-    COAP_OPTION_URI_PORT = 7,
-    COAP_OPTION_LOCATION_PATH = 8,
-    COAP_OPTION_URI_PATH = 11,
-    COAP_OPTION_CONTENT_FORMAT = 12,
-    COAP_OPTION_MAX_AGE = 14,
-    COAP_OPTION_URI_QUERY = 15,
-    COAP_OPTION_ACCEPT = 17,
-    COAP_OPTION_LOCATION_QUERY = 20,
-    COAP_OPTION_PROXY_URI = 35,
-    COAP_OPTION_PROXY_SCHEME = 39
-} coap_option_num_t;
-
-//http://tools.ietf.org/html/rfc7252#section-12.1.1
-typedef enum
-{
-    COAP_METHOD_GET = 1,
-    COAP_METHOD_POST = 2,
-    COAP_METHOD_PUT = 3,
-    COAP_METHOD_DELETE = 4
-} coap_method_t;
-
-//http://tools.ietf.org/html/rfc7252#section-12.1.1
-typedef enum
-{
-    COAP_TYPE_CON = 0,
-    COAP_TYPE_NONCON = 1,
-    COAP_TYPE_ACK = 2,
-    COAP_TYPE_RESET = 3
-} coap_msgtype_t;
-
-//http://tools.ietf.org/html/rfc7252#section-5.2
-//http://tools.ietf.org/html/rfc7252#section-12.1.2
-#define MAKE_RSPCODE(clas, det) ((clas << 5) | (det))
-typedef enum
-{
-    COAP_RSPCODE_CONTENT = MAKE_RSPCODE(2, 5),
-    COAP_RSPCODE_NOT_FOUND = MAKE_RSPCODE(4, 4),
-    COAP_RSPCODE_BAD_REQUEST = MAKE_RSPCODE(4, 0),
-    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4)
-} coap_responsecode_t;
-
-//http://tools.ietf.org/html/rfc7252#section-12.3
-typedef enum
-{
-    COAP_CONTENTTYPE_NONE = -1, // bodge to allow us not to send option block
-    COAP_CONTENTTYPE_TEXT_PLAIN = 0,
-    COAP_CONTENTTYPE_APPLICATION_LINKFORMAT = 40,
-    COAP_CONTENTTYPE_APPLICATION_XML = 41,
-    COAP_CONTENTTYPE_APPLICATION_OCTECT_STREAM = 42,
-    COAP_CONTENTTYPE_APPLICATION_EXI = 47,
-    COAP_CONTENTTYPE_APPLICATION_JSON = 50,
-} coap_content_type_t;
-
-///////////////////////
-
-typedef enum
-{
-    COAP_ERR_NONE = 0,
-    COAP_ERR_HEADER_TOO_SHORT = 1,
-    COAP_ERR_VERSION_NOT_1 = 2,
-    COAP_ERR_TOKEN_TOO_SHORT = 3,
-    COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER = 4,
-    COAP_ERR_OPTION_TOO_SHORT = 5,
-    COAP_ERR_OPTION_OVERRUNS_PACKET = 6,
-    COAP_ERR_OPTION_TOO_BIG = 7,
-    COAP_ERR_OPTION_LEN_INVALID = 8,
-    COAP_ERR_BUFFER_TOO_SMALL = 9,
-    COAP_ERR_UNSUPPORTED = 10,
-    COAP_ERR_OPTION_DELTA_INVALID = 11,
-} coap_error_t;
-
-///////////////////////
-
-typedef int (*coap_endpoint_func)(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
-#define MAX_SEGMENTS 2  // 2 = /foo/bar, 3 = /foo/bar/baz
-typedef struct
-{
-    int count;
-    const char *elems[MAX_SEGMENTS];
-} coap_endpoint_path_t;
-
-typedef struct
-{
-    coap_method_t method;               /* (i.e. POST, PUT or GET) */
-    coap_endpoint_func handler;         /* callback function which handles this 
-                                         * type of endpoint (and calls 
-                                         * coap_make_response() at some point) */
-    const coap_endpoint_path_t *path;   /* path towards a resource (i.e. foo/bar/) */ 
-    const char *core_attr;              /* the 'ct' attribute, as defined in RFC7252, section 7.2.1.:
-                                         * "The Content-Format code "ct" attribute 
-                                         * provides a hint about the 
-                                         * Content-Formats this resource returns." 
-                                         * (Section 12.3. lists possible ct values.) */
-} coap_endpoint_t;
-
-
-// void coap_dumpPacket(coap_packet_t *pkt);
-// int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen);
-// int coap_buffer_to_string(char *strbuf, size_t strbuflen, const coap_buffer_t *buf);
-// const coap_option_t *coap_findOptions(const coap_packet_t *pkt, uint8_t num, uint8_t *count);
-// int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt);
-// void coap_dump(const uint8_t *buf, size_t buflen, bool bare);
-int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint8_t *content, size_t content_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type);
-// int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt);
-// void coap_option_nibble(uint32_t value, uint8_t *nibble);
-void coap_setup(void);
-void endpoint_setup(void);
-
-void coapServer_init(uint8_t * tx_buf, uint8_t * rx_buf, uint8_t sock);
-void coapServer_run();
-
-#ifdef __cplusplus
-}
-#endif
-
-#endif
+#ifndef	__COAPSERVER_H__
+#define	__COAPSERVER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define COAP_SERVER_PORT        5683
+#define COAP_WRITER_STAGE_SIZE  64  // small writes are coalesced up to this size before going over SPI
+#define COAP_TEMPLATE_OPTS_SIZE 16  // room for the pre-encoded options of a coap_template_t
+#ifndef COAP_ROUTER_MAX_NODES
+#define COAP_ROUTER_MAX_NODES   32  // distinct path segments over all endpoints, plus one for the root
+#endif
+#ifndef COAP_BLOCK_SZX_MAX
+#define COAP_BLOCK_SZX_MAX      6   // largest block is 16 << 6 = 1024 bytes, fits a 2 KB socket buffer with the headers
+#endif
+#ifndef COAP_OBSERVE_MAX
+#define COAP_OBSERVE_MAX        4   // observers over all resources
+#endif
+#ifndef COAP_ARENA_SIZE
+#define COAP_ARENA_SIZE         1024    // scratch arena handed to the handlers, reset before each request
+#endif
+#define COAP_OBSERVE_OPTS_SIZE  32  // room to re-encode the options of a response behind an Observe option
+#ifndef COAP_OBSERVE_NON_MAX
+#define COAP_OBSERVE_NON_MAX    16  // NON notifications to an observer between two CON ones
+#endif
+#define COAP_OBSERVE_CON_MS     86400000    // a CON notification at least once a day (RFC 7641 section 4.5)
+#ifndef COAP_DEDUP_ENTRIES
+#define COAP_DEDUP_ENTRIES      8   // answered CON requests remembered for duplicate detection
+#endif
+#ifndef COAP_DEDUP_RSP_SIZE
+#define COAP_DEDUP_RSP_SIZE     128 // largest response kept for replay in each entry
+#endif
+#ifndef COAP_DEDUP_LARGE_SIZE
+#define COAP_DEDUP_LARGE_SIZE   1088    // shared replay of the newest larger response, a full Block2 block with its options
+#endif
+#define COAP_EXCHANGE_LIFETIME_MS   247000  // RFC 7252 section 4.8.2, with the default transmission parameters
+#ifndef COAP_STATS_RESOURCE
+#define COAP_STATS_RESOURCE     1   // built-in GET /stats answering with the counters in CBOR
+#endif
+#ifndef COAP_STATS_ENDPOINTS
+#define COAP_STATS_ENDPOINTS    8   // entries of endpoints[] with counters of their own
+#endif
+#define COAP_STATS_LATENCY_BUCKETS  16  // bucket b counts latencies of [2^b, 2^(b+1)) us, the last one all longer ones
+#define COAP_STATS_PARSE_ERRORS     12  // coap_error_t values counted apart, larger ones go in the last
+#define COAP_TRACE_DUMP_MAX         120 // newest trace events in a GET /trace response, with COAP_TRACE
+#ifndef COAP_SERVER_BATCH_MAX
+#define COAP_SERVER_BATCH_MAX   8   // default datagrams served per coapServer_run() call
+#endif
+#ifndef COAP_SERVER_BATCH_US
+#define COAP_SERVER_BATCH_US    2000    // default time budget per coapServer_run() call, 0 = packet budget only
+#endif
+
+//http://tools.ietf.org/html/rfc7252#section-3
+typedef struct
+{
+    uint8_t ver;                /* CoAP version number */
+    uint8_t t;                  /* CoAP Message Type */
+    uint8_t tkl;                /* Token length: indicates length of the Token field */
+    uint8_t code;               /* CoAP status code. Can be request (0.xx), success reponse (2.xx), 
+                                 * client error response (4.xx), or rever error response (5.xx) 
+                                 * For possible values, see http://tools.ietf.org/html/rfc7252#section-12.1 */
+    uint8_t id[2];
+} coap_header_t;
+
+typedef struct
+{
+    const uint8_t *p;
+    size_t len;
+} coap_buffer_t;
+
+typedef struct
+{
+    uint8_t *p;
+    size_t len;
+} coap_rw_buffer_t;
+
+typedef struct
+{
+    uint8_t *buf;               /* RAM destination, or NULL to write into the TX memory of socket sn */
+    uint8_t sn;                 /* Socket the message is written to */
+    uint16_t wr;                /* Sn_TX_WR when the message was started, restored on abort */
+    size_t room;                /* Bytes that can still be written */
+    size_t len;                 /* Bytes of the message written so far */
+    bool marker;                /* Payload marker written */
+    uint8_t nstage;             /* Bytes waiting in stage */
+    uint8_t stage[COAP_WRITER_STAGE_SIZE];
+    uint8_t *tee;               /* If set, everything written is also copied here, NULL once it overflowed */
+    size_t tee_room;            /* Bytes left at tee */
+    size_t tee_len;             /* Bytes copied to tee so far */
+    uint8_t *spill;             /* Where the copy moves once it outgrows tee, NULL if unset or taken */
+    size_t spill_room;          /* Bytes at spill */
+} coap_writer_t;
+
+/* Bump allocator over a fixed buffer. Nothing is freed on its own, coap_arena_reset()
+ * to a mark frees everything allocated after it, so scopes nest. The server owns one
+ * and resets it before every request, handlers and the response builders share it */
+typedef struct
+{
+    uint8_t *base;
+    size_t size;
+    size_t used;                /* Bytes taken, alignment padding included */
+    size_t peak;                /* Most bytes ever taken at once */
+    uint32_t failed;            /* Allocations that did not fit */
+} coap_arena_t;
+
+typedef size_t coap_arena_mark_t;
+
+#define COAP_ARENA_INIT(buf, size)      {(buf), (size), 0, 0, 0}
+#define COAP_ARENA_NEW(a, type)         ((type *)coap_arena_alloc((a), sizeof(type), _Alignof(type)))
+#define COAP_ARENA_ARRAY(a, type, n)    ((type *)coap_arena_alloc((a), sizeof(type) * (n), _Alignof(type)))
+
+/* Produces the payload of a response with coap_write_payload(), called while the
+ * message is being sent so the payload never has to be materialized in RAM */
+typedef int (*coap_payload_func)(coap_writer_t *w, void *arg);
+
+/* Writes bytes [offset, offset + len) of a representation with coap_write_payload(),
+ * used to send one Block2 block of it */
+typedef int (*coap_block_func)(coap_writer_t *w, size_t offset, size_t len, void *arg);
+
+//http://tools.ietf.org/html/rfc7959#section-2.2
+typedef struct
+{
+    uint32_t num;               /* Block number */
+    bool more;                  /* More blocks follow */
+    uint8_t szx;                /* Block size exponent, the block is 16 << szx bytes */
+} coap_block_t;
+
+// What coap_block_get() found
+typedef enum
+{
+    COAP_BLOCK_ABSENT = 0,      /* no such option */
+    COAP_BLOCK_VALID = 1,       /* the option is in blk */
+    COAP_BLOCK_INVALID = 2      /* too long or the reserved szx 7, answered with 4.00 (RFC 7959 section 2.2) */
+} coap_block_result_t;
+
+#define COAP_BLOCK_SIZE(szx)    (16U << (szx))
+#define COAP_BLOCK_OFFSET(blk)  ((size_t)(blk)->num << ((blk)->szx + 4))
+
+typedef struct
+{
+    uint16_t num;               /* Option number. See http://tools.ietf.org/html/rfc7252#section-5.10 */
+    coap_buffer_t buf;          /* Option value */
+} coap_option_t;
+
+typedef struct
+{
+    coap_header_t hdr;          /* Header of the packet */
+    coap_buffer_t tok;          /* Token value, size as specified by hdr.tkl */
+    coap_buffer_t opts;         /* Options of the packet, still in wire format. They are decoded 
+                                 * on demand with a coap_option_iter_t. For possible entries see
+                                 * http://tools.ietf.org/html/rfc7252#section-5.10 */
+    coap_buffer_t payload;      /* Payload carried by the packet */
+    coap_payload_func payload_fn; /* If set, called to write the payload instead of copying payload */
+    void *payload_arg;          /* Argument of payload_fn */
+} coap_packet_t;
+
+typedef struct
+{
+    const uint8_t *p;           /* Next option to decode */
+    const uint8_t *end;         /* End of the option region */
+    uint16_t delta;             /* Number of the last decoded option */
+} coap_option_iter_t;
+
+typedef struct
+{
+    uint8_t *p;                 /* Where the next option is written */
+    uint8_t *end;               /* End of the buffer */
+    uint16_t delta;             /* Number of the last written option, options must be added in order */
+} coap_option_writer_t;
+
+/////////////////////////////////////////
+
+//http://tools.ietf.org/html/rfc7252#section-12.2
+typedef enum
+{
+    COAP_OPTION_IF_MATCH = 1,
+    COAP_OPTION_URI_HOST = 3,
+    COAP_OPTION_ETAG = 4,
+    COAP_OPTION_IF_NONE_MATCH = 5,
+    COAP_OPTION_OBSERVE = 6,
+    COAP_OPTION_URI_PORT = 7,
+    COAP_OPTION_LOCATION_PATH = 8,
+    COAP_OPTION_URI_PATH = 11,
+    COAP_OPTION_CONTENT_FORMAT = 12,
+    COAP_OPTION_MAX_AGE = 14,
+    COAP_OPTION_URI_QUERY = 15,
+    COAP_OPTION_ACCEPT = 17,
+    COAP_OPTION_LOCATION_QUERY = 20,
+    COAP_OPTION_PROXY_URI = 35,
+    COAP_OPTION_BLOCK2 = 23,
+    COAP_OPTION_BLOCK1 = 27,
+    COAP_OPTION_SIZE2 = 28,
+    COAP_OPTION_PROXY_SCHEME = 39,
+    COAP_OPTION_SIZE1 = 60
+} coap_option_num_t;
+
+//http://tools.ietf.org/html/rfc7252#section-12.1.1
+typedef enum
+{
+    COAP_METHOD_GET = 1,
+    COAP_METHOD_POST = 2,
+    COAP_METHOD_PUT = 3,
+    COAP_METHOD_DELETE = 4
+} coap_method_t;
+
+//http://tools.ietf.org/html/rfc7252#section-12.1.1
+typedef enum
+{
+    COAP_TYPE_CON = 0,
+    COAP_TYPE_NONCON = 1,
+    COAP_TYPE_ACK = 2,
+    COAP_TYPE_RESET = 3
+} coap_msgtype_t;
+
+//http://tools.ietf.org/html/rfc7252#section-5.2
+//http://tools.ietf.org/html/rfc7252#section-12.1.2
+#define MAKE_RSPCODE(clas, det) ((clas << 5) | (det))
+typedef enum
+{
+    COAP_RSPCODE_CONTENT = MAKE_RSPCODE(2, 5),
+    COAP_RSPCODE_NOT_FOUND = MAKE_RSPCODE(4, 4),
+    COAP_RSPCODE_BAD_REQUEST = MAKE_RSPCODE(4, 0),
+    COAP_RSPCODE_BAD_OPTION = MAKE_RSPCODE(4, 2),
+    COAP_RSPCODE_METHOD_NOT_ALLOWED = MAKE_RSPCODE(4, 5),
+    COAP_RSPCODE_REQUEST_ENTITY_INCOMPLETE = MAKE_RSPCODE(4, 8),
+    COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE = MAKE_RSPCODE(4, 13),
+    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4),
+    COAP_RSPCODE_CONTINUE = MAKE_RSPCODE(2, 31)
+} coap_responsecode_t;
+
+//http://tools.ietf.org/html/rfc7252#section-12.3
+typedef enum
+{
+    COAP_CONTENTTYPE_NONE = -1, // bodge to allow us not to send option block
+    COAP_CONTENTTYPE_TEXT_PLAIN = 0,
+    COAP_CONTENTTYPE_APPLICATION_LINKFORMAT = 40,
+    COAP_CONTENTTYPE_APPLICATION_XML = 41,
+    COAP_CONTENTTYPE_APPLICATION_OCTECT_STREAM = 42,
+    COAP_CONTENTTYPE_APPLICATION_EXI = 47,
+    COAP_CONTENTTYPE_APPLICATION_JSON = 50,
+    COAP_CONTENTTYPE_APPLICATION_CBOR = 60,
+} coap_content_type_t;
+
+///////////////////////
+
+typedef enum
+{
+    COAP_ERR_NONE = 0,
+    COAP_ERR_HEADER_TOO_SHORT = 1,
+    COAP_ERR_VERSION_NOT_1 = 2,
+    COAP_ERR_TOKEN_TOO_SHORT = 3,
+    COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER = 4,
+    COAP_ERR_OPTION_TOO_SHORT = 5,
+    COAP_ERR_OPTION_OVERRUNS_PACKET = 6,
+    COAP_ERR_OPTION_TOO_BIG = 7,
+    COAP_ERR_OPTION_LEN_INVALID = 8,
+    COAP_ERR_BUFFER_TOO_SMALL = 9,
+    COAP_ERR_UNSUPPORTED = 10,
+    COAP_ERR_OPTION_DELTA_INVALID = 11,
+} coap_error_t;
+
+///////////////////////
+
+/* Pre-encoded response for fixed content. Only the message ID, type and token
+ * are filled in per request, see coap_make_template_response() */
+typedef struct
+{
+    uint8_t code;               /* Response code */
+    uint8_t opts_len;           /* Length of opts */
+    uint8_t opts[COAP_TEMPLATE_OPTS_SIZE]; /* Options in wire format */
+    const uint8_t *payload;     /* Payload, referenced and not copied */
+    size_t payload_len;
+} coap_template_t;
+
+/* Compile time template with a Content-Format option, content_type can't be COAP_CONTENTTYPE_NONE */
+#define COAP_TEMPLATE_INIT(rspcode, content_type, content, content_len) \
+    {(rspcode), 3, {(COAP_OPTION_CONTENT_FORMAT << 4) | 2, ((content_type) >> 8) & 0xFF, (content_type) & 0xFF}, \
+     (const uint8_t *)(content), (content_len)}
+
+typedef int (*coap_endpoint_func)(coap_arena_t *arena, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
+// Only sizes coap_endpoint_path_t, the router itself has no depth limit
+#ifndef MAX_SEGMENTS
+#define MAX_SEGMENTS 4  // 2 = /foo/bar, 3 = /foo/bar/baz
+#endif
+typedef struct
+{
+    int count;
+    const char *elems[MAX_SEGMENTS];
+} coap_endpoint_path_t;
+
+typedef struct
+{
+    coap_method_t method;               /* (i.e. POST, PUT or GET) */
+    coap_endpoint_func handler;         /* callback function which handles this 
+                                         * type of endpoint (and calls 
+                                         * coap_make_response() at some point), 
+                                         * may be NULL if tpl is set */
+    const coap_endpoint_path_t *path;   /* path towards a resource (i.e. foo/bar/) */ 
+    const char *core_attr;              /* the 'ct' attribute, as defined in RFC7252, section 7.2.1.:
+                                         * "The Content-Format code "ct" attribute 
+                                         * provides a hint about the 
+                                         * Content-Formats this resource returns." 
+                                         * (Section 12.3. lists possible ct values.) */
+    const coap_template_t *tpl;         /* if set, the endpoint always answers with this 
+                                         * pre-encoded response and handler is not called */
+} coap_endpoint_t;
+
+
+// void coap_dumpPacket(coap_packet_t *pkt);
+int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen);
+// int coap_buffer_to_string(char *strbuf, size_t strbuflen, const coap_buffer_t *buf);
+void coap_option_iter_init(coap_option_iter_t *it, const coap_packet_t *pkt);
+bool coap_option_next(coap_option_iter_t *it, coap_option_t *option);
+uint8_t coap_findOptions(const coap_packet_t *pkt, uint16_t num, coap_option_iter_t *it);
+void coap_option_writer_init(coap_option_writer_t *w, uint8_t *buf, size_t buflen);
+int coap_option_add(coap_option_writer_t *w, uint16_t num, const uint8_t *val, size_t len);
+int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt);
+void coap_arena_init(coap_arena_t *a, uint8_t *buf, size_t size);
+void *coap_arena_alloc(coap_arena_t *a, size_t size, size_t align);
+coap_arena_mark_t coap_arena_mark(const coap_arena_t *a);
+void coap_arena_reset(coap_arena_t *a, coap_arena_mark_t mark);
+size_t coap_arena_left(const coap_arena_t *a);
+// void coap_dump(const uint8_t *buf, size_t buflen, bool bare);
+int coap_make_response(coap_arena_t *arena, coap_packet_t *pkt, const uint8_t *content, size_t content_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type);
+int coap_template_init(coap_template_t *tpl, coap_responsecode_t rspcode, coap_content_type_t content_type, const uint8_t *content, size_t content_len);
+int coap_make_template_response(coap_packet_t *pkt, const coap_template_t *tpl, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok);
+coap_block_result_t coap_block_get(const coap_packet_t *pkt, uint16_t num, coap_block_t *blk);
+int coap_make_block2_response(coap_arena_t *arena, coap_packet_t *pkt, const coap_packet_t *inpkt, coap_block_func block_fn, void *block_arg, size_t total_len, uint8_t msgid_hi, uint8_t msgid_lo, coap_responsecode_t rspcode, coap_content_type_t content_type);
+int coap_make_block1_response(coap_arena_t *arena, coap_packet_t *pkt, const coap_block_t *blk, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode);
+int coap_make_stream_response(coap_arena_t *arena, coap_packet_t *pkt, coap_payload_func payload_fn, void *payload_arg, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type);
+void coap_writer_init(coap_writer_t *w, uint8_t sn);
+void coap_writer_init_buf(coap_writer_t *w, uint8_t *buf, size_t buflen);
+void coap_writer_tee(coap_writer_t *w, uint8_t *buf, size_t buflen);
+void coap_writer_spill(coap_writer_t *w, uint8_t *buf, size_t buflen);
+int coap_write(coap_writer_t *w, const uint8_t *buf, size_t len);
+int coap_write_payload(coap_writer_t *w, const uint8_t *buf, size_t len);
+int32_t coap_writer_send(coap_writer_t *w, uint8_t *addr, uint16_t port);
+void coap_writer_abort(coap_writer_t *w);
+int coap_write_packet(coap_writer_t *w, const coap_packet_t *pkt);
+int coap_handle_req(coap_arena_t *arena, const coap_packet_t *inpkt, coap_packet_t *outpkt);
+// void coap_option_nibble(uint32_t value, uint8_t *nibble);
+void coap_setup(void);
+void endpoint_setup(void);
+
+// Microsecond clock used for the batch time budget, e.g. time_us_32 of the Pico SDK
+typedef uint32_t (*coap_clock_func)(void);
+
+typedef struct
+{
+    uint32_t runs;              /* coapServer_run() calls */
+    uint32_t batches;           /* calls that served at least one datagram */
+    uint32_t packets;           /* datagrams served */
+    uint32_t budget_pkts;       /* batches cut short by the packet budget */
+    uint32_t budget_time;       /* batches cut short by the time budget */
+    uint16_t batch_max;         /* largest batch seen */
+    uint32_t batch_hist[COAP_SERVER_BATCH_MAX + 1];     /* batches per size, the last bucket holds larger ones */
+    uint32_t rx_reg_reads;      /* Sn_SR, Sn_RX_RSR and Sn_IR reads done looking for work, each one is an SPI frame */
+    uint32_t idle_runs;         /* coapServer_run() calls that found nothing to do */
+    uint32_t irq_wakes;         /* coapServer_runIrq() calls that handled an interrupt */
+    uint32_t irq_spurious;      /* interrupts without Sn_IR_RECV */
+    uint32_t latency_count;     /* interrupts with a measured wake-to-response latency */
+    uint32_t latency_last_us;   /* interrupt to the first response sent, needs coapServer_setClock() */
+    uint32_t latency_max_us;
+    uint64_t latency_sum_us;
+    uint32_t notifications;     /* Observe notifications sent */
+    uint32_t observe_reclaimed; /* observers dropped, the oldest first, to make room for a registration */
+    uint32_t observe_timeouts;  /* observers dropped because a CON notification was not acknowledged */
+    uint32_t dedup_hits;        /* duplicate CON requests answered from the replay cache */
+    uint32_t dedup_misses;      /* CON requests not found in the replay cache */
+    uint32_t dedup_uncached;    /* duplicates whose response was too large or no longer kept, answered with an empty ACK */
+    uint32_t arena_peak;        /* most scratch arena bytes a request used, to size COAP_ARENA_SIZE */
+    uint32_t arena_failed;      /* arena allocations that did not fit */
+    uint32_t rx_bytes;          /* bytes of the datagrams served */
+    uint32_t tx_packets;        /* responses and notifications sent, replays included */
+    uint32_t tx_bytes;
+    uint32_t parse_errors[COAP_STATS_PARSE_ERRORS];     /* datagrams dropped by coap_parse(), per coap_error_t */
+    uint32_t not_found;         /* requests answered with 4.04 */
+    uint32_t method_not_allowed;    /* requests answered with 4.05 */
+    uint32_t build_failed;      /* responses that could not be written to the socket */
+    uint32_t send_failed;       /* SEND commands that timed out */
+} coap_server_stats_t;
+
+/* Counters of one entry of endpoints[], kept for the first COAP_STATS_ENDPOINTS */
+typedef struct
+{
+    uint32_t requests;
+    uint32_t errors;            /* answered with 4.xx or 5.xx */
+    uint32_t latency_hist[COAP_STATS_LATENCY_BUCKETS];  /* datagram read to response sent, needs coapServer_setClock() */
+} coap_endpoint_stats_t;
+
+void coapServer_init(uint8_t * tx_buf, uint8_t * rx_buf, uint8_t sock);
+void coapServer_setClock(coap_clock_func clock);
+void coapServer_setBatch(uint16_t max_pkts, uint32_t max_us);
+const coap_server_stats_t *coapServer_getStats(void);
+// Counters of endpoints[index], NULL past COAP_STATS_ENDPOINTS or the end of endpoints[]
+const coap_endpoint_stats_t *coapServer_getEndpointStats(uint8_t index);
+void coapServer_run();
+// Event mode, pass coapServer_irqHandler to wizchip_gpio_interrupt_initialize() and call
+// coapServer_runIrq() from the main loop. Whenever it returns false, arm an alarm of
+// coapServer_nextTimeoutMs() calling coapServer_alarmHandler and sleep (WFE).
+void coapServer_irqHandler(void);
+void coapServer_alarmHandler(void);
+uint32_t coapServer_nextTimeoutMs(void);
+bool coapServer_runIrq(void);
+// Sends the current representation of path to all its observers, returns the number of notifications sent
+int coapServer_notify(const coap_endpoint_path_t *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
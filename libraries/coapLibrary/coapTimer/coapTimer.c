@@ -0,0 +1,157 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "coapTimer.h"
+
+#define COAP_TIMER_TICK_MS  (1U << COAP_TIMER_TICK_SHIFT)
+#define COAP_TIMER_MASK     (COAP_TIMER_SLOTS - 1)
+
+#if (COAP_TIMER_SLOTS & COAP_TIMER_MASK) != 0
+#error "COAP_TIMER_SLOTS must be a power of two"
+#endif
+
+static uint32_t coap_rand_state = 0x2545F491;
+
+void coap_timer_wheel_init(coap_timer_wheel_t *w, uint32_t now_ms)
+{
+    uint16_t i;
+
+    for (i = 0; i < COAP_TIMER_SLOTS; i++)
+        w->slots[i] = NULL;
+    w->ms = now_ms;
+    w->tick = 0;
+    w->count = 0;
+}
+
+static void coap_timer_link(coap_timer_t **head, coap_timer_t *t)
+{
+    t->next = *head;
+    if (NULL != t->next)
+        t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+static void coap_timer_unlink(coap_timer_t *t)
+{
+    *t->pprev = t->next;
+    if (NULL != t->next)
+        t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+bool coap_timer_running(const coap_timer_t *t)
+{
+    return NULL != t->pprev;
+}
+
+void coap_timer_stop(coap_timer_wheel_t *w, coap_timer_t *t)
+{
+    if (NULL == t->pprev)
+        return;
+    coap_timer_unlink(t);
+    w->count--;
+}
+
+void coap_timer_start(coap_timer_wheel_t *w, coap_timer_t *t, uint32_t now_ms, uint32_t delay_ms, coap_timer_func fn, void *arg)
+{
+    uint32_t ahead = now_ms - w->ms;
+    uint32_t ticks;
+
+    // a time behind the current tick counts from the tick
+    if ((int32_t)ahead < 0)
+        ahead = 0;
+    ticks = (ahead + delay_ms + COAP_TIMER_TICK_MS - 1) >> COAP_TIMER_TICK_SHIFT;
+    coap_timer_stop(w, t);
+    if (0 == ticks)
+        ticks = 1;
+    t->expire = w->tick + ticks;
+    t->fn = fn;
+    t->arg = arg;
+    coap_timer_link(&w->slots[t->expire & COAP_TIMER_MASK], t);
+    w->count++;
+}
+
+// Each slot passed is looked at once, a timer in it fires if its tick has come,
+// the others are due in a later turn of the wheel and stay
+int coap_timer_advance(coap_timer_wheel_t *w, uint32_t now_ms)
+{
+    uint32_t ticks = (now_ms - w->ms) >> COAP_TIMER_TICK_SHIFT;
+    uint32_t from, i, n;
+    coap_timer_t *pending, *t;
+    int fired = 0;
+
+    if (0 == ticks)
+        return 0;
+    w->ms += ticks << COAP_TIMER_TICK_SHIFT;
+    from = w->tick + 1;
+    w->tick += ticks;
+    if (0 == w->count)
+        return 0;
+
+    n = (ticks < COAP_TIMER_SLOTS) ? ticks : COAP_TIMER_SLOTS;
+    for (i = 0; i < n && 0 != w->count; i++)
+    {
+        coap_timer_t **slot = &w->slots[(from + i) & COAP_TIMER_MASK];
+
+        // detach the slot, so timers started again by a callback are not seen twice.
+        // Callbacks may still stop timers that wait in pending.
+        if (NULL == (pending = *slot))
+            continue;
+        *slot = NULL;
+        pending->pprev = &pending;
+
+        while (NULL != (t = pending))
+        {
+            coap_timer_unlink(t);
+            if ((int32_t)(t->expire - w->tick) > 0)
+            {
+                coap_timer_link(slot, t);
+                continue;
+            }
+            w->count--;
+            fired++;
+            t->fn(t, t->arg);
+        }
+    }
+    return fired;
+}
+
+int32_t coap_timer_next_ms(const coap_timer_wheel_t *w, uint32_t now_ms)
+{
+    uint32_t i, due;
+    int32_t left;
+
+    if (0 == w->count)
+        return -1;
+    for (i = 1; i <= COAP_TIMER_SLOTS; i++)
+    {
+        if (NULL != w->slots[(w->tick + i) & COAP_TIMER_MASK])
+            break;
+    }
+    due = w->ms + (i << COAP_TIMER_TICK_SHIFT);
+    left = (int32_t)(due - now_ms);
+    return (left > 0) ? left : 0;
+}
+
+void coap_rand_seed(uint32_t seed)
+{
+    coap_rand_state = (0 != seed) ? seed : 0x2545F491;
+}
+
+uint32_t coap_rand(void)
+{
+    uint32_t x = coap_rand_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    coap_rand_state = x;
+    return x;
+}
+
+uint32_t coap_rand_range(uint32_t range)
+{
+    return ((coap_rand() >> 16) * range) >> 16;
+}
@@ -0,0 +1,68 @@
+#ifndef	__COAPTIMER_H__
+#define	__COAPTIMER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef COAP_TIMER_SLOTS
+#define COAP_TIMER_SLOTS        64  // wheel slots, a power of two
+#endif
+#ifndef COAP_TIMER_TICK_SHIFT
+#define COAP_TIMER_TICK_SHIFT   3   // a tick is 1 << 3 = 8 ms, timers fire to within one tick
+#endif
+
+typedef struct coap_timer coap_timer_t;
+
+/* Called from coap_timer_advance() when t expires. t is already stopped, so the
+ * callback may start it again or start and stop other timers */
+typedef void (*coap_timer_func)(coap_timer_t *t, void *arg);
+
+/* Timer embedded in the object it times, no memory is allocated */
+struct coap_timer
+{
+    coap_timer_t *next;         /* Next timer in the slot */
+    coap_timer_t **pprev;       /* Link pointing at this timer, NULL if stopped */
+    uint32_t expire;            /* Tick at which the timer fires */
+    coap_timer_func fn;
+    void *arg;
+};
+
+/* Hashed timer wheel. A timer due in n ticks sits in slot (now + n) % COAP_TIMER_SLOTS,
+ * so starting and stopping are O(1) and a tick only looks at the timers of one slot */
+typedef struct
+{
+    coap_timer_t *slots[COAP_TIMER_SLOTS];
+    uint32_t ms;                /* Millisecond time of the current tick */
+    uint32_t tick;              /* Current tick */
+    uint16_t count;             /* Running timers */
+} coap_timer_wheel_t;
+
+void coap_timer_wheel_init(coap_timer_wheel_t *w, uint32_t now_ms);
+// Starts t to fire delay_ms after now_ms, restarting it if it is running. now_ms may be ahead of the
+// wheel, e.g. after an idle time without coap_timer_advance(), the time in between is added to the delay.
+void coap_timer_start(coap_timer_wheel_t *w, coap_timer_t *t, uint32_t now_ms, uint32_t delay_ms, coap_timer_func fn, void *arg);
+void coap_timer_stop(coap_timer_wheel_t *w, coap_timer_t *t);
+bool coap_timer_running(const coap_timer_t *t);
+// Moves the wheel to now_ms, a free running millisecond counter that may wrap, and
+// fires the timers that expired. Returns the number fired.
+int coap_timer_advance(coap_timer_wheel_t *w, uint32_t now_ms);
+// Milliseconds from now_ms until the first tick with a timer in its slot, for a one-shot alarm
+// instead of a periodic tick. -1 if no timer runs, 0 if one is due. A timer due in a later turn
+// of the wheel may make it early, never late.
+int32_t coap_timer_next_ms(const coap_timer_wheel_t *w, uint32_t now_ms);
+
+// xorshift32, integer only, for the retransmission jitter and fresh message IDs and tokens
+void coap_rand_seed(uint32_t seed);
+uint32_t coap_rand(void);
+// Uniform in [0, range), range up to 65535, without a division
+uint32_t coap_rand_range(uint32_t range);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __COAPTIMER_H__
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "coapTrace.h"
+
+#define COAP_TRACE_MASK (COAP_TRACE_ENTRIES - 1)
+
+#if (COAP_TRACE_ENTRIES & COAP_TRACE_MASK) != 0
+#error "COAP_TRACE_ENTRIES must be a power of two"
+#endif
+
+static const char *const coap_trace_names[COAP_TRACE_PHASES] =
+{
+    "srv_rx", "srv_read", "srv_parse", "srv_route", "srv_handler", "srv_build", "srv_send", "srv_notify",
+    "cli_rx", "cli_read", "cli_parse", "cli_dispatch", "cli_tx", "cli_send",
+};
+
+static uint64_t (*coap_trace_clock)(void) = NULL;
+
+#if COAP_TRACE
+// Single writer, the main loop. total only moves after the slot is written, so a reader
+// knows which slots are complete and which ones were overwritten meanwhile.
+static coap_trace_event_t coap_trace_ring[COAP_TRACE_ENTRIES];
+static volatile uint32_t coap_trace_total = 0;
+static uint16_t coap_trace_seq = 0;
+#endif
+
+void coap_trace_setClock(uint64_t (*clock)(void))
+{
+    coap_trace_clock = clock;
+}
+
+void coap_trace_record(uint8_t phase, bool begin)
+{
+#if COAP_TRACE
+    coap_trace_event_t *e;
+    uint32_t n;
+
+    if (NULL == coap_trace_clock)
+        return;
+    if (begin)
+        coap_trace_seq++;
+    n = coap_trace_total;
+    e = &coap_trace_ring[n & COAP_TRACE_MASK];
+    e->us = (uint32_t)coap_trace_clock();
+    e->seq = coap_trace_seq;
+    e->phase = phase;
+    coap_trace_total = n + 1;
+#else
+    (void)phase;
+    (void)begin;
+#endif
+}
+
+size_t coap_trace_read(coap_trace_event_t *events, size_t max, uint32_t *total)
+{
+#if COAP_TRACE
+    uint32_t end = coap_trace_total, first, i, now;
+    size_t n = 0;
+
+    if (max > COAP_TRACE_ENTRIES)
+        max = COAP_TRACE_ENTRIES;
+    first = (end > max) ? end - (uint32_t)max : 0;
+    for (i = first; i != end; i++)
+        events[n++] = coap_trace_ring[i & COAP_TRACE_MASK];
+
+    // drop the oldest ones if the writer came round meanwhile
+    now = coap_trace_total;
+    if (now - first > COAP_TRACE_ENTRIES)
+    {
+        i = now - first - COAP_TRACE_ENTRIES;
+        if (i > n)
+            i = (uint32_t)n;
+        for (n = 0; i + n < end - first; n++)
+            events[n] = events[i + n];
+    }
+    *total = end;
+    return n;
+#else
+    (void)events;
+    (void)max;
+    *total = 0;
+    return 0;
+#endif
+}
+
+void coap_trace_dump(void)
+{
+#if COAP_TRACE
+    coap_trace_event_t e;
+    uint32_t end = coap_trace_total;
+    uint32_t i = (end > COAP_TRACE_ENTRIES) ? end - COAP_TRACE_ENTRIES : 0;
+
+    for (; i != end; i++)
+    {
+        e = coap_trace_ring[i & COAP_TRACE_MASK];
+        printf("trace %u %u %s %u\n", (unsigned int)i, (unsigned int)e.seq, coap_trace_phase_name(e.phase), (unsigned int)e.us);
+    }
+#endif
+}
+
+const char *coap_trace_phase_name(uint8_t phase)
+{
+    return (phase < COAP_TRACE_PHASES) ? coap_trace_names[phase] : "unknown";
+}
@@ -0,0 +1,70 @@
+#ifndef	__COAPTRACE_H__
+#define	__COAPTRACE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef COAP_TRACE
+#define COAP_TRACE              0   // 1 records the phase timestamps, with 0 the probes compile to nothing
+#endif
+#ifndef COAP_TRACE_ENTRIES
+#define COAP_TRACE_ENTRIES      256 // events kept, a power of two, 8 bytes each
+#endif
+
+/* Probe points of the pipelines. A datagram's events share a sequence number,
+ * the time of an event minus that of the one before it is the phase it ends. */
+typedef enum
+{
+    COAP_TRACE_SRV_RX = 0,      /* coapServer_run() found a datagram, starts a sequence */
+    COAP_TRACE_SRV_READ,        /* datagram read out of the RX memory */
+    COAP_TRACE_SRV_PARSE,       /* coap_parse() done */
+    COAP_TRACE_SRV_ROUTE,       /* routed, the handler is called next */
+    COAP_TRACE_SRV_HANDLER,     /* handler returned */
+    COAP_TRACE_SRV_BUILD,       /* response written to the TX memory */
+    COAP_TRACE_SRV_SEND,        /* SEND command completed */
+    COAP_TRACE_SRV_NOTIFY,      /* coapServer_notify() called, starts a sequence */
+    COAP_TRACE_CLI_RX,          /* coapClient_run() found a datagram, starts a sequence */
+    COAP_TRACE_CLI_READ,
+    COAP_TRACE_CLI_PARSE,
+    COAP_TRACE_CLI_DISPATCH,    /* matched, the response callback returned */
+    COAP_TRACE_CLI_TX,          /* a request is (re)transmitted, starts a sequence */
+    COAP_TRACE_CLI_SEND,        /* sendto() returned */
+    COAP_TRACE_PHASES
+} coap_trace_phase_t;
+
+typedef struct
+{
+    uint32_t us;                /* Low 32 bits of the microsecond clock */
+    uint16_t seq;               /* Sequence the event belongs to */
+    uint16_t phase;             /* coap_trace_phase_t */
+} coap_trace_event_t;
+
+#if COAP_TRACE
+#define COAP_TRACE_BEGIN(phase) coap_trace_record((phase), true)
+#define COAP_TRACE_POINT(phase) coap_trace_record((phase), false)
+#else
+#define COAP_TRACE_BEGIN(phase) ((void)0)
+#define COAP_TRACE_POINT(phase) ((void)0)
+#endif
+
+// Clock of the events, e.g. time_us_64 of the Pico SDK. Nothing is recorded without one.
+void coap_trace_setClock(uint64_t (*clock)(void));
+// Use the macros, so the probes go away with COAP_TRACE 0
+void coap_trace_record(uint8_t phase, bool begin);
+// Copies the newest events, up to max, oldest first and returns how many. *total gets
+// the number of events ever recorded, the last one copied is event *total - 1.
+size_t coap_trace_read(coap_trace_event_t *events, size_t max, uint32_t *total);
+// Newest events as "trace <index> <seq> <phase> <us>" lines, for tools/coap_trace
+void coap_trace_dump(void);
+const char *coap_trace_phase_name(uint8_t phase);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __COAPTRACE_H__
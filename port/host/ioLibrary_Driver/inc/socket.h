@@ -0,0 +1,311 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _SOCKET_H_
+#define _SOCKET_H_
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+#include "wizchip_conf.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Return values, same as ioLibrary_Driver */
+#define SOCK_OK 1
+#define SOCK_BUSY 0
+#define SOCK_FATAL -1000
+
+#define SOCK_ERROR 0
+#define SOCKERR_SOCKNUM (SOCK_ERROR - 1)
+#define SOCKERR_SOCKOPT (SOCK_ERROR - 2)
+#define SOCKERR_SOCKINIT (SOCK_ERROR - 3)
+#define SOCKERR_SOCKCLOSED (SOCK_ERROR - 4)
+#define SOCKERR_SOCKMODE (SOCK_ERROR - 5)
+#define SOCKERR_SOCKFLAG (SOCK_ERROR - 6)
+#define SOCKERR_SOCKSTATUS (SOCK_ERROR - 7)
+#define SOCKERR_ARG (SOCK_ERROR - 10)
+#define SOCKERR_PORTZERO (SOCK_ERROR - 11)
+#define SOCKERR_IPINVALID (SOCK_ERROR - 12)
+#define SOCKERR_TIMEOUT (SOCK_ERROR - 13)
+#define SOCKERR_DATALEN (SOCK_ERROR - 14)
+#define SOCKERR_BUFFER (SOCK_ERROR - 15)
+
+/* Impairment */
+#define WIZHOST_IMPAIR_TX 0
+#define WIZHOST_IMPAIR_RX 1
+
+#ifndef WIZHOST_IMPAIR_QUEUE
+#define WIZHOST_IMPAIR_QUEUE 64       // datagrams held per direction, more are dropped as overflow
+#endif
+#ifndef WIZHOST_IMPAIR_REORDER_MS
+#define WIZHOST_IMPAIR_REORDER_MS 50  // extra hold of a reordered datagram
+#endif
+
+/* ioLibrary_Driver names that collide with the host C library */
+#ifndef WIZHOST_SOCKET_IMPL
+#define socket wizhost_socket
+#define close wizhost_close
+#define sendto wizhost_sendto
+#define recvfrom wizhost_recvfrom
+#endif
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Impairment of one direction, probabilities in per mille */
+typedef struct
+{
+    uint16_t drop;      /* datagrams lost */
+    uint16_t dup;       /* datagrams delivered twice */
+    uint16_t reorder;   /* datagrams held WIZHOST_IMPAIR_REORDER_MS longer, the ones after them overtake them */
+    uint32_t delay_ms;  /* added to every datagram */
+    uint32_t jitter_ms; /* uniform 0..jitter_ms added on top of delay_ms */
+} wizhost_impair_t;
+
+typedef struct
+{
+    uint32_t datagrams;  /* offered by the sender or received from the host */
+    uint32_t dropped;
+    uint32_t duplicated;
+    uint32_t reordered;
+    uint32_t delayed;    /* copies held for a while */
+    uint32_t overflow;   /* copies lost because the queue was full */
+} wizhost_impair_stats_t;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Socket */
+/*! \brief Open a socket
+ *  \ingroup host_socket
+ *
+ *  Only Sn_MR_UDP is supported. The socket is backed by a host UDP socket bound to INADDR_ANY:port,
+ *  port 0 lets the host pick an ephemeral port like the W5x00 'any port'.
+ *
+ *  \param sn socket number
+ *  \param protocol socket mode, Sn_MR_UDP
+ *  \param port local port
+ *  \param flag socket flags, ignored
+ *  \return sn on success, SOCKERR_SOCKNUM, SOCKERR_SOCKMODE or SOCKERR_SOCKINIT otherwise
+ */
+int8_t wizhost_socket(uint8_t sn, uint8_t protocol, uint16_t port, uint8_t flag);
+
+/*! \brief Close a socket
+ *  \ingroup host_socket
+ *
+ *  \param sn socket number
+ *  \return SOCK_OK or SOCKERR_SOCKNUM
+ */
+int8_t wizhost_close(uint8_t sn);
+
+/*! \brief Send a UDP datagram
+ *  \ingroup host_socket
+ *
+ *  \param sn socket number
+ *  \param buf data to send
+ *  \param len length of data
+ *  \param addr destination IPv4 address
+ *  \param port destination port
+ *  \return sent length on success, negative SOCKERR_ value otherwise
+ */
+int32_t wizhost_sendto(uint8_t sn, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t port);
+
+/*! \brief Receive a UDP datagram
+ *  \ingroup host_socket
+ *
+ *  Never blocks, returns SOCK_BUSY if nothing is queued. A datagram larger than len is truncated.
+ *
+ *  \param sn socket number
+ *  \param buf receive buffer
+ *  \param len size of buf
+ *  \param addr source IPv4 address
+ *  \param port source port
+ *  \return received length on success, SOCK_BUSY or negative SOCKERR_ value otherwise
+ */
+int32_t wizhost_recvfrom(uint8_t sn, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t *port);
+
+/* Register */
+/*! \brief Get Sn_SR
+ *  \ingroup host_socket
+ *
+ *  \param sn socket number
+ *  \return SOCK_UDP if the socket is open, SOCK_CLOSED otherwise
+ */
+uint8_t getSn_SR(uint8_t sn);
+
+/*! \brief Get Sn_RX_RSR
+ *  \ingroup host_socket
+ *
+ *  Like the W5x00, the size includes the 8 byte UDP packet info header. Only the datagram at the
+ *  head of the host queue is reported.
+ *
+ *  \param sn socket number
+ *  \return received size, 0 if nothing is queued
+ */
+uint16_t getSn_RX_RSR(uint8_t sn);
+
+/*! \brief Get Sn_TX_FSR
+ *  \ingroup host_socket
+ *
+ *  \param sn socket number
+ *  \return free size of the emulated socket TX memory
+ */
+uint16_t getSn_TX_FSR(uint8_t sn);
+
+/*! \brief Get Sn_TX_WR
+ *  \ingroup host_socket
+ *
+ *  \param sn socket number
+ *  \return TX write pointer
+ */
+uint16_t getSn_TX_WR(uint8_t sn);
+
+/*! \brief Set Sn_TX_WR
+ *  \ingroup host_socket
+ *
+ *  \param sn socket number
+ *  \param wr TX write pointer
+ */
+void setSn_TX_WR(uint8_t sn, uint16_t wr);
+
+/*! \brief Set Sn_DIPR
+ *  \ingroup host_socket
+ *
+ *  \param sn socket number
+ *  \param dipr destination IPv4 address
+ */
+void setSn_DIPR(uint8_t sn, uint8_t *dipr);
+
+/*! \brief Set Sn_DPORT
+ *  \ingroup host_socket
+ *
+ *  \param sn socket number
+ *  \param dport destination port
+ */
+void setSn_DPORT(uint8_t sn, uint16_t dport);
+
+/*! \brief Set Sn_CR
+ *  \ingroup host_socket
+ *
+ *  Sn_CR_SEND sends the bytes between Sn_TX_RD and Sn_TX_WR as one datagram to Sn_DIPR:Sn_DPORT
+ *  and raises Sn_IR_SENDOK. Other commands are ignored.
+ *
+ *  \param sn socket number
+ *  \param cr command
+ */
+void setSn_CR(uint8_t sn, uint8_t cr);
+
+/*! \brief Get Sn_CR
+ *  \ingroup host_socket
+ *
+ *  Commands complete immediately on the host.
+ *
+ *  \param sn socket number
+ *  \return 0
+ */
+uint8_t getSn_CR(uint8_t sn);
+
+/*! \brief Get Sn_IR
+ *  \ingroup host_socket
+ *
+ *  Sn_IR_RECV is reported while a datagram is queued, it is not latched like on the W5x00.
+ *
+ *  \param sn socket number
+ *  \return interrupt flags
+ */
+uint8_t getSn_IR(uint8_t sn);
+
+/*! \brief Set Sn_IR
+ *  \ingroup host_socket
+ *
+ *  Writing 1 to a bit clears it.
+ *
+ *  \param sn socket number
+ *  \param ir interrupt flags to clear
+ */
+void setSn_IR(uint8_t sn, uint8_t ir);
+
+/* Buffer */
+/*! \brief Copy data to the socket TX memory
+ *  \ingroup host_socket
+ *
+ *  Writes at Sn_TX_WR and advances it, like wiz_send_data() of ioLibrary_Driver.
+ *
+ *  \param sn socket number
+ *  \param wizdata data to write
+ *  \param len length of data
+ */
+void wiz_send_data(uint8_t sn, uint8_t *wizdata, uint16_t len);
+
+/* Host */
+/*! \brief Get the host socket behind a socket number
+ *  \ingroup host_socket
+ *
+ *  Used by the host w5x00_gpio_irq stand-in to wait for data.
+ *
+ *  \param sn socket number
+ *  \return file descriptor, -1 if the socket is closed
+ */
+int wizhost_fd(uint8_t sn);
+
+/* Impairment */
+/*! \brief Seed the impairment
+ *  \ingroup host_socket
+ *
+ *  Decisions come from their own xorshift32, so the same seed and the same datagrams give the
+ *  same drops, duplicates and delays on every run.
+ *
+ *  \param seed any value, 0 is taken as 1
+ */
+void wizhost_impair_seed(uint32_t seed);
+
+/*! \brief Impair one direction of all sockets
+ *  \ingroup host_socket
+ *
+ *  TX impairs what wizhost_sendto() and Sn_CR_SEND send, RX what the host receives before
+ *  getSn_RX_RSR() and wizhost_recvfrom() see it. Held datagrams are released from those functions,
+ *  so the CoAP loops release them while they poll. The first wizhost_socket() also reads the
+ *  WIZHOST_IMPAIR environment variable, e.g. "seed=7,drop=5,tx.delay=20,tx.jitter=10,rx.dup=1",
+ *  with drop, dup and reorder in percent, delay and jitter in ms, and keys without tx. or rx.
+ *  applying to both directions.
+ *
+ *  \param dir WIZHOST_IMPAIR_TX or WIZHOST_IMPAIR_RX
+ *  \param cfg impairment, all zero turns it off
+ */
+void wizhost_impair_set(uint8_t dir, const wizhost_impair_t *cfg);
+
+/*! \brief Get the impairment counters of a direction
+ *  \ingroup host_socket
+ *
+ *  datagrams is counted with the impairment off as well.
+ *
+ *  \param dir WIZHOST_IMPAIR_TX or WIZHOST_IMPAIR_RX
+ *  \return counters, NULL if dir is invalid
+ */
+const wizhost_impair_stats_t *wizhost_impair_stats(uint8_t dir);
+
+/*! \brief Time until the next held datagram is due
+ *  \ingroup host_socket
+ *
+ *  Used by the host w5x00_gpio_irq stand-in to wake up for delayed datagrams.
+ *
+ *  \return ms, -1 if nothing is held
+ */
+int wizhost_impair_next_ms(void);
+
+#endif /* _SOCKET_H_ */
@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _W5X00_GPIO_IRQ_H_
+#define _W5X00_GPIO_IRQ_H_
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/*! \brief Initialize w5x00 gpio interrupt callback function
+ *  \ingroup w5x00_gpio_irq
+ *
+ *  There is no INTn line on the host, the callback is raised by wizchip_gpio_interrupt_wait() instead.
+ *
+ *  \param socket socket number
+ *  \param callback the gpio interrupt callback function
+ */
+void wizchip_gpio_interrupt_initialize(uint8_t socket, void (*callback)(void));
+
+/*! \brief Wait for the w5x00 interrupt
+ *  \ingroup w5x00_gpio_irq
+ *
+ *  Host stand-in for sleeping with __wfe() until INTn fires. Blocks in poll() until the socket has a
+ *  datagram queued, then calls the interrupt callback. Returns early if a signal arrives, e.g. the
+ *  SIGALRM of wizchip_alarm_ms(), which also ends the wait while the socket is not open.
+ */
+void wizchip_gpio_interrupt_wait(void);
+
+#endif /* _W5X00_GPIO_IRQ_H_ */
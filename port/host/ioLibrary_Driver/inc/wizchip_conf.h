@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _WIZCHIP_CONF_H_
+#define _WIZCHIP_CONF_H_
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Chip */
+#define W5100S 5100 + 5
+#define W5500 5500
+
+/* Host build, neither chip specific path is taken */
+#define WIZCHIP_HOST 0
+#ifndef _WIZCHIP_
+#define _WIZCHIP_ WIZCHIP_HOST
+#endif
+
+#define _WIZCHIP_SOCK_NUM_ 8
+
+/* Socket buffer */
+#define WIZHOST_SOCK_BUF_SIZE (1024 * 2)
+
+/* Sn_MR */
+#define Sn_MR_CLOSE 0x00
+#define Sn_MR_UDP 0x02
+
+/* Sn_CR */
+#define Sn_CR_SEND 0x20
+#define Sn_CR_RECV 0x40
+
+/* Sn_IR */
+#define Sn_IR_SENDOK 0x10
+#define Sn_IR_TIMEOUT 0x08
+#define Sn_IR_RECV 0x04
+
+/* Sn_SR */
+#define SOCK_CLOSED 0x00
+#define SOCK_UDP 0x22
+
+#endif /* _WIZCHIP_CONF_H_ */
@@ -0,0 +1,641 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define WIZHOST_SOCKET_IMPL
+#include "socket.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Socket */
+typedef struct
+{
+    int fd;          /* host UDP socket, -1 when closed */
+    uint8_t sr;      /* emulated Sn_SR */
+    uint8_t ir;      /* emulated Sn_IR */
+    uint8_t dipr[4]; /* emulated Sn_DIPR */
+    uint16_t dport;  /* emulated Sn_DPORT */
+    uint16_t tx_rd;  /* emulated Sn_TX_RD */
+    uint16_t tx_wr;  /* emulated Sn_TX_WR */
+    uint8_t tx[WIZHOST_SOCK_BUF_SIZE];
+} wizhost_sock_t;
+
+static wizhost_sock_t g_sock[_WIZCHIP_SOCK_NUM_] = {
+    [0 ... _WIZCHIP_SOCK_NUM_ - 1] = {.fd = -1, .sr = SOCK_CLOSED},
+};
+
+/* Impairment */
+typedef struct
+{
+    bool used;
+    uint8_t sn;
+    uint8_t addr[4];
+    uint16_t port;
+    uint16_t len;
+    uint32_t order;  /* FIFO among datagrams due at the same time */
+    uint64_t due_ms; /* released at this time */
+    uint8_t data[WIZHOST_SOCK_BUF_SIZE];
+} wizhost_held_t;
+
+typedef struct
+{
+    wizhost_impair_t cfg;
+    wizhost_impair_stats_t stats;
+    bool active;
+    uint16_t held;
+    wizhost_held_t queue[WIZHOST_IMPAIR_QUEUE];
+} wizhost_path_t;
+
+static wizhost_path_t g_path[2];
+static uint32_t g_impair_rand = 1;
+static uint32_t g_impair_order = 0;
+static bool g_impair_env = false;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Impairment */
+static uint64_t wizhost_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* xorshift32, apart from coap_rand() so seeding the network does not change the CoAP stack */
+static uint32_t wizhost_rand(void)
+{
+    uint32_t x = g_impair_rand;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_impair_rand = x;
+
+    return x;
+}
+
+static bool wizhost_chance(uint16_t permille)
+{
+    return permille != 0 && wizhost_rand() % 1000 < permille;
+}
+
+/* Queues a copy of a datagram to be released hold_ms from now */
+static void wizhost_hold(wizhost_path_t *path, uint8_t sn, const uint8_t *buf, uint16_t len, const uint8_t *addr, uint16_t port, uint64_t hold_ms)
+{
+    wizhost_held_t *h;
+    uint16_t i;
+
+    for (i = 0; i < WIZHOST_IMPAIR_QUEUE && path->queue[i].used; i++)
+        ;
+    if (i == WIZHOST_IMPAIR_QUEUE)
+    {
+        path->stats.overflow++;
+        return;
+    }
+
+    h = &path->queue[i];
+    h->used = true;
+    h->sn = sn;
+    memcpy(h->addr, addr, 4);
+    h->port = port;
+    h->len = len;
+    memcpy(h->data, buf, len);
+    h->order = g_impair_order++;
+    h->due_ms = wizhost_now_ms() + hold_ms;
+    path->held++;
+}
+
+/* Next datagram of sn, any socket with sn >= _WIZCHIP_SOCK_NUM_, that is due at now */
+static wizhost_held_t *wizhost_due(wizhost_path_t *path, uint8_t sn, uint64_t now)
+{
+    wizhost_held_t *h, *first = NULL;
+    uint16_t i;
+
+    if (path->held == 0)
+        return NULL;
+
+    for (i = 0; i < WIZHOST_IMPAIR_QUEUE; i++)
+    {
+        h = &path->queue[i];
+        if (!h->used || h->due_ms > now || (sn < _WIZCHIP_SOCK_NUM_ && h->sn != sn))
+            continue;
+        if (first == NULL || h->due_ms < first->due_ms || (h->due_ms == first->due_ms && (int32_t)(h->order - first->order) < 0))
+            first = h;
+    }
+
+    return first;
+}
+
+static void wizhost_release(wizhost_path_t *path, wizhost_held_t *h)
+{
+    h->used = false;
+    path->held--;
+}
+
+/* Drop, duplicate, delay and reorder of one datagram. Each copy that passes is queued, or
+ * handed to deliver right away when it is not held at all */
+static void wizhost_impair(wizhost_path_t *path, uint8_t sn, const uint8_t *buf, uint16_t len, const uint8_t *addr, uint16_t port,
+                           void (*deliver)(uint8_t sn, const uint8_t *buf, uint16_t len, const uint8_t *addr, uint16_t port))
+{
+    const wizhost_impair_t *cfg = &path->cfg;
+    uint64_t hold_ms;
+    int copies = 1;
+
+    if (wizhost_chance(cfg->drop))
+    {
+        path->stats.dropped++;
+        return;
+    }
+    if (wizhost_chance(cfg->dup))
+    {
+        path->stats.duplicated++;
+        copies = 2;
+    }
+
+    while (copies-- > 0)
+    {
+        hold_ms = cfg->delay_ms;
+        if (cfg->jitter_ms != 0)
+            hold_ms += wizhost_rand() % (cfg->jitter_ms + 1);
+        // held back long enough for the datagrams after it to overtake it
+        if (wizhost_chance(cfg->reorder))
+        {
+            path->stats.reordered++;
+            hold_ms += WIZHOST_IMPAIR_REORDER_MS;
+        }
+
+        if (hold_ms == 0 && deliver != NULL)
+            deliver(sn, buf, len, addr, port);
+        else
+        {
+            if (hold_ms != 0)
+                path->stats.delayed++;
+            wizhost_hold(path, sn, buf, len, addr, port, hold_ms);
+        }
+    }
+}
+
+static void wizhost_transmit(uint8_t sn, const uint8_t *buf, uint16_t len, const uint8_t *addr, uint16_t port)
+{
+    struct sockaddr_in to;
+
+    if (g_sock[sn].fd < 0)
+        return;
+
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    memcpy(&to.sin_addr.s_addr, addr, 4);
+    to.sin_port = htons(port);
+
+    sendto(g_sock[sn].fd, buf, len, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+/* Sends the held datagrams that are due and, with RX impairment, moves what the host
+ * received into the RX queue. Called from the functions the CoAP loops poll */
+static void wizhost_pump(void)
+{
+    wizhost_path_t *tx = &g_path[WIZHOST_IMPAIR_TX];
+    wizhost_path_t *rx = &g_path[WIZHOST_IMPAIR_RX];
+    uint8_t buf[WIZHOST_SOCK_BUF_SIZE];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    wizhost_held_t *h;
+    uint64_t now;
+    ssize_t ret;
+    uint8_t sn;
+
+    if (!tx->active && !rx->active)
+        return;
+    now = wizhost_now_ms();
+
+    while ((h = wizhost_due(tx, _WIZCHIP_SOCK_NUM_, now)) != NULL)
+    {
+        wizhost_transmit(h->sn, h->data, h->len, h->addr, h->port);
+        wizhost_release(tx, h);
+    }
+
+    if (!rx->active)
+        return;
+    for (sn = 0; sn < _WIZCHIP_SOCK_NUM_; sn++)
+    {
+        if (g_sock[sn].sr != SOCK_UDP)
+            continue;
+        for (;;)
+        {
+            fromlen = sizeof(from);
+            if ((ret = recvfrom(g_sock[sn].fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen)) < 0)
+                break;
+            rx->stats.datagrams++;
+            wizhost_impair(rx, sn, buf, (uint16_t)ret, (const uint8_t *)&from.sin_addr.s_addr, ntohs(from.sin_port), NULL);
+        }
+    }
+}
+
+static void wizhost_impair_parse(const char *spec)
+{
+    char buf[256], *item, *save = NULL, *eq;
+    wizhost_impair_t cfg[2];
+    const char *key;
+    double value;
+    int dir, d;
+
+    cfg[WIZHOST_IMPAIR_TX] = g_path[WIZHOST_IMPAIR_TX].cfg;
+    cfg[WIZHOST_IMPAIR_RX] = g_path[WIZHOST_IMPAIR_RX].cfg;
+
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (item = strtok_r(buf, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        if ((eq = strchr(item, '=')) == NULL)
+            continue;
+        *eq++ = '\0';
+        value = strtod(eq, NULL);
+
+        // tx.key or rx.key for one direction, a bare key for both
+        dir = -1;
+        key = item;
+        if (0 == strncmp(item, "tx.", 3))
+            dir = WIZHOST_IMPAIR_TX, key = item + 3;
+        else if (0 == strncmp(item, "rx.", 3))
+            dir = WIZHOST_IMPAIR_RX, key = item + 3;
+
+        if (0 == strcmp(key, "seed"))
+        {
+            wizhost_impair_seed((uint32_t)value);
+            continue;
+        }
+        for (d = WIZHOST_IMPAIR_TX; d <= WIZHOST_IMPAIR_RX; d++)
+        {
+            if (dir >= 0 && dir != d)
+                continue;
+            // percentages, kept in per mille
+            if (0 == strcmp(key, "drop"))
+                cfg[d].drop = (uint16_t)(value * 10);
+            else if (0 == strcmp(key, "dup"))
+                cfg[d].dup = (uint16_t)(value * 10);
+            else if (0 == strcmp(key, "reorder"))
+                cfg[d].reorder = (uint16_t)(value * 10);
+            else if (0 == strcmp(key, "delay"))
+                cfg[d].delay_ms = (uint32_t)value;
+            else if (0 == strcmp(key, "jitter"))
+                cfg[d].jitter_ms = (uint32_t)value;
+            else
+                printf("WIZHOST_IMPAIR: unknown key %s\n", item);
+        }
+    }
+
+    for (d = WIZHOST_IMPAIR_TX; d <= WIZHOST_IMPAIR_RX; d++)
+    {
+        wizhost_impair_set((uint8_t)d, &cfg[d]);
+        if (g_path[d].active)
+            printf("impair %s: drop %u.%u%%, dup %u.%u%%, reorder %u.%u%%, delay %u ms, jitter %u ms, seed %u\n", d == WIZHOST_IMPAIR_TX ? "tx" : "rx",
+                   cfg[d].drop / 10, cfg[d].drop % 10, cfg[d].dup / 10, cfg[d].dup % 10, cfg[d].reorder / 10, cfg[d].reorder % 10,
+                   (unsigned)cfg[d].delay_ms, (unsigned)cfg[d].jitter_ms, (unsigned)g_impair_rand);
+    }
+}
+
+void wizhost_impair_seed(uint32_t seed)
+{
+    g_impair_rand = (seed != 0) ? seed : 1;
+}
+
+void wizhost_impair_set(uint8_t dir, const wizhost_impair_t *cfg)
+{
+    wizhost_path_t *path;
+
+    if (dir > WIZHOST_IMPAIR_RX)
+        return;
+
+    path = &g_path[dir];
+    path->cfg = *cfg;
+    path->active = cfg->drop != 0 || cfg->dup != 0 || cfg->reorder != 0 || cfg->delay_ms != 0 || cfg->jitter_ms != 0;
+}
+
+const wizhost_impair_stats_t *wizhost_impair_stats(uint8_t dir)
+{
+    return (dir <= WIZHOST_IMPAIR_RX) ? &g_path[dir].stats : NULL;
+}
+
+int wizhost_impair_next_ms(void)
+{
+    uint64_t now = wizhost_now_ms(), next = UINT64_MAX;
+    wizhost_path_t *path;
+    uint16_t i;
+    int d;
+
+    for (d = WIZHOST_IMPAIR_TX; d <= WIZHOST_IMPAIR_RX; d++)
+    {
+        path = &g_path[d];
+        for (i = 0; i < WIZHOST_IMPAIR_QUEUE && path->held != 0; i++)
+        {
+            if (path->queue[i].used && path->queue[i].due_ms < next)
+                next = path->queue[i].due_ms;
+        }
+    }
+
+    if (next == UINT64_MAX)
+        return -1;
+
+    return (next > now) ? (int)(next - now) : 0;
+}
+
+/* Socket */
+int8_t wizhost_socket(uint8_t sn, uint8_t protocol, uint16_t port, uint8_t flag)
+{
+    struct sockaddr_in addr;
+    int fd;
+
+    (void)flag;
+
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+        return SOCKERR_SOCKNUM;
+    if (protocol != Sn_MR_UDP)
+        return SOCKERR_SOCKMODE;
+
+    // the network of this process, read once
+    if (!g_impair_env)
+    {
+        const char *spec = getenv("WIZHOST_IMPAIR");
+
+        g_impair_env = true;
+        if (spec != NULL)
+            wizhost_impair_parse(spec);
+    }
+
+    wizhost_close(sn);
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return SOCKERR_SOCKINIT;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        printf("%d:bind to port %d failed: %s\n", sn, port, strerror(errno));
+        close(fd);
+        return SOCKERR_SOCKINIT;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    g_sock[sn].fd = fd;
+    g_sock[sn].sr = SOCK_UDP;
+    g_sock[sn].ir = 0;
+    g_sock[sn].tx_rd = 0;
+    g_sock[sn].tx_wr = 0;
+
+    return sn;
+}
+
+int8_t wizhost_close(uint8_t sn)
+{
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+        return SOCKERR_SOCKNUM;
+
+    if (g_sock[sn].fd >= 0)
+        close(g_sock[sn].fd);
+    g_sock[sn].fd = -1;
+    g_sock[sn].sr = SOCK_CLOSED;
+
+    return SOCK_OK;
+}
+
+int32_t wizhost_sendto(uint8_t sn, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t port)
+{
+    wizhost_path_t *tx = &g_path[WIZHOST_IMPAIR_TX];
+    struct sockaddr_in to;
+    ssize_t ret;
+
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+        return SOCKERR_SOCKNUM;
+    if (g_sock[sn].sr != SOCK_UDP)
+        return SOCKERR_SOCKSTATUS;
+    if (port == 0)
+        return SOCKERR_PORTZERO;
+    if (len == 0)
+        return SOCKERR_DATALEN;
+
+    // what the impairment drops is lost on the wire, the sender does not see it
+    tx->stats.datagrams++;
+    if (tx->active)
+    {
+        wizhost_impair(tx, sn, buf, len, addr, port, wizhost_transmit);
+        wizhost_pump();
+        return len;
+    }
+
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    memcpy(&to.sin_addr.s_addr, addr, 4);
+    to.sin_port = htons(port);
+
+    ret = sendto(g_sock[sn].fd, buf, len, 0, (struct sockaddr *)&to, sizeof(to));
+    if (ret < 0)
+        return SOCKERR_SOCKSTATUS;
+
+    return (int32_t)ret;
+}
+
+int32_t wizhost_recvfrom(uint8_t sn, uint8_t *buf, uint16_t len, uint8_t *addr, uint16_t *port)
+{
+    wizhost_path_t *rx = &g_path[WIZHOST_IMPAIR_RX];
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    wizhost_held_t *h;
+    ssize_t ret;
+
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+        return SOCKERR_SOCKNUM;
+    if (g_sock[sn].sr != SOCK_UDP)
+        return SOCKERR_SOCKSTATUS;
+    if (len == 0)
+        return SOCKERR_DATALEN;
+
+    if (rx->active)
+    {
+        wizhost_pump();
+        if ((h = wizhost_due(rx, sn, wizhost_now_ms())) == NULL)
+            return SOCK_BUSY;
+        ret = (h->len < len) ? h->len : len;
+        memcpy(buf, h->data, ret);
+        memcpy(addr, h->addr, 4);
+        *port = h->port;
+        wizhost_release(rx, h);
+        return (int32_t)ret;
+    }
+
+    ret = recvfrom(g_sock[sn].fd, buf, len, 0, (struct sockaddr *)&from, &fromlen);
+    if (ret < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? SOCK_BUSY : SOCKERR_SOCKSTATUS;
+    rx->stats.datagrams++;
+
+    memcpy(addr, &from.sin_addr.s_addr, 4);
+    *port = ntohs(from.sin_port);
+
+    return (int32_t)ret;
+}
+
+/* Register */
+uint8_t getSn_SR(uint8_t sn)
+{
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+        return SOCK_CLOSED;
+
+    return g_sock[sn].sr;
+}
+
+uint16_t getSn_RX_RSR(uint8_t sn)
+{
+    wizhost_held_t *h;
+    ssize_t ret;
+
+    if (sn >= _WIZCHIP_SOCK_NUM_ || g_sock[sn].sr != SOCK_UDP)
+        return 0;
+
+    wizhost_pump();
+    if (g_path[WIZHOST_IMPAIR_RX].active)
+    {
+        h = wizhost_due(&g_path[WIZHOST_IMPAIR_RX], sn, wizhost_now_ms());
+        ret = (h != NULL) ? h->len + 8 : 0;
+        return (uint16_t)((ret > WIZHOST_SOCK_BUF_SIZE) ? WIZHOST_SOCK_BUF_SIZE : ret);
+    }
+
+    ret = recv(g_sock[sn].fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if (ret < 0)
+        return 0;
+
+    // 8 byte packet info header of the W5x00 RX buffer, clamped to the socket buffer size
+    ret += 8;
+    if (ret > WIZHOST_SOCK_BUF_SIZE)
+        ret = WIZHOST_SOCK_BUF_SIZE;
+
+    return (uint16_t)ret;
+}
+
+uint16_t getSn_TX_FSR(uint8_t sn)
+{
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+        return 0;
+
+    return WIZHOST_SOCK_BUF_SIZE - (uint16_t)(g_sock[sn].tx_wr - g_sock[sn].tx_rd);
+}
+
+uint16_t getSn_TX_WR(uint8_t sn)
+{
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+        return 0;
+
+    return g_sock[sn].tx_wr;
+}
+
+void setSn_TX_WR(uint8_t sn, uint16_t wr)
+{
+    if (sn < _WIZCHIP_SOCK_NUM_)
+        g_sock[sn].tx_wr = wr;
+}
+
+void setSn_DIPR(uint8_t sn, uint8_t *dipr)
+{
+    if (sn < _WIZCHIP_SOCK_NUM_)
+        memcpy(g_sock[sn].dipr, dipr, 4);
+}
+
+void setSn_DPORT(uint8_t sn, uint16_t dport)
+{
+    if (sn < _WIZCHIP_SOCK_NUM_)
+        g_sock[sn].dport = dport;
+}
+
+void setSn_CR(uint8_t sn, uint8_t cr)
+{
+    wizhost_sock_t *s;
+    uint8_t buf[WIZHOST_SOCK_BUF_SIZE];
+    uint16_t len, i;
+
+    if (sn >= _WIZCHIP_SOCK_NUM_ || cr != Sn_CR_SEND)
+        return;
+
+    s = &g_sock[sn];
+    len = s->tx_wr - s->tx_rd;
+    for (i = 0; i < len; i++)
+        buf[i] = s->tx[(uint16_t)(s->tx_rd + i) % WIZHOST_SOCK_BUF_SIZE];
+    s->tx_rd = s->tx_wr;
+
+    if (len > 0 && wizhost_sendto(sn, buf, len, s->dipr, s->dport) < 0)
+        s->ir |= Sn_IR_TIMEOUT;
+    else
+        s->ir |= Sn_IR_SENDOK;
+}
+
+uint8_t getSn_CR(uint8_t sn)
+{
+    (void)sn;
+
+    return 0;
+}
+
+uint8_t getSn_IR(uint8_t sn)
+{
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+        return 0;
+
+    return g_sock[sn].ir | (getSn_RX_RSR(sn) > 0 ? Sn_IR_RECV : 0);
+}
+
+void setSn_IR(uint8_t sn, uint8_t ir)
+{
+    if (sn < _WIZCHIP_SOCK_NUM_)
+        g_sock[sn].ir &= ~ir;
+}
+
+/* Buffer */
+void wiz_send_data(uint8_t sn, uint8_t *wizdata, uint16_t len)
+{
+    wizhost_sock_t *s;
+    uint16_t i;
+
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+        return;
+
+    s = &g_sock[sn];
+    for (i = 0; i < len; i++)
+        s->tx[(uint16_t)(s->tx_wr + i) % WIZHOST_SOCK_BUF_SIZE] = wizdata[i];
+    s->tx_wr += len;
+}
+
+/* Host */
+int wizhost_fd(uint8_t sn)
+{
+    if (sn >= _WIZCHIP_SOCK_NUM_)
+        return -1;
+
+    return g_sock[sn].fd;
+}
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2022 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#define _GNU_SOURCE /* ppoll */
+#include <stdio.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include "wizchip_conf.h"
+#include "socket.h"
+#include "w5x00_gpio_irq.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+static uint8_t g_irq_socket;
+static void (*callback_ptr)(void);
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* GPIO */
+void wizchip_gpio_interrupt_initialize(uint8_t socket, void (*callback)(void))
+{
+    g_irq_socket = socket;
+    callback_ptr = callback;
+}
+
+void wizchip_gpio_interrupt_wait(void)
+{
+    struct pollfd pfd;
+    struct timespec ts;
+    sigset_t mask;
+    int ret, ms;
+
+    // without an open socket only an alarm or a signal ends the wait
+    pfd.fd = wizhost_fd(g_irq_socket);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    // SIGALRM of wizchip_alarm_ms() is only let through while waiting
+    pthread_sigmask(SIG_SETMASK, NULL, &mask);
+    sigdelset(&mask, SIGALRM);
+
+    // a delayed datagram falling due counts as an interrupt too
+    ms = wizhost_impair_next_ms();
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000 * 1000;
+    ret = ppoll(&pfd, 1, (ms < 0) ? NULL : &ts, &mask);
+    if ((ret == 0 || (ret > 0 && (pfd.revents & POLLIN))) && callback_ptr != NULL)
+    {
+        callback_ptr();
+    }
+}
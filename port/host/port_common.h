@@ -0,0 +1,20 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _PORT_COMMON_H_
+#define _PORT_COMMON_H_
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Common */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#endif /* _PORT_COMMON_H_ */
@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "timer.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Timer */
+static pthread_t g_timer;
+static void (*callback_ptr)(void);
+
+/* Alarm */
+static timer_t g_alarm;
+static int g_alarm_created = 0;
+static void (*alarm_callback_ptr)(void);
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Timer */
+static void *wizchip_1ms_timer_thread(void *arg)
+{
+    struct timespec next;
+
+    (void)arg;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (1)
+    {
+        next.tv_nsec += 1000 * 1000;
+        if (next.tv_nsec >= 1000 * 1000 * 1000)
+        {
+            next.tv_nsec -= 1000 * 1000 * 1000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        if (callback_ptr != NULL)
+        {
+            callback_ptr();
+        }
+    }
+
+    return NULL;
+}
+
+void wizchip_1ms_timer_initialize(void (*callback)(void))
+{
+    callback_ptr = callback;
+    pthread_create(&g_timer, NULL, wizchip_1ms_timer_thread, NULL);
+}
+
+/* Alarm */
+static void wizchip_alarm_signal(int sig)
+{
+    (void)sig;
+
+    if (alarm_callback_ptr != NULL)
+    {
+        alarm_callback_ptr();
+    }
+}
+
+void wizchip_alarm_ms(uint32_t ms, void (*callback)(void))
+{
+    struct sigevent sev;
+    struct sigaction sa;
+    struct itimerspec its;
+    sigset_t mask;
+
+    if (!g_alarm_created)
+    {
+        // blocked outside wizchip_gpio_interrupt_wait(), so an alarm due before the wait stays
+        // pending and ends it at once, like the event register does for __wfe()
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGALRM);
+        pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = wizchip_alarm_signal;
+        sigaction(SIGALRM, &sa, NULL);
+
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_SIGNAL;
+        sev.sigev_signo = SIGALRM;
+        if (timer_create(CLOCK_MONOTONIC, &sev, &g_alarm) != 0)
+            return;
+        g_alarm_created = 1;
+    }
+
+    alarm_callback_ptr = callback;
+
+    // an it_value of zero would disarm, so a due alarm fires after 1 ns
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (ms % 1000) ? (long)(ms % 1000) * 1000 * 1000 : (ms == 0 ? 1 : 0);
+    timer_settime(g_alarm, 0, &its, NULL);
+}
+
+/* Time */
+uint64_t time_us_64(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 * 1000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+uint32_t time_us_32(void)
+{
+    return (uint32_t)time_us_64();
+}
+
+/* Delay */
+void wizchip_delay_ms(uint32_t ms)
+{
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000 * 1000};
+
+    nanosleep(&ts, NULL);
+}
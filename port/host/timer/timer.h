@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdint.h>
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Timeout */
+#define RECV_TIMEOUT (1000 * 10) // 10 seconds
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Timer */
+/*! \brief Initialize timer callback function
+ *  \ingroup timer
+ *
+ *  Start a host thread that calls the callback every millisecond.
+ *
+ *  \param callback the repeating timer callback function
+ */
+void wizchip_1ms_timer_initialize(void (*callback)(void));
+
+/* Time */
+/*! \brief Return the current time in microseconds
+ *  \ingroup timer
+ *
+ *  Stand-in for time_us_32() of the Pico SDK, based on CLOCK_MONOTONIC.
+ *
+ *  \return microseconds since an arbitrary point, wraps like the 32 bit RP2040 timer
+ */
+uint32_t time_us_32(void);
+
+/*! \brief Return the current time in microseconds
+ *  \ingroup timer
+ *
+ *  Stand-in for time_us_64() of the Pico SDK, based on CLOCK_MONOTONIC.
+ *
+ *  \return microseconds since an arbitrary point
+ */
+uint64_t time_us_64(void);
+
+/* Alarm */
+/*! \brief Call a function once after the given number of milliseconds
+ *  \ingroup timer
+ *
+ *  One-shot POSIX timer, a pending one is cancelled first. Unlike the 1 ms timer it interrupts
+ *  the core only at the deadline, e.g. the ones coapServer_nextTimeoutMs() and coapClient_nextTimeoutMs() return. It raises
+ *  SIGALRM, which is blocked except inside wizchip_gpio_interrupt_wait().
+ *
+ *  \param ms delay in milliseconds
+ *  \param callback called from the SIGALRM handler, may be NULL
+ */
+void wizchip_alarm_ms(uint32_t ms, void (*callback)(void));
+
+/* Delay */
+/*! \brief Wait for the given number of milliseconds before returning
+ *  \ingroup timer
+ *
+ *  \param ms the number of milliseconds to sleep
+ */
+void wizchip_delay_ms(uint32_t ms);
+
+#endif /* _TIMER_H_ */
@@ -24,6 +24,10 @@
 static struct repeating_timer g_timer;
 void (*callback_ptr)(void);
 
+/* Alarm */
+static alarm_id_t g_alarm = 0;
+static void (*alarm_callback_ptr)(void);
+
 /**
  * ----------------------------------------------------------------------------------------------------
  * Functions
@@ -44,6 +48,30 @@ bool wizchip_1ms_timer_callback(struct repeating_timer *t)
     }
 }
 
+/* Alarm */
+static int64_t wizchip_alarm_callback(alarm_id_t id, void *user_data)
+{
+    g_alarm = 0;
+
+    if (alarm_callback_ptr != NULL)
+    {
+        alarm_callback_ptr();
+    }
+
+    return 0; // one-shot
+}
+
+void wizchip_alarm_ms(uint32_t ms, void (*callback)(void))
+{
+    if (g_alarm > 0)
+    {
+        cancel_alarm(g_alarm);
+    }
+
+    alarm_callback_ptr = callback;
+    g_alarm = add_alarm_in_ms(ms, wizchip_alarm_callback, NULL, true);
+}
+
 /* Delay */
 void wizchip_delay_ms(uint32_t ms)
 {
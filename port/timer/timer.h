@@ -39,6 +39,18 @@ void wizchip_1ms_timer_initialize(void (*callback)(void));
  */
 bool wizchip_1ms_timer_callback(struct repeating_timer *t);
 
+/* Alarm */
+/*! \brief Call a function once after the given number of milliseconds
+ *  \ingroup timer
+ *
+ *  One-shot hardware alarm, a pending one is cancelled first. Unlike the 1 ms timer it interrupts
+ *  the core only at the deadline, e.g. the ones coapServer_nextTimeoutMs() and coapClient_nextTimeoutMs() return.
+ *
+ *  \param ms delay in milliseconds
+ *  \param callback called from the alarm interrupt, may be NULL to only wake the core
+ */
+void wizchip_alarm_ms(uint32_t ms, void (*callback)(void));
+
 /* Delay */
 /*! \brief Wait for the given number of milliseconds before returning
  *  \ingroup timer
@@ -0,0 +1,356 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "port_common.h"
+
+#include "coapServer.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Buffer */
+#define BENCH_BUF_MAX_SIZE (1024 * 2)
+
+/* Default number of packets per stage */
+#define BENCH_ITERATIONS 1000000
+
+/* Output format */
+#define BENCH_OUTPUT_TEXT 0
+#define BENCH_OUTPUT_CSV 1
+#define BENCH_OUTPUT_JSON 2
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Corpus */
+typedef struct
+{
+    const char *name;
+    uint8_t buf[BENCH_BUF_MAX_SIZE];
+    size_t len;
+} bench_corpus_t;
+
+static bench_corpus_t g_corpus[3];
+static const size_t g_corpus_count = sizeof(g_corpus) / sizeof(g_corpus[0]);
+
+/* Stage */
+typedef struct
+{
+    const char *name;
+    int (*run)(const bench_corpus_t *c);
+} bench_stage_t;
+
+/* Keeps the compiler from dropping the measured work */
+static volatile uint32_t g_sink;
+
+static uint8_t g_arena_buf[128];
+static coap_arena_t g_arena = COAP_ARENA_INIT(g_arena_buf, sizeof(g_arena_buf));
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Clock */
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Corpus */
+static int bench_add_path(coap_option_writer_t *w, const char *path)
+{
+    const char *seg, *end;
+    int rc;
+
+    for (seg = path; *seg != '\0'; seg = end)
+    {
+        while (*seg == '/')
+            seg++;
+        for (end = seg; *end != '\0' && *end != '/'; end++)
+            ;
+        if (end != seg && 0 != (rc = coap_option_add(w, COAP_OPTION_URI_PATH, (const uint8_t *)seg, end - seg)))
+            return rc;
+    }
+
+    return 0;
+}
+
+static int bench_make_request(bench_corpus_t *c, const char *name, coap_method_t method, coap_msgtype_t type,
+                              const uint8_t *opts, size_t opts_len, const uint8_t *payload, size_t payload_len)
+{
+    static const uint8_t token[4] = {0xde, 0xad, 0xbe, 0xef};
+    coap_packet_t pkt;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = 0x01;
+    pkt.hdr.t = type;
+    pkt.hdr.tkl = sizeof(token);
+    pkt.hdr.code = method;
+    pkt.hdr.id[0] = 0x12;
+    pkt.hdr.id[1] = 0x34;
+    pkt.tok.p = token;
+    pkt.tok.len = sizeof(token);
+    pkt.opts.p = opts;
+    pkt.opts.len = opts_len;
+    pkt.payload.p = payload;
+    pkt.payload.len = payload_len;
+
+    c->name = name;
+    c->len = sizeof(c->buf);
+
+    return coap_build(c->buf, &c->len, &pkt);
+}
+
+static int bench_make_corpus(void)
+{
+    static const uint8_t content_format[1] = {COAP_CONTENTTYPE_TEXT_PLAIN};
+    static const uint8_t accept[1] = {COAP_CONTENTTYPE_APPLICATION_LINKFORMAT};
+    static const uint8_t etag[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    static const uint8_t uri_port[2] = {0x16, 0x33};
+    static const char payload[] = "The quick brown fox jumps over the lazy dog, twice. The quick brown fox jumps over the lazy dog.";
+    static const char *queries[] = {"rt=core.s", "if=sensor", "ct=0", "title=temperature", "anchor=coap://example"};
+    uint8_t opts[3][256];
+    coap_option_writer_t w;
+    size_t i;
+    int rc = 0;
+
+    /* Discovery : GET /.well-known/core */
+    coap_option_writer_init(&w, opts[0], sizeof(opts[0]));
+    rc |= bench_add_path(&w, ".well-known/core");
+    rc |= bench_make_request(&g_corpus[0], "discovery_get", COAP_METHOD_GET, COAP_TYPE_CON, opts[0], w.p - opts[0], NULL, 0);
+
+    /* PUT /example_data with a text payload */
+    coap_option_writer_init(&w, opts[1], sizeof(opts[1]));
+    rc |= bench_add_path(&w, "example_data");
+    rc |= coap_option_add(&w, COAP_OPTION_CONTENT_FORMAT, content_format, sizeof(content_format));
+    rc |= bench_make_request(&g_corpus[1], "put_payload", COAP_METHOD_PUT, COAP_TYPE_CON, opts[1], w.p - opts[1],
+                             (const uint8_t *)payload, sizeof(payload) - 1);
+
+    /* Many options : GET /.well-known/core behind a proxy style option set */
+    coap_option_writer_init(&w, opts[2], sizeof(opts[2]));
+    rc |= coap_option_add(&w, COAP_OPTION_IF_MATCH, etag, sizeof(etag));
+    rc |= coap_option_add(&w, COAP_OPTION_URI_HOST, (const uint8_t *)"coap.example.net", 16);
+    rc |= coap_option_add(&w, COAP_OPTION_ETAG, etag, 4);
+    rc |= coap_option_add(&w, COAP_OPTION_ETAG, etag + 4, 4);
+    rc |= coap_option_add(&w, COAP_OPTION_URI_PORT, uri_port, sizeof(uri_port));
+    rc |= bench_add_path(&w, ".well-known/core");
+    for (i = 0; i < sizeof(queries) / sizeof(queries[0]); i++)
+        rc |= coap_option_add(&w, COAP_OPTION_URI_QUERY, (const uint8_t *)queries[i], strlen(queries[i]));
+    rc |= coap_option_add(&w, COAP_OPTION_ACCEPT, accept, sizeof(accept));
+    rc |= bench_make_request(&g_corpus[2], "many_options", COAP_METHOD_GET, COAP_TYPE_CON, opts[2], w.p - opts[2], NULL, 0);
+
+    return rc;
+}
+
+/* Stage */
+static int bench_stage_parse(const bench_corpus_t *c)
+{
+    coap_packet_t pkt;
+    int rc;
+
+    rc = coap_parse(&pkt, c->buf, c->len);
+    g_sink += pkt.opts.len;
+
+    return rc;
+}
+
+static int bench_stage_options(const bench_corpus_t *c)
+{
+    coap_packet_t pkt;
+    coap_option_iter_t it;
+    coap_option_t opt;
+    int rc;
+
+    if (0 != (rc = coap_parse(&pkt, c->buf, c->len)))
+        return rc;
+
+    coap_option_iter_init(&it, &pkt);
+    while (coap_option_next(&it, &opt))
+        g_sink += opt.num + opt.buf.len;
+
+    return 0;
+}
+
+static int bench_stage_find(const bench_corpus_t *c)
+{
+    coap_packet_t pkt;
+    coap_option_iter_t it;
+    int rc;
+
+    if (0 != (rc = coap_parse(&pkt, c->buf, c->len)))
+        return rc;
+
+    g_sink += coap_findOptions(&pkt, COAP_OPTION_URI_PATH, &it);
+
+    return 0;
+}
+
+static int bench_stage_route(const bench_corpus_t *c)
+{
+    coap_packet_t pkt, rsppkt;
+    int rc;
+
+    if (0 != (rc = coap_parse(&pkt, c->buf, c->len)))
+        return rc;
+    coap_arena_reset(&g_arena, 0);
+    if (0 != (rc = coap_handle_req(&g_arena, &pkt, &rsppkt)))
+        return rc;
+    g_sink += rsppkt.hdr.code;
+
+    return 0;
+}
+
+static int bench_stage_build(const bench_corpus_t *c)
+{
+    uint8_t buf[BENCH_BUF_MAX_SIZE];
+    size_t len = sizeof(buf);
+    coap_packet_t pkt, rsppkt;
+    int rc;
+
+    if (0 != (rc = coap_parse(&pkt, c->buf, c->len)))
+        return rc;
+    coap_arena_reset(&g_arena, 0);
+    if (0 != (rc = coap_handle_req(&g_arena, &pkt, &rsppkt)))
+        return rc;
+    if (0 != (rc = coap_build(buf, &len, &rsppkt)))
+        return rc;
+    g_sink += len;
+
+    return 0;
+}
+
+/* Stages are cumulative, so the cost of a stage is its number minus the one above it */
+static const bench_stage_t g_stage[] = {
+    {"parse", bench_stage_parse},
+    {"options", bench_stage_options},
+    {"find", bench_stage_find},
+    {"route", bench_stage_route},
+    {"build", bench_stage_build},
+};
+
+static void bench_usage(const char *prog)
+{
+    printf("usage: %s [-n iterations] [-f text|csv|json]\n", prog);
+}
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[])
+{
+    uint32_t iterations = BENCH_ITERATIONS;
+    int format = BENCH_OUTPUT_TEXT;
+    uint64_t start, elapsed;
+    double ns_per_pkt;
+    size_t c, s;
+    uint32_t i;
+    int first = 1;
+    int rc;
+
+    for (i = 1; i < (uint32_t)argc; i++)
+    {
+        if (0 == strcmp(argv[i], "-n") && i + 1 < (uint32_t)argc)
+            iterations = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (0 == strcmp(argv[i], "-f") && i + 1 < (uint32_t)argc)
+        {
+            i++;
+            if (0 == strcmp(argv[i], "csv"))
+                format = BENCH_OUTPUT_CSV;
+            else if (0 == strcmp(argv[i], "json"))
+                format = BENCH_OUTPUT_JSON;
+            else if (0 == strcmp(argv[i], "text"))
+                format = BENCH_OUTPUT_TEXT;
+            else
+            {
+                bench_usage(argv[0]);
+                return 1;
+            }
+        }
+        else
+        {
+            bench_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations == 0)
+        iterations = 1;
+
+    endpoint_setup();
+    coap_setup();
+
+    if (0 != (rc = bench_make_corpus()))
+    {
+        printf("corpus build failed rc=%d\n", rc);
+        return 1;
+    }
+
+    if (format == BENCH_OUTPUT_CSV)
+        printf("corpus,bytes,stage,iterations,ns_per_pkt,pkts_per_s\n");
+    else if (format == BENCH_OUTPUT_JSON)
+        printf("{\"iterations\":%u,\"results\":[", iterations);
+    else
+        printf("%-16s %6s %-8s %12s %14s\n", "corpus", "bytes", "stage", "ns/pkt", "pkts/s");
+
+    for (c = 0; c < g_corpus_count; c++)
+    {
+        for (s = 0; s < sizeof(g_stage) / sizeof(g_stage[0]); s++)
+        {
+            // one untimed pass to check the stage works on this corpus
+            if (0 != (rc = g_stage[s].run(&g_corpus[c])))
+            {
+                printf("%s/%s failed rc=%d\n", g_corpus[c].name, g_stage[s].name, rc);
+                return 1;
+            }
+
+            start = bench_now_ns();
+            for (i = 0; i < iterations; i++)
+                g_stage[s].run(&g_corpus[c]);
+            elapsed = bench_now_ns() - start;
+
+            ns_per_pkt = (double)elapsed / iterations;
+
+            if (format == BENCH_OUTPUT_CSV)
+                printf("%s,%u,%s,%u,%.2f,%.0f\n", g_corpus[c].name, (unsigned)g_corpus[c].len, g_stage[s].name,
+                       iterations, ns_per_pkt, 1e9 / ns_per_pkt);
+            else if (format == BENCH_OUTPUT_JSON)
+            {
+                printf("%s{\"corpus\":\"%s\",\"bytes\":%u,\"stage\":\"%s\",\"ns_per_pkt\":%.2f,\"pkts_per_s\":%.0f}",
+                       first ? "" : ",", g_corpus[c].name, (unsigned)g_corpus[c].len, g_stage[s].name, ns_per_pkt,
+                       1e9 / ns_per_pkt);
+                first = 0;
+            }
+            else
+                printf("%-16s %6u %-8s %12.2f %14.0f\n", g_corpus[c].name, (unsigned)g_corpus[c].len, g_stage[s].name,
+                       ns_per_pkt, 1e9 / ns_per_pkt);
+        }
+    }
+
+    if (format == BENCH_OUTPUT_JSON)
+        printf("]}\n");
+
+    return 0;
+}
@@ -0,0 +1,482 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#define _GNU_SOURCE /* ppoll */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "coapClient.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Buffer */
+#define LOAD_BUF_MAX_SIZE (1024 * 2)
+#define LOAD_PAYLOAD_MAX_SIZE 1024
+
+/* Requests in flight, a power of two. The token is the request number, its low bits the slot */
+#define LOAD_SLOTS 65536
+#define LOAD_SLOT_MASK (LOAD_SLOTS - 1)
+
+/* Defaults */
+#define LOAD_DEFAULT_PORT 5683
+#define LOAD_DEFAULT_SECONDS 10
+#define LOAD_DEFAULT_CONCURRENCY 1
+#define LOAD_DEFAULT_TIMEOUT_MS 2000
+#define LOAD_DEFAULT_PAYLOAD 16
+#define LOAD_DEFAULT_PATH "example_data"
+
+/* Output format */
+#define LOAD_OUTPUT_TEXT 0
+#define LOAD_OUTPUT_CSV 1
+#define LOAD_OUTPUT_JSON 2
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Request kinds of the mix */
+typedef struct
+{
+    const char *name;
+    coap_msgtype_t type;
+    coap_method_t method;
+    uint32_t weight;
+    uint32_t sent;
+} load_kind_t;
+
+static load_kind_t g_kind[] = {
+    {"con-get", COAP_TYPE_CON, COAP_METHOD_GET, 1, 0},
+    {"non-get", COAP_TYPE_NONCON, COAP_METHOD_GET, 0, 0},
+    {"con-put", COAP_TYPE_CON, COAP_METHOD_PUT, 0, 0},
+    {"non-put", COAP_TYPE_NONCON, COAP_METHOD_PUT, 0, 0},
+};
+static const size_t g_kind_count = sizeof(g_kind) / sizeof(g_kind[0]);
+
+/* Request in flight */
+typedef struct
+{
+    uint64_t sent_us;
+    uint32_t number;            /* request number + 1, 0 when the slot is free */
+} load_slot_t;
+
+static load_slot_t g_slot[LOAD_SLOTS];
+
+/* Counters */
+typedef struct
+{
+    uint32_t sent;
+    uint32_t received;          /* responses matched to a request in flight */
+    uint32_t errors;            /* 4.xx, 5.xx and resets */
+    uint32_t lost;              /* no response within the timeout */
+    uint32_t late;              /* responses after the timeout or duplicates */
+    uint32_t send_failed;
+    uint64_t last_us;           /* time of the last response */
+    uint32_t *latency_us;       /* latency of every response, sorted at the end */
+    size_t latency_size;
+} load_result_t;
+
+static load_result_t g_result;
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Clock */
+static uint64_t load_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Mix : kind=weight,... e.g. con-get=7,non-put=3 */
+static int load_parse_mix(const char *mix)
+{
+    char buf[128], *item, *save = NULL, *eq;
+    uint32_t total = 0;
+    size_t k;
+
+    snprintf(buf, sizeof(buf), "%s", mix);
+    for (k = 0; k < g_kind_count; k++)
+        g_kind[k].weight = 0;
+    for (item = strtok_r(buf, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        if ((eq = strchr(item, '=')) != NULL)
+            *eq++ = '\0';
+        for (k = 0; k < g_kind_count; k++)
+        {
+            if (0 == strcmp(item, g_kind[k].name))
+                break;
+        }
+        if (k == g_kind_count)
+            return -1;
+        g_kind[k].weight = (eq != NULL) ? (uint32_t)strtoul(eq, NULL, 0) : 1;
+        total += g_kind[k].weight;
+    }
+
+    return (total > 0) ? 0 : -1;
+}
+
+/* Deterministic pick, request n gets kind k for weight[k] of every total requests */
+static load_kind_t *load_pick(uint32_t n)
+{
+    uint32_t total = 0, pos;
+    size_t k;
+
+    for (k = 0; k < g_kind_count; k++)
+        total += g_kind[k].weight;
+    pos = n % total;
+    for (k = 0; k < g_kind_count; k++)
+    {
+        if (pos < g_kind[k].weight)
+            break;
+        pos -= g_kind[k].weight;
+    }
+
+    return &g_kind[k];
+}
+
+/* Requests */
+static int load_send(int fd, const struct sockaddr_in *addr, const char *path, const uint8_t *payload, size_t payload_len, uint32_t n, uint64_t now)
+{
+    load_kind_t *kind = load_pick(n);
+    uint8_t scratch_buf[64], tok_buf[4], buf[LOAD_BUF_MAX_SIZE];
+    coap_rw_buffer_t scratch = {scratch_buf, sizeof(scratch_buf)};
+    coap_buffer_t tok = {tok_buf, sizeof(tok_buf)};
+    coap_packet_t pkt;
+    size_t len = sizeof(buf);
+    int rc;
+
+    tok_buf[0] = n >> 24;
+    tok_buf[1] = (n >> 16) & 0xFF;
+    tok_buf[2] = (n >> 8) & 0xFF;
+    tok_buf[3] = n & 0xFF;
+
+    if (kind->method == COAP_METHOD_PUT)
+        rc = coap_make_request(&scratch, &pkt, (const uint8_t *)path, strlen(path), payload, payload_len, (n >> 8) & 0xFF, n & 0xFF, &tok, COAP_METHOD_PUT, COAP_CONTENTTYPE_TEXT_PLAIN);
+    else
+        rc = coap_make_request(&scratch, &pkt, (const uint8_t *)path, strlen(path), NULL, 0, (n >> 8) & 0xFF, n & 0xFF, &tok, COAP_METHOD_GET, COAP_CONTENTTYPE_NONE);
+    if (rc != 0)
+        return rc;
+    pkt.hdr.t = kind->type;
+    if ((rc = coap_build(buf, &len, &pkt)) != 0)
+        return rc;
+
+    g_slot[n & LOAD_SLOT_MASK].sent_us = now;
+    g_slot[n & LOAD_SLOT_MASK].number = n + 1;
+    g_result.sent++;
+    kind->sent++;
+    if (sendto(fd, buf, len, 0, (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+        g_result.send_failed++;
+
+    return 0;
+}
+
+static void load_latency(uint32_t us)
+{
+    if (g_result.received == g_result.latency_size)
+    {
+        g_result.latency_size = g_result.latency_size ? g_result.latency_size * 2 : 4096;
+        g_result.latency_us = realloc(g_result.latency_us, g_result.latency_size * sizeof(*g_result.latency_us));
+        if (g_result.latency_us == NULL)
+        {
+            printf("out of memory\n");
+            exit(1);
+        }
+    }
+    g_result.latency_us[g_result.received] = us;
+}
+
+/* Matches a response by its token, returns true if it completed a request in flight */
+static int load_receive(int fd, const struct sockaddr_in *addr, const uint8_t *buf, size_t len, uint64_t now)
+{
+    coap_packet_t pkt;
+    load_slot_t *slot;
+    uint32_t n;
+
+    if (coap_parse(&pkt, buf, len) != 0)
+        return 0;
+    // an empty ACK of a separate response, the response itself comes later
+    if (pkt.hdr.code == 0 && pkt.hdr.t == COAP_TYPE_ACK)
+        return 0;
+    if (pkt.tok.len != 4)
+        return 0;
+    n = ((uint32_t)pkt.tok.p[0] << 24) | ((uint32_t)pkt.tok.p[1] << 16) | ((uint32_t)pkt.tok.p[2] << 8) | pkt.tok.p[3];
+    slot = &g_slot[n & LOAD_SLOT_MASK];
+    if (slot->number != n + 1)
+    {
+        g_result.late++;
+        return 0;
+    }
+    // a separate CON response is acknowledged, so the server stops retransmitting it
+    if (pkt.hdr.t == COAP_TYPE_CON)
+    {
+        uint8_t ack[4] = {0x60, 0x00, pkt.hdr.id[0], pkt.hdr.id[1]};
+
+        sendto(fd, ack, sizeof(ack), 0, (const struct sockaddr *)addr, sizeof(*addr));
+    }
+
+    load_latency((uint32_t)(now - slot->sent_us));
+    slot->number = 0;
+    g_result.last_us = now;
+    g_result.received++;
+    if (pkt.hdr.t == COAP_TYPE_RESET || (pkt.hdr.code >> 5) >= 4)
+        g_result.errors++;
+
+    return 1;
+}
+
+static int load_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t load_percentile(uint32_t permille)
+{
+    size_t i = ((size_t)g_result.received * permille + 999) / 1000;
+
+    if (g_result.received == 0)
+        return 0;
+
+    return g_result.latency_us[(i > 0) ? i - 1 : 0];
+}
+
+static void load_usage(const char *prog)
+{
+    printf("usage: %s <server ip> [-p port] [-u path] [-d seconds] [-r rate | -c concurrency]\n", prog);
+    printf("       [-m kind=weight,...] [-s payload bytes] [-t timeout ms] [-f text|csv|json]\n");
+    printf("kinds: con-get, non-get, con-put, non-put\n");
+}
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[])
+{
+    static uint8_t payload[LOAD_PAYLOAD_MAX_SIZE];
+    struct sockaddr_in addr;
+    struct pollfd pfd;
+    struct timespec wait;
+    uint8_t buf[LOAD_BUF_MAX_SIZE];
+    const char *path = LOAD_DEFAULT_PATH;
+    uint16_t port = LOAD_DEFAULT_PORT;
+    uint32_t seconds = LOAD_DEFAULT_SECONDS;
+    uint32_t concurrency = LOAD_DEFAULT_CONCURRENCY;
+    uint32_t rate = 0;
+    uint32_t timeout_ms = LOAD_DEFAULT_TIMEOUT_MS;
+    size_t payload_len = LOAD_DEFAULT_PAYLOAD;
+    int format = LOAD_OUTPUT_TEXT;
+    uint64_t start, now, end, next_send, elapsed;
+    uint32_t next = 0, oldest = 0, inflight = 0;
+    double throughput;
+    ssize_t len;
+    uint64_t wait_us;
+    int fd, i;
+    size_t k;
+
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        load_usage(argv[0]);
+        return 1;
+    }
+    for (i = 2; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            load_usage(argv[0]);
+            return 1;
+        }
+        if (0 == strcmp(argv[i], "-p"))
+            port = (uint16_t)strtoul(argv[++i], NULL, 0);
+        else if (0 == strcmp(argv[i], "-u"))
+            path = argv[++i];
+        else if (0 == strcmp(argv[i], "-d"))
+            seconds = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (0 == strcmp(argv[i], "-r"))
+            rate = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (0 == strcmp(argv[i], "-c"))
+            concurrency = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (0 == strcmp(argv[i], "-t"))
+            timeout_ms = (uint32_t)strtoul(argv[++i], NULL, 0);
+        else if (0 == strcmp(argv[i], "-s"))
+            payload_len = (size_t)strtoul(argv[++i], NULL, 0);
+        else if (0 == strcmp(argv[i], "-m"))
+        {
+            if (load_parse_mix(argv[++i]) != 0)
+            {
+                load_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (0 == strcmp(argv[i], "-f"))
+        {
+            i++;
+            if (0 == strcmp(argv[i], "csv"))
+                format = LOAD_OUTPUT_CSV;
+            else if (0 == strcmp(argv[i], "json"))
+                format = LOAD_OUTPUT_JSON;
+            else if (0 == strcmp(argv[i], "text"))
+                format = LOAD_OUTPUT_TEXT;
+            else
+            {
+                load_usage(argv[0]);
+                return 1;
+            }
+        }
+        else
+        {
+            load_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (concurrency == 0)
+        concurrency = 1;
+    if (concurrency > LOAD_SLOTS)
+        concurrency = LOAD_SLOTS;
+    if (payload_len > sizeof(payload))
+        payload_len = sizeof(payload);
+    memset(payload, 'x', payload_len);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, argv[1], &addr.sin_addr) != 1)
+    {
+        printf("bad address %s\n", argv[1]);
+        return 1;
+    }
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return 1;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    start = load_now_us();
+    end = start + (uint64_t)seconds * 1000000ull;
+    next_send = start;
+    now = start;
+
+    // open loop with -r, a request every 1/rate s whatever the responses do.
+    // Closed loop otherwise, a new request as soon as one of the concurrency in flight completes.
+    // Requests are sent once, a CON request not answered within the timeout counts as lost.
+    while (now < end || inflight > 0)
+    {
+        // requests in flight time out in the order they were sent
+        while (oldest != next)
+        {
+            load_slot_t *slot = &g_slot[oldest & LOAD_SLOT_MASK];
+
+            if (slot->number == oldest + 1)
+            {
+                if (now - slot->sent_us < (uint64_t)timeout_ms * 1000)
+                    break;
+                slot->number = 0;
+                g_result.lost++;
+                inflight--;
+            }
+            oldest++;
+        }
+
+        if (now < end && next - oldest < LOAD_SLOTS)
+        {
+            if (rate > 0)
+            {
+                while (now >= next_send && next - oldest < LOAD_SLOTS)
+                {
+                    if (load_send(fd, &addr, path, payload, payload_len, next++, now) != 0)
+                        return 1;
+                    inflight++;
+                    next_send = start + (uint64_t)next * 1000000ull / rate;
+                }
+            }
+            else
+            {
+                while (inflight < concurrency)
+                {
+                    if (load_send(fd, &addr, path, payload, payload_len, next++, now) != 0)
+                        return 1;
+                    inflight++;
+                }
+            }
+        }
+
+        // sleeps to the next send rather than spinning, a spinning sender delays a server on the same core
+        if (rate > 0 && now < end)
+            wait_us = (next_send > now) ? next_send - now : 0;
+        else
+            wait_us = 10000;
+        wait.tv_sec = wait_us / 1000000;
+        wait.tv_nsec = (long)(wait_us % 1000000) * 1000;
+        if (ppoll(&pfd, 1, &wait, NULL) > 0)
+        {
+            while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+                inflight -= load_receive(fd, &addr, buf, (size_t)len, load_now_us());
+        }
+        now = load_now_us();
+    }
+    // throughput over the send window, or up to the last response, not the timeout at the end
+    elapsed = ((g_result.last_us > end) ? g_result.last_us : end) - start;
+    close(fd);
+
+    qsort(g_result.latency_us, g_result.received, sizeof(*g_result.latency_us), load_cmp);
+    throughput = (double)g_result.received * 1000000.0 / (double)(elapsed ? elapsed : 1);
+
+    if (format == LOAD_OUTPUT_CSV)
+    {
+        printf("sent,received,errors,lost,late,send_failed,loss_pct,rsp_per_s,p50_us,p99_us,p999_us,max_us\n");
+        printf("%u,%u,%u,%u,%u,%u,%.3f,%.0f,%u,%u,%u,%u\n", g_result.sent, g_result.received, g_result.errors, g_result.lost,
+               g_result.late, g_result.send_failed, g_result.sent ? 100.0 * g_result.lost / g_result.sent : 0.0, throughput,
+               load_percentile(500), load_percentile(990), load_percentile(999), load_percentile(1000));
+    }
+    else if (format == LOAD_OUTPUT_JSON)
+    {
+        printf("{\"sent\":%u,\"received\":%u,\"errors\":%u,\"lost\":%u,\"late\":%u,\"send_failed\":%u,\"loss_pct\":%.3f,"
+               "\"rsp_per_s\":%.0f,\"p50_us\":%u,\"p99_us\":%u,\"p999_us\":%u,\"max_us\":%u}\n",
+               g_result.sent, g_result.received, g_result.errors, g_result.lost, g_result.late, g_result.send_failed,
+               g_result.sent ? 100.0 * g_result.lost / g_result.sent : 0.0, throughput,
+               load_percentile(500), load_percentile(990), load_percentile(999), load_percentile(1000));
+    }
+    else
+    {
+        printf("%s %u requests in %.2f s,", rate ? "open loop" : "closed loop", g_result.sent, elapsed / 1000000.0);
+        for (k = 0; k < g_kind_count; k++)
+        {
+            if (g_kind[k].sent != 0)
+                printf(" %s %u", g_kind[k].name, g_kind[k].sent);
+        }
+        printf("\n");
+        printf("received %u, errors %u, lost %u (%.3f %%), late %u, send failed %u\n", g_result.received, g_result.errors,
+               g_result.lost, g_result.sent ? 100.0 * g_result.lost / g_result.sent : 0.0, g_result.late, g_result.send_failed);
+        printf("throughput %.0f responses/s\n", throughput);
+        printf("latency us p50 %u p99 %u p99.9 %u max %u\n", load_percentile(500), load_percentile(990), load_percentile(999),
+               load_percentile(1000));
+    }
+
+    return 0;
+}
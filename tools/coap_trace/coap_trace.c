@@ -0,0 +1,288 @@
+/**
+ * Copyright (c) 2021 WIZnet Co.,Ltd
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Includes
+ * ----------------------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "coapTrace.h"
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Macros
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Buffer */
+#define TRACE_BUF_MAX_SIZE (1024 * 2)
+
+/* Events kept for the analysis */
+#define TRACE_EVENTS_MAX (1024 * 1024)
+
+/* Polling of GET /trace */
+#define TRACE_POLL_MS 50
+#define TRACE_TIMEOUT_MS 500
+#define TRACE_DEFAULT_SECONDS 10
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Variables
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Events in the order they were recorded, without gaps between fetches */
+static coap_trace_event_t *g_events;
+static size_t g_count;
+static uint32_t g_next;     /* index of the next event not seen yet */
+static uint32_t g_lost;     /* events overwritten before they were fetched */
+
+/* Phase durations */
+typedef struct
+{
+    uint32_t *us;
+    size_t count;
+    size_t size;
+} trace_samples_t;
+
+static trace_samples_t g_samples[COAP_TRACE_PHASES];
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Functions
+ * ----------------------------------------------------------------------------------------------------
+ */
+/* Events */
+static void trace_add(uint32_t index, const coap_trace_event_t *e)
+{
+    if (index < g_next || g_count == TRACE_EVENTS_MAX)
+        return;
+    if (index > g_next && g_count > 0)
+        g_lost += index - g_next;
+    g_events[g_count++] = *e;
+    g_next = index + 1;
+}
+
+/* GET /trace : total (4), then us (4), seq (2) and phase (2) per event, big endian */
+static int trace_fetch(int fd, const struct sockaddr_in *addr, uint16_t msgid)
+{
+    uint8_t req[] = {0x40, 0x01, 0x00, 0x00, 0xB5, 't', 'r', 'a', 'c', 'e'};
+    uint8_t rsp[TRACE_BUF_MAX_SIZE];
+    struct pollfd pfd = {fd, POLLIN, 0};
+    coap_trace_event_t e;
+    uint32_t total, first;
+    size_t n, i, pos;
+    ssize_t len;
+
+    req[2] = msgid >> 8;
+    req[3] = msgid & 0xFF;
+    if (sendto(fd, req, sizeof(req), 0, (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+        return -1;
+
+    for (;;)
+    {
+        if (poll(&pfd, 1, TRACE_TIMEOUT_MS) <= 0)
+            return -1;
+        if ((len = recv(fd, rsp, sizeof(rsp), 0)) < 4)
+            continue;
+        // the answer to this request, a late one of an earlier request is dropped
+        if (rsp[2] == req[2] && rsp[3] == req[3])
+            break;
+    }
+    if (rsp[1] != 0x45)
+    {
+        printf("GET /trace answered %u.%02u, server built without COAP_TRACE?\n", rsp[1] >> 5, rsp[1] & 0x1F);
+        return -2;
+    }
+
+    // payload after the token, the options and the 0xFF marker
+    for (pos = 4 + (rsp[0] & 0x0F); pos < (size_t)len && rsp[pos] != 0xFF; pos++)
+        ;
+    if (++pos + 4 > (size_t)len)
+        return -1;
+    total = ((uint32_t)rsp[pos] << 24) | ((uint32_t)rsp[pos + 1] << 16) | ((uint32_t)rsp[pos + 2] << 8) | rsp[pos + 3];
+    pos += 4;
+    n = ((size_t)len - pos) / 8;
+    first = total - (uint32_t)n;
+
+    for (i = 0; i < n; i++, pos += 8)
+    {
+        e.us = ((uint32_t)rsp[pos] << 24) | ((uint32_t)rsp[pos + 1] << 16) | ((uint32_t)rsp[pos + 2] << 8) | rsp[pos + 3];
+        e.seq = (uint16_t)((rsp[pos + 4] << 8) | rsp[pos + 5]);
+        e.phase = (uint16_t)((rsp[pos + 6] << 8) | rsp[pos + 7]);
+        trace_add(first + (uint32_t)i, &e);
+    }
+
+    return 0;
+}
+
+static int trace_poll(const char *ip, uint16_t port, uint32_t seconds)
+{
+    struct sockaddr_in addr;
+    struct timespec delay = {0, TRACE_POLL_MS * 1000000L};
+    uint32_t rounds = seconds * (1000 / TRACE_POLL_MS);
+    uint16_t msgid = (uint16_t)time(NULL);
+    int fd, rc = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1)
+    {
+        printf("bad address %s\n", ip);
+        return -1;
+    }
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return -1;
+
+    // each response carries the newest events, events recorded faster than they are polled are counted as lost
+    while (rounds-- > 0)
+    {
+        if ((rc = trace_fetch(fd, &addr, msgid++)) == -2)
+            break;
+        nanosleep(&delay, NULL);
+    }
+
+    close(fd);
+
+    return (rc == -2) ? -1 : 0;
+}
+
+/* Lines of coap_trace_dump() : trace <index> <seq> <phase> <us> */
+static void trace_read_dump(FILE *in)
+{
+    char line[256], name[32];
+    unsigned int index, seq, us;
+    coap_trace_event_t e;
+    uint8_t phase;
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        if (sscanf(line, "trace %u %u %31s %u", &index, &seq, name, &us) != 4)
+            continue;
+        for (phase = 0; phase < COAP_TRACE_PHASES; phase++)
+        {
+            if (0 == strcmp(name, coap_trace_phase_name(phase)))
+                break;
+        }
+        if (phase == COAP_TRACE_PHASES)
+            continue;
+        e.us = us;
+        e.seq = (uint16_t)seq;
+        e.phase = phase;
+        trace_add(index, &e);
+    }
+}
+
+/* Analysis */
+static void trace_sample(uint8_t phase, uint32_t us)
+{
+    trace_samples_t *s = &g_samples[phase];
+
+    if (s->count == s->size)
+    {
+        s->size = s->size ? s->size * 2 : 1024;
+        s->us = realloc(s->us, s->size * sizeof(*s->us));
+        if (s->us == NULL)
+        {
+            printf("out of memory\n");
+            exit(1);
+        }
+    }
+    s->us[s->count++] = us;
+}
+
+static int trace_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t trace_percentile(const trace_samples_t *s, uint32_t pct)
+{
+    size_t i = (s->count * pct + 99) / 100;
+
+    return s->us[(i > 0) ? i - 1 : 0];
+}
+
+/* The time from the previous event of a sequence to an event is the phase the event ends */
+static void trace_analyze(void)
+{
+    const coap_trace_event_t *e, *prev = NULL;
+    size_t i;
+    uint8_t p;
+
+    for (i = 0; i < g_count; i++)
+    {
+        e = &g_events[i];
+        if (prev != NULL && prev->seq == e->seq && e->phase < COAP_TRACE_PHASES)
+            trace_sample((uint8_t)e->phase, e->us - prev->us);
+        prev = e;
+    }
+
+    printf("%u events, %u lost\n", (unsigned)g_count, (unsigned)g_lost);
+    printf("%-14s %8s %8s %8s %8s %8s\n", "phase", "count", "p50 us", "p90 us", "p99 us", "max us");
+    for (p = 0; p < COAP_TRACE_PHASES; p++)
+    {
+        trace_samples_t *s = &g_samples[p];
+
+        if (s->count == 0)
+            continue;
+        qsort(s->us, s->count, sizeof(*s->us), trace_cmp);
+        printf("%-14s %8u %8u %8u %8u %8u\n", coap_trace_phase_name(p), (unsigned)s->count, trace_percentile(s, 50),
+               trace_percentile(s, 90), trace_percentile(s, 99), s->us[s->count - 1]);
+    }
+}
+
+static void trace_usage(const char *prog)
+{
+    printf("usage: %s <server ip> [port] [seconds]\n", prog);
+    printf("       %s -   reads coap_trace_dump() lines from stdin\n", prog);
+}
+
+/**
+ * ----------------------------------------------------------------------------------------------------
+ * Main
+ * ----------------------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[])
+{
+    uint16_t port = 5683;
+    uint32_t seconds = TRACE_DEFAULT_SECONDS;
+
+    if (argc < 2)
+    {
+        trace_usage(argv[0]);
+        return 1;
+    }
+    if ((g_events = malloc(TRACE_EVENTS_MAX * sizeof(*g_events))) == NULL)
+        return 1;
+
+    if (0 == strcmp(argv[1], "-"))
+        trace_read_dump(stdin);
+    else
+    {
+        if (argc > 2)
+            port = (uint16_t)strtoul(argv[2], NULL, 0);
+        if (argc > 3)
+            seconds = (uint32_t)strtoul(argv[3], NULL, 0);
+        if (trace_poll(argv[1], port, seconds) != 0)
+            return 1;
+    }
+
+    trace_analyze();
+
+    return 0;
+}